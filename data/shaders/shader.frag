@@ -0,0 +1,33 @@
+#version 450
+// -DBINDLESS:runtime sized array indexed per instance,needs descriptor indexing
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
+
+layout(set = 1,binding = 0) uniform sampler texSampler;
+#ifdef BINDLESS
+layout(set = 1,binding = 1) uniform texture2D textures[];
+#else
+#define TEXTURE_COUNT 16 // BindlessTextures::fallback_count
+layout(set = 1,binding = 1) uniform texture2D textures[TEXTURE_COUNT];
+#endif
+
+// 固定数组只能用整个draw都一样的下标
+layout(push_constant) uniform Material{
+    uint texture;
+} material;
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragUV;
+layout(location = 2) flat in uint fragTexture;
+
+layout(location = 0) out vec4 outColor;
+
+void main(){
+#ifdef BINDLESS
+    vec4 texel = texture(sampler2D(textures[nonuniformEXT(fragTexture)],texSampler),fragUV);
+#else
+    vec4 texel = texture(sampler2D(textures[material.texture],texSampler),fragUV);
+#endif
+    outColor = vec4(fragColor,1.0) * texel;
+}
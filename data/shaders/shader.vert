@@ -0,0 +1,24 @@
+#version 450
+
+layout(set = 0,binding = 0) uniform FrameUniforms{
+    mat4 transform;
+    vec4 time;
+} frame;
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec2 inOffset; // per instance
+layout(location = 3) in float inScale;
+layout(location = 4) in uint inTexture; // bindless slot
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragUV;
+layout(location = 2) flat out uint fragTexture;
+
+void main(){
+    gl_Position = frame.transform * vec4(inPosition * inScale + inOffset,0.0,1.0);
+    fragColor = inColor;
+    // 网格在[-0.5,0.5]里，直接拿位置当UV
+    fragUV = inPosition + 0.5;
+    fragTexture = inTexture;
+}
@@ -440,7 +440,7 @@ namespace g3{
     private:
         std::string head;///<头信息
         Logger* i;///<绑定的logger
-        int defLogType;///<默认的log level级别
+        static THREAD_LOCAL int defLogType;///<默认的log level级别，和cachedStr一样每个线程一份
         bool showContainerName;///< << 输出时是否显示容器名字
     public:
         static THREAD_LOCAL std::string cachedStr;///<缓存的数据 @todo Windows上THREADLOCAL目前无效,也许需要处理
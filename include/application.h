@@ -3,6 +3,24 @@
 #include <GLFW/glfw3.h>
 #include <vulkan/vulkan.h>
 #include <alib-g3/alogger.h>
+#include <glm/glm.hpp>
+#include <array>
+#include <mutex>
+#include <span>
+#include "bindless.h"
+#include "descriptors.h"
+#include "deletionqueue.h"
+#include "filewatcher.h"
+#include "vkdispatch.h"
+#include "pipelines.h"
+#include "profiler.h"
+#include "rendergraph.h"
+#include "simulation.h"
+#include "texturestream.h"
+#include "validationlog.h"
+#include "vkmemory.h"
+#include "vkutil.h"
+#include "workerpool.h"
 
 using namespace alib::g3;
 
@@ -13,6 +31,26 @@ constexpr const char * app_name = win_title;
 constexpr uint32_t app_version = VK_MAKE_VERSION(1,0,0);
 constexpr uint32_t app_api_version = VK_API_VERSION_1_0; 
 constexpr bool app_enable_validation = true;
+constexpr uint32_t app_frames_in_flight = 2; ///< default,can be overridden by --frames-in-flight
+constexpr uint32_t app_max_frames_in_flight = 8;
+constexpr double app_stat_interval = 2000; ///< ms between two frame statistics logs
+constexpr uint64_t app_headless_frames = 300; ///< frames rendered by --headless unless --headless-frames is given
+constexpr VkFormat app_headless_format = VK_FORMAT_R8G8B8A8_UNORM;
+constexpr const char * app_pipeline_cache_path = "data/pipeline.cache";
+constexpr VkDeviceSize app_staging_size = 32ull << 20; ///< staging buffer for uploads,used as two halves
+constexpr VkDeviceSize app_uniform_frame_size = 64ull << 10; ///< uniform ring bytes per frame in flight
+constexpr uint32_t app_bench_frames = 200; ///< frames measured per case by the benchmarks
+constexpr uint32_t app_bench_record_instances = 100000; ///< per object draws recorded by --bench-record
+constexpr uint32_t app_bench_dispatch_calls = 1000000; ///< commands recorded per run by --bench-dispatch
+constexpr uint32_t app_bench_cull_objects = 1000000; ///< instances culled by --bench-cull
+constexpr uint32_t app_cull_group_size = 256; ///< local_size_x of cull.comp
+constexpr uint32_t app_texture_count = 8; ///< procedural textures spread over the instances
+constexpr uint32_t app_texture_size = 64;
+constexpr VkDeviceSize app_stream_staging_size = 16ull << 20; ///< staging ring of the texture streamer
+constexpr VkDeviceSize app_stream_budget = 4ull << 20; ///< bytes streamed per frame unless --stream-budget is given
+constexpr uint32_t app_stream_texture_size = 512; ///< procedural textures of --stream-textures
+constexpr float app_fps_cap = 60; ///< frame rate of FramePacing::Capped unless --fps-cap is given
+constexpr double app_tick_rate = Simulation::default_rate; ///< simulation ticks per second unless --tick-rate is given
 
 static std::vector<const char *> app_validation_layers = {
     "VK_LAYER_KHRONOS_validation"
@@ -22,6 +60,107 @@ static std::vector<const char*> app_device_extensions = {
     VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
 
+/// Shaders rebuilt by the watcher thread,waiting for the next frame boundary
+struct ShaderReload{
+    PipelineKey key;
+    VkShaderModule vert { VK_NULL_HANDLE };
+    VkShaderModule frag { VK_NULL_HANDLE };
+};
+
+struct Vertex{
+    glm::vec2 pos;
+    glm::vec3 color;
+
+    static inline VkVertexInputBindingDescription binding(){
+        VkVertexInputBindingDescription desc {};
+        desc.binding = 0;
+        desc.stride = sizeof(Vertex);
+        desc.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+        return desc;
+    }
+
+    static inline std::array<VkVertexInputAttributeDescription,2> attributes(){
+        std::array<VkVertexInputAttributeDescription,2> desc {};
+        desc[0].binding = 0;
+        desc[0].location = 0;
+        desc[0].format = VK_FORMAT_R32G32_SFLOAT;
+        desc[0].offset = offsetof(Vertex,pos);
+        desc[1].binding = 0;
+        desc[1].location = 1;
+        desc[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+        desc[1].offset = offsetof(Vertex,color);
+        return desc;
+    }
+};
+
+/// Per instance attributes,vertex binding 1,matches the Instance block in cull.comp
+struct Instance{
+    glm::vec2 offset;
+    float scale;
+    uint32_t texture; ///< bindless slot
+
+    static inline VkVertexInputBindingDescription binding(){
+        VkVertexInputBindingDescription desc {};
+        desc.binding = 1;
+        desc.stride = sizeof(Instance);
+        desc.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+        return desc;
+    }
+
+    static inline std::array<VkVertexInputAttributeDescription,3> attributes(){
+        std::array<VkVertexInputAttributeDescription,3> desc {};
+        desc[0].binding = 1;
+        desc[0].location = 2;
+        desc[0].format = VK_FORMAT_R32G32_SFLOAT;
+        desc[0].offset = offsetof(Instance,offset);
+        desc[1].binding = 1;
+        desc[1].location = 3;
+        desc[1].format = VK_FORMAT_R32_SFLOAT;
+        desc[1].offset = offsetof(Instance,scale);
+        desc[2].binding = 1;
+        desc[2].location = 4;
+        desc[2].format = VK_FORMAT_R32_UINT;
+        desc[2].offset = offsetof(Instance,texture);
+        return desc;
+    }
+};
+
+/// How the instances of the mesh are drawn
+enum class DrawPath{
+    PerObject, ///< one vkCmdDrawIndexed per instance,for comparison
+    Instanced, ///< one vkCmdDrawIndexed with instanceCount
+    Indirect, ///< vkCmdDrawIndexedIndirect reading the draw from indirectBuffer
+    Culled ///< a compute pass culls the instances on the GPU and writes the indirect draw of the survivors
+};
+
+/// Per frame data,matches the uniform block in shader.vert
+struct FrameUniforms{
+    glm::mat4 transform;
+    glm::vec4 time; ///< x:seconds since start
+};
+
+/// Device local vertex and index buffers of one indexed mesh
+struct Mesh{
+    GpuBuffer vertices;
+    GpuBuffer indices;
+    uint32_t indexCount { 0 };
+    float radius { 0 }; ///< bounding circle around the origin
+};
+
+/// Sampled RGBA8 image registered in the bindless table
+struct Texture{
+    GpuImage image;
+    VkImageView view { VK_NULL_HANDLE };
+    uint32_t slot { BindlessTextures::none };
+};
+
+/// Streamed texture whose upload was submitted with frame serial,published once that frame completed
+struct PendingTexture{
+    Texture texture;
+    uint64_t serial { 0 };
+    std::string name;
+};
+
 struct Application{
     Logger logger;
     LogFactory lg;
@@ -31,26 +170,178 @@ struct Application{
     /// Vulkan Data
     VkInstance instance;
     VkDebugUtilsMessengerEXT debugMessenger;
-    VkSurfaceKHR surface;
+    ValidationLog validationLog; ///< debug messenger sink,logs through lg_v on its own thread
+    VkSurfaceKHR surface { VK_NULL_HANDLE };
     VkPhysicalDevice physicalDevice { VK_NULL_HANDLE };
     VkDevice device;
+    VkDispatch vkd; ///< per frame calls go through this instead of the loader
     VkQueue graphicsQueue;
     VkQueue presentQueue;
-    VkSwapchainKHR swapChain;
+    VkQueue transferQueue; ///< may be graphicsQueue when the device has no spare queue
+    VkQueue computeQueue; ///< may be graphicsQueue too
+    QueueFamilyIndices queueFamilies;
+    VkSwapchainKHR swapChain { VK_NULL_HANDLE };
     std::vector<VkImage> swapChainImages;
     VkFormat swapChainImageFormat;
     VkExtent2D swapChainExtent;
     std::vector<VkImageView> swapChainImageViews;
     VkRenderPass renderPass;
     VkPipelineLayout pipelineLayout;
-    VkPipeline graphicsPipeline;
+    VkPipeline graphicsPipeline; ///< pipelines.get(pipelineKey) of the current frame
+    PipelineLibrary pipelines;
+    DescriptorAllocator descriptors; ///< layouts and sets except the bindless table
+    PipelineKey pipelineKey;
+    VkShaderModule vertModule { VK_NULL_HANDLE };
+    VkShaderModule fragModule { VK_NULL_HANDLE };
+
+    /// Shader hot reload,pipelines are rebuilt on the watcher thread and swapped in by refreshPipelines
+    FileWatcher shaderWatcher;
+    std::mutex reloadLock; ///< guards pendingReload and writes of pipelineKey
+    std::optional<ShaderReload> pendingReload;
+    std::atomic<bool> reloadReady { false };
+    VkPipelineCache pipelineCache { VK_NULL_HANDLE };
+    bool pipelineCacheWarm { false }; ///< whether pipelineCache was seeded from disk
     std::vector<VkFramebuffer> swapChainFramebuffers;
     VkCommandPool pool;
-    VkCommandBuffer commandBuffer;
-    VkSemaphore sem_imgAva;
-    VkSemaphore sem_renderFin;
-    VkFence fen_inFlight;
 
+    /// Frames in flight
+    uint32_t framesInFlight { app_frames_in_flight };
+    uint32_t currentFrame { 0 };
+    std::vector<VkCommandBuffer> commandBuffers; ///< one per frame in flight
+    std::vector<VkSemaphore> sem_imgAva; ///< one per frame in flight
+    std::vector<VkFence> fen_inFlight; ///< one per frame in flight
+    std::vector<VkSemaphore> sem_renderFin; ///< one per swapchain image,presentation holds it until the image comes back
+    std::vector<VkFence> fen_imagesInFlight; ///< fence of the frame that last rendered to each swapchain image,not owned
+    uint64_t frameSerial { 0 }; ///< serial of the last submitted frame
+    uint64_t completedSerial { 0 }; ///< every frame up to this serial has finished on the GPU
+    std::vector<uint64_t> frameSerials; ///< serial last submitted from each frame slot
+    DeletionQueue deletionQueue; ///< objects retired mid session,flushed with completedSerial
+
+    /// Frame pacing
+    FramePacing pacing { FramePacing::Throughput };
+    float fpsCap { app_fps_cap };
+    double inputStamp { 0 }; ///< startClock ms when the input of the next frame was sampled
+    std::vector<double> inputStamps; ///< per frame slot,input time of the frame in flight,<0 once measured
+    double latencySum { 0 }; ///< input to GPU completion,ms,since the last stats
+    double latencyMax { 0 };
+    uint32_t latencyCount { 0 };
+
+    /// Swapchain rebuild
+    bool framebufferResized { false };
+
+    /// Static recording,command buffers are recorded once per framebuffer and reused
+    bool staticRecording { false };
+    std::vector<VkCommandBuffer> staticCommandBuffers; ///< one per swapchain framebuffer and frame slot,see staticIndex
+    std::vector<bool> staticDirty; ///< whether a static buffer needs to be recorded again
+    uint64_t staticRecordCount { 0 }; ///< how many times a static buffer was (re)recorded
+
+    VkClearValue clearColor {{{0,0,0,1}}};
+
+    /// Headless,offscreen images take the place of the swapchain images
+    bool headless { false };
+    uint64_t headlessFrames { app_headless_frames };
+    std::string dumpDir; ///< dump read back frames as PPM here if not empty
+    uint64_t dumpEvery { 0 }; ///< dump every Nth frame,0 dumps only the last one
+    std::vector<Allocation> offscreenAllocations;
+    std::vector<VkBuffer> readbackBuffers; ///< one per frame in flight,persistently mapped
+    std::vector<VkDeviceMemory> readbackMemories;
+    std::vector<void*> readbackMapped;
+    std::vector<uint64_t> readbackSerials; ///< frame serial waiting in each readback slot,0 if empty
+    bool readbackCoherent { true };
+
+    /// Geometry
+    MemoryAllocator allocator;
+    VkCommandPool uploadPool; ///< transfer family
+    std::vector<VkBufferMemoryBarrier> pendingAcquires; ///< uploads released by the transfer family,guarded by uploadLock
+    std::vector<VkImageMemoryBarrier> pendingImageAcquires; ///< same for images,guarded by uploadLock
+    std::vector<VkCommandBuffer> acquireCommandBuffers; ///< one per frame in flight,runs pendingAcquires on graphics
+    VkCommandBuffer uploadCommandBuffers[2]; ///< one per staging half
+    VkFence uploadFences[2];
+    GpuBuffer stagingBuffer; ///< persistently mapped,host coherent
+    std::mutex uploadLock;
+    Mesh mesh;
+    bool benchUpload { false };
+
+    /// Instancing
+    DrawPath drawPath { DrawPath::Instanced };
+    uint32_t instanceCount { 1 };
+    GpuBuffer instanceBuffer; ///< instanceCount Instance
+    std::vector<Instance> instanceData; ///< what instanceBuffer holds,or will once streaming copied it
+    GpuBuffer indirectBuffer; ///< VkDrawIndexedIndirectCommand
+    bool benchDraw { false };
+
+    /// GPU culling,see DrawPath::Culled
+    std::vector<char> cullCode;
+    VkDescriptorSetLayout cullSetLayout { VK_NULL_HANDLE };
+    VkPipelineLayout cullLayout;
+    VkPipeline cullPipeline;
+    VkDescriptorSet cullSet { VK_NULL_HANDLE }; ///< from descriptors,looked up again every frame
+    GpuBuffer visibleBuffer; ///< survivors compacted by the cull shader,vertex binding 1 of the culled path
+    GpuBuffer cullDrawBuffer; ///< one VkDrawIndexedIndirectCommand,instanceCount is the number of survivors
+    GpuBuffer cullStatsBuffer; ///< survivors per frame slot,host visible,for the stats only
+    uint32_t cullVisible { 0 }; ///< survivors of the last completed frame
+    bool benchCull { false };
+    double recordTime { 0 }; ///< ms spent in vk_recordCommandBuffer since last reset
+    uint64_t recordCount { 0 };
+
+    /// Threaded recording,0 threads records inline into the primary buffer
+    uint32_t recordThreads { 0 };
+    WorkerPool recordWorkers;
+    std::vector<std::vector<VkCommandPool>> recordPools; ///< [worker][frame slot],transient,reset as a whole
+    std::vector<std::vector<VkCommandBuffer>> recordBuffers; ///< [worker][frame slot],secondary
+    bool benchRecord { false };
+    bool benchDispatch { false };
+
+    /// Textures,all in one descriptor set bound as set 1 of the graphics pipeline
+    bool useBindless { true }; ///< try descriptor indexing,--no-bindless forces the fixed array
+    uint32_t bindlessLimit { 0 }; ///< images a set may hold with descriptor indexing,0 if it isn't enabled
+    BindlessTextures bindless;
+    Texture defaultTexture; ///< 1x1 white,fills the unused elements of the fixed array
+    std::vector<Texture> textures;
+
+    /// Texture streaming,decoded on the streamer threads and uploaded on the graphics queue within streamBudget per frame
+    TextureStreamer streamer;
+    StagingRing streamRing;
+    std::vector<VkCommandBuffer> streamCommandBuffers; ///< one per frame in flight,submitted before the frame
+    std::vector<PendingTexture> streamInFlight;
+    bool streamMips { false }; ///< whether the format can be blitted with a linear filter,else only level 0
+    VkDeviceSize streamBudget { app_stream_budget };
+    uint32_t streamTextureCount { 0 }; ///< procedural textures requested by --stream-textures
+    std::string streamDir; ///< .ppm files requested by --stream-dir
+    uint32_t streamUnassigned { 0 }; ///< published but not given to any instance yet
+    uint32_t streamInstanceNext { 0 }; ///< instanceData from here on still has to be copied to instanceBuffer
+    uint64_t streamBytes { 0 }; ///< uploaded since the last stats
+    uint64_t streamPublished { 0 };
+
+    /// Frame graph,barriers and layout transitions of the frame come from here
+    RenderGraph frameGraph;
+    RenderGraph::Id rgBackbuffer { RenderGraph::none };
+    RenderGraph::Id rgReadback { RenderGraph::none }; ///< headless only
+    RenderGraph::Id rgInstances { RenderGraph::none };
+    RenderGraph::Id rgVisible { RenderGraph::none };
+    RenderGraph::Id rgCullDraw { RenderGraph::none };
+    RenderGraph::Id rgCullStats { RenderGraph::none };
+    uint32_t graphImage { 0 }; ///< framebuffer index the passes record for
+    std::string graphDumpPath; ///< write the compiled graph here if not empty
+
+    /// Simulation,runs at tickRate on its own thread,frames interpolate its snapshots
+    Simulation simulation;
+    double tickRate { app_tick_rate };
+
+    /// Profiling,off unless --profile is given
+    Profiler profiler;
+
+    /// Uniforms,one dynamic uniform buffer descriptor over a per frame ring
+    LinearPool uniformRing;
+    VkDeviceSize uniformAlignment { 256 }; ///< minUniformBufferOffsetAlignment
+    VkDescriptorSetLayout uniformSetLayout;
+    VkDescriptorSet uniformSet { VK_NULL_HANDLE }; ///< cached in descriptors,looked up again every frame,bound by static recordings
+    uint32_t frameUniformOffset { 0 }; ///< dynamic offset of this frame's FrameUniforms
+
+    std::vector<char> vertCode; ///< SPIR-V,loaded off the main thread during startup
+    std::vector<char> fragCode; ///< fixed texture array
+    std::vector<char> fragIndexedCode; ///< runtime texture array,needs descriptor indexing
+    Clock startClock; ///< for time to first frame
 
     VkRect2D scissor {};
     VkViewport viewport {};
@@ -60,6 +351,7 @@ struct Application{
     lg_v ("Vulkan",logger)
     {}
 
+    void parseArguments(int argc,char ** argv);
     void setup();
     int run();
     void cleanup();
@@ -71,22 +363,147 @@ struct Application{
 
     /// draw
     void drawFrame();
+    /// look this frame's pipeline up in the library and evict long unused ones
+    void refreshPipelines();
+    /// swap in pipelines rebuilt by a hot reload,the old ones are retired
+    void applyShaderReload();
+    /// runs on the watcher thread
+    void reloadShaders(const std::vector<std::string> & names);
+    /// choose the command buffer for this frame and record it if needed
+    VkCommandBuffer prepareCommandBuffer(uint32_t imgIndex);
+    /// static buffers bake the dynamic uniform offset in,so there is one per image and frame slot
+    inline uint32_t staticIndex(uint32_t imgIndex) const{
+        return imgIndex * framesInFlight + currentFrame;
+    }
+    /// rebuild swapchain,image views and framebuffers only,the old ones are retired
+    void recreateSwapChain();
+    /// destroy through fn once every frame submitted so far completed
+    inline void retire(DeletionQueue::Deleter fn){
+        deletionQueue.push(frameSerial,std::move(fn));
+    }
+    /// low latency pacing:wait for the last submitted frame so input is sampled as late as possible
+    void waitBeforeRecord();
+    /// record the latency of every frame whose fence signalled since the last call
+    void pollLatency();
+    /// wait for the fences of every frame in flight,cheaper than a device idle
+    void waitFrames();
+    /// mark every static recording as stale,call it when anything recorded changes
+    void invalidateRecording();
+    void setClearColor(float r,float g,float b,float a = 1);
+
+    void loadShaders();
 
     /// vulkan setups
+    void vk_checkValidationLayers();
     void vk_createInstance();
+    void vk_listInstanceExtensions();
     void vk_setupDebugMessenger();
     void vk_pickPhysicalDevice();
     void vk_createLogicalDevice();
     void vk_createSurface();
     void vk_createSwapChain();
     void vk_createImageViews();
+    void vk_createPipelineCache();
+    void vk_savePipelineCache();
     void vk_createGraphicePipeline();
+    void vk_createShaderWatcher();
     void vk_createRenderPass();
     void vk_createFramebuffers();
     void vk_createCommandPool();
     void vk_createCommandBuffer();
+    void vk_allocateStaticCommandBuffers();
     void vk_recordCommandBuffer(VkCommandBuffer buf,uint32_t index);
+    /// bind the pipeline state and draw instances [first,first+count) inside the render pass,
+    /// thread is the recording worker,its transient descriptor sets come from its own chain
+    void recordDraws(VkCommandBuffer buf,uint32_t first,uint32_t count,uint32_t thread);
     void vk_createSyncObjects();
+    void vk_createPresentSemaphores();
+    /// declare the passes of a frame and compile them,again after every swapchain rebuild
+    void vk_createFrameGraph();
+
+    /// headless
+    int runHeadless();
+    void drawFrameHeadless();
+    void consumeReadback(uint32_t slot);
+    void cleanupHeadless();
+    void vk_createOffscreenTargets();
+    void vk_createReadbackBuffers();
+    void vk_recordReadback(VkCommandBuffer buf,uint32_t index);
+
+    /// geometry
+    void vk_createAllocator();
+    void vk_createUploadContext();
+    void vk_createMesh();
+    /// copy data into dst through the staging buffer,blocks until the copy finished
+    void uploadBuffer(const GpuBuffer & dst,const void * data,VkDeviceSize size,VkDeviceSize dstOffset = 0);
+    /// record the ownership acquires of finished uploads,null if there are none
+    VkCommandBuffer recordAcquires();
+    bool createMesh(std::span<const Vertex> vertices,std::span<const uint32_t> indices,Mesh & out);
+    /// destroy a buffer filled by uploadBuffer,dropping its ownership acquire if still pending
+    void destroyBuffer(GpuBuffer & buf);
+    void destroyMesh(Mesh & m);
+    void cleanupGeometry();
+    int runUploadBenchmark();
+    /// lay count instances out in a grid and rebuild the instance and indirect buffers,
+    /// the old buffers are retired,so frames may still be in flight
+    void setInstances(uint32_t count);
+    int runDrawBenchmark();
+    /// switch the draw path,the frame graph is rebuilt since the culling passes come and go with it
+    void setDrawPath(DrawPath path);
+
+    /// textures
+    void vk_createTextures();
+    /// create an RGBA8 image,fill it and make a view,registering it in the bindless table is up to the caller
+    bool createTexture(uint32_t width,uint32_t height,const void * rgba,Texture & out);
+    /// copy tightly packed pixels into the whole image and leave it in SHADER_READ_ONLY_OPTIMAL,blocks
+    bool uploadImage(const GpuImage & dst,uint32_t width,uint32_t height,const void * data,VkDeviceSize size);
+    /// unregister and destroy once the frames in flight are done with it
+    void destroyTexture(Texture & t);
+    /// without descriptor indexing swap in a rewritten texture set,recordings are invalidated then
+    void refreshTextures();
+    void cleanupTextures();
+
+    /// texture streaming
+    void vk_createStreaming();
+    /// record new uploads and pending instance texture changes within the budget,null if nothing was recorded
+    VkCommandBuffer recordStreaming();
+    /// register textures whose upload frame completed,before refreshTextures.
+    /// Once a batch is complete the instances are reassigned in instanceData
+    void publishStreamed();
+    void cleanupStreaming();
+
+    /// culling
+    void vk_createCulling();
+    /// read and clear the survivors counted in a frame slot,after its fence
+    void collectCullStats(uint32_t slot);
+    void cleanupCulling();
+    int runCullBenchmark();
+
+    /// threaded recording
+    void vk_createRecordContexts();
+    void destroyRecordContexts();
+    /// split the draws over the workers,each records a secondary buffer for framebuffer index
+    std::vector<VkCommandBuffer> recordSecondaries(uint32_t index);
+    /// one frame of whichever loop is active
+    void benchFrame();
+    int runRecordBenchmark();
+    /// cost of one vkCmd* call through the loader and through vkd
+    int runDispatchBenchmark();
+
+    /// descriptors
+    void vk_createDescriptorAllocator();
+    /// look up the uniform and cull sets of the frame being recorded,recordings are invalidated if either changed
+    void updateDescriptorSets();
+    /// uniform set to bind while recording this frame on worker thread:a transient one written for this frame,
+    /// or the cached uniformSet with static recording since those command buffers outlive the frame
+    VkDescriptorSet frameUniformSet(uint32_t thread);
+
+    /// uniforms
+    void vk_createUniformRing();
+    /// copy data into this frame's part of the ring,returns the dynamic offset
+    std::optional<uint32_t> pushUniforms(const void * data,VkDeviceSize size);
+    void updateFrameUniforms();
+    void cleanupUniforms();
 
     ~Application();
 };
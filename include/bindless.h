@@ -0,0 +1,82 @@
+#ifndef BINDLESS_H
+#define BINDLESS_H
+#include <vulkan/vulkan.h>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <vector>
+#include "vkdispatch.h"
+
+/// Every sampled texture in one descriptor set,shaders index the image array by slot.
+/// With VK_EXT_descriptor_indexing the array is runtime sized,partially bound and updated after bind:
+/// registering a texture writes one descriptor into the live set,nothing is rebound or recorded again.
+/// Without it the array has fallback_count elements,empty ones show the default texture,and a change
+/// is written into a fresh set while the old one is retired.
+/// Binding 0 is an immutable sampler shared by all textures,binding 1 the image array.
+class BindlessTextures{
+public:
+    static constexpr uint32_t max_count = 16384; ///< array size with descriptor indexing,capped by the device
+    static constexpr uint32_t fallback_count = 16; ///< the guaranteed maxPerStageDescriptorSampledImages,must match TEXTURE_COUNT in shader.frag
+    static constexpr uint32_t fallback_sets = 10; ///< fresh sets a fallback table can have in flight
+    static constexpr uint32_t none = UINT32_MAX;
+
+    /// whether dev has everything the indexed path needs,limit is how many images one set may hold.
+    /// Needs VK_KHR_get_physical_device_properties2 on the instance
+    static bool query(const VkDispatch & vkd,VkPhysicalDevice dev,uint32_t & limit);
+    /// the features query checked for,chain into VkDeviceCreateInfo
+    static VkPhysicalDeviceDescriptorIndexingFeaturesEXT features();
+    /// device extensions the indexed path needs
+    static std::span<const char * const> extensions();
+
+    /// limit comes from query,defaultView fills empty elements of the fallback array and must outlive the table
+    bool init(VkDevice device,bool indexing,uint32_t limit,VkImageView defaultView);
+    void destroy();
+
+    /// view must be in SHADER_READ_ONLY_OPTIMAL,returns its slot or none when the array is full.Thread safe
+    uint32_t add(VkImageView view);
+    /// free a slot,it is handed out again right away,so only once no frame in flight samples it.Thread safe
+    void remove(uint32_t slot);
+    /// render thread,before recording:without descriptor indexing write the changes into a new set.
+    /// Returns whether set() changed,old then frees the previous set and must be retired
+    bool refresh(std::function<void()> & old);
+
+    inline VkDescriptorSet set() const{
+        return current;
+    }
+    inline VkDescriptorSetLayout layout() const{
+        return setLayout;
+    }
+    inline bool indexed() const{
+        return indexing;
+    }
+    /// size of the image array
+    inline uint32_t capacity() const{
+        return count;
+    }
+    inline uint32_t used(){
+        std::lock_guard guard(lock);
+        return usedSlots;
+    }
+
+private:
+    VkDevice device { VK_NULL_HANDLE };
+    bool indexing { false };
+    uint32_t count { 0 };
+    VkSampler sampler { VK_NULL_HANDLE };
+    VkDescriptorSetLayout setLayout { VK_NULL_HANDLE };
+    VkDescriptorPool pool { VK_NULL_HANDLE };
+    VkDescriptorSet current { VK_NULL_HANDLE };
+    VkImageView defaultView { VK_NULL_HANDLE };
+
+    std::mutex lock;
+    std::vector<VkImageView> views; ///< per slot,null when free
+    std::vector<uint32_t> freeSlots; ///< below next,reused first
+    uint32_t next { 0 }; ///< slots above were never handed out
+    uint32_t usedSlots { 0 };
+    bool dirty { false }; ///< fallback only,views changed since the set was written
+
+    VkDescriptorSet allocate();
+    void write(VkDescriptorSet set,uint32_t first,std::span<const VkImageView> images);
+};
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef DELETION_QUEUE_H
+#define DELETION_QUEUE_H
+#include <alib-g3/alogger.h>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+/// Destroys GPU objects once the frame that last used them completed.
+/// Everything retired in the same frame forms one batch,batches are released in order.
+/// Thread safe.
+class DeletionQueue{
+public:
+    using Deleter = std::function<void()>;
+
+    /// frame is the serial of the last frame that may use what fn destroys
+    void push(uint64_t frame,Deleter fn);
+    /// run the batches of every frame <= completed,no argument runs all of them (device idle)
+    uint32_t flush(uint64_t completed = UINT64_MAX);
+
+    inline size_t pending(){
+        std::lock_guard guard(lock);
+        return count;
+    }
+    void report(alib::g3::LogFactory & lg);
+
+private:
+    struct Batch{
+        uint64_t frame;
+        std::vector<Deleter> deleters;
+    };
+
+    std::mutex lock;
+    std::deque<Batch> batches; ///< ascending frame
+    size_t count { 0 };
+    size_t peak { 0 };
+    uint64_t destroyed { 0 };
+};
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef DESCRIPTORS_H
+#define DESCRIPTORS_H
+#include <vulkan/vulkan.h>
+#include <alib-g3/alogger.h>
+#include <atomic>
+#include <mutex>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+/// One descriptor of a cached set,buffer or image depending on type
+struct DescriptorBinding{
+    uint32_t binding { 0 };
+    VkDescriptorType type { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER };
+    VkDescriptorBufferInfo buffer {};
+    VkDescriptorImageInfo image {};
+
+    static inline DescriptorBinding ofBuffer(uint32_t binding,VkDescriptorType type,VkBuffer buf,
+                                             VkDeviceSize offset = 0,VkDeviceSize range = VK_WHOLE_SIZE){
+        DescriptorBinding b;
+        b.binding = binding;
+        b.type = type;
+        b.buffer = {buf,offset,range};
+        return b;
+    }
+    static inline DescriptorBinding ofImage(uint32_t binding,VkDescriptorType type,VkImageView view,
+                                            VkImageLayout layout,VkSampler sampler = VK_NULL_HANDLE){
+        DescriptorBinding b;
+        b.binding = binding;
+        b.type = type;
+        b.image = {sampler,view,layout};
+        return b;
+    }
+};
+
+/// Descriptor sets out of growable pool chains,one chain per frame in flight and per thread.
+/// Transient sets live until the frame slot comes around again,then its pools are reset in bulk.
+/// Cached sets are looked up by layout and contents,so unchanged sets are never rewritten;
+/// ones idle for max_idle frames are recycled for other contents once the GPU is done with them.
+/// A thread only touches its own chains,only the layout cache takes a lock.
+class DescriptorAllocator{
+public:
+    static constexpr uint32_t min_pool_sets = 64;
+    static constexpr uint32_t max_pool_sets = 4096; ///< pools double up to this
+    static constexpr uint64_t max_idle = 8; ///< frames
+
+    void init(VkDevice device,uint32_t frames,uint32_t threads);
+    void destroy();
+
+    /// cached by flags and bindings,destroyed by destroy().
+    /// Layouts with a pNext chain aren't cached,the caller owns those
+    VkDescriptorSetLayout layout(const VkDescriptorSetLayoutCreateInfo & info);
+
+    /// the fence of frame has signaled:reset its transient pools and recycle cached sets
+    /// whose last use is completed and more than max_idle frames old
+    void beginFrame(uint32_t frame,uint64_t serial,uint64_t completed);
+    /// transient set valid until beginFrame(frame) runs again,VK_NULL_HANDLE on failure.
+    /// Only the thread owning index thread may use it during a frame
+    VkDescriptorSet allocate(uint32_t frame,uint32_t thread,VkDescriptorSetLayout layout);
+    /// set of layout holding bindings,written only on a miss.
+    /// serial is the frame that will use it,a set must be asked for every frame it's used in
+    VkDescriptorSet get(uint32_t thread,VkDescriptorSetLayout layout,std::span<const DescriptorBinding> bindings,uint64_t serial);
+    /// forget every cached set,e.g. after handles they point at were destroyed.
+    /// The sets are recycled once serial completed
+    void invalidate(uint64_t serial);
+
+    void report(alib::g3::LogFactory & lg);
+
+    /// pools in the transient chain of frame and thread,for tests and stats
+    inline size_t chainLength(uint32_t frame,uint32_t thread) const{
+        return frameChains[frame * threadCount + thread].pools.size();
+    }
+    inline uint64_t poolCount() const{
+        return poolsCreated;
+    }
+    inline uint64_t poolSwitches() const{
+        return switches;
+    }
+    inline uint64_t poolResets() const{
+        return resets;
+    }
+
+private:
+    struct Chain{
+        std::vector<VkDescriptorPool> pools; ///< each twice the size of the one before
+        uint32_t current { 0 }; ///< pool allocated from,the earlier ones are full
+        uint32_t sets { 0 }; ///< allocated from the current pool
+    };
+    struct Cached{
+        VkDescriptorSetLayout layout;
+        VkDescriptorSet set;
+        std::vector<DescriptorBinding> bindings;
+        uint64_t lastUsed;
+    };
+    struct Vacant{
+        VkDescriptorSet set;
+        uint64_t serial; ///< reusable once this frame completed
+    };
+    struct ThreadCache{
+        Chain chain; ///< never reset,cached sets go back to vacant instead
+        std::unordered_multimap<uint64_t,Cached> sets; ///< hash of layout and bindings
+        std::unordered_map<VkDescriptorSetLayout,std::vector<Vacant>> vacant;
+        uint64_t hits { 0 };
+        uint64_t writes { 0 };
+    };
+    struct LayoutEntry{
+        VkDescriptorSetLayoutCreateFlags flags;
+        std::vector<VkDescriptorSetLayoutBinding> bindings;
+        std::vector<VkSampler> samplers; ///< immutable samplers of all bindings in order
+        VkDescriptorSetLayout layout;
+    };
+
+    VkDevice device { VK_NULL_HANDLE };
+    uint32_t threadCount { 0 };
+    std::vector<Chain> frameChains; ///< [frame * threadCount + thread]
+    std::vector<ThreadCache> caches;
+
+    uint64_t completedFrame { 0 };
+    std::atomic<uint64_t> poolsCreated { 0 };
+    std::atomic<uint64_t> switches { 0 }; ///< allocations that ran out of pool memory and moved on
+    uint64_t resets { 0 };
+
+    std::mutex lock;
+    std::unordered_multimap<uint64_t,LayoutEntry> layouts;
+
+    VkDescriptorSet allocateFrom(Chain & chain,VkDescriptorSetLayout layout);
+    VkDescriptorPool createPool(uint32_t sets);
+    void destroyChain(Chain & chain);
+    static uint64_t hashBindings(VkDescriptorSetLayout layout,std::span<const DescriptorBinding> bindings);
+    static bool sameBindings(std::span<const DescriptorBinding> a,std::span<const DescriptorBinding> b);
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+#include <atomic>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Watches the files of one directory on its own thread.
+/// Uses inotify on Linux and polls modification times elsewhere.
+/// Bursts of writes are merged,the callback runs on the watcher thread once the directory
+/// has been quiet for quiet_ms,with the names of the files that changed.
+class FileWatcher{
+public:
+    static constexpr int quiet_ms = 150;
+    static constexpr int poll_ms = 250; ///< only without inotify
+
+    using Callback = std::function<void(const std::vector<std::string> & names)>;
+
+    FileWatcher() = default;
+    FileWatcher(const FileWatcher &) = delete;
+    ~FileWatcher();
+
+    bool start(std::string dir,Callback fn);
+    void stop();
+    inline bool running() const{
+        return thread.joinable();
+    }
+
+private:
+    std::string dir;
+    Callback callback;
+    std::thread thread;
+    std::atomic<bool> quit { false };
+    int fd { -1 }; ///< inotify
+    int wakeFd[2] { -1,-1 }; ///< pipe that interrupts poll() on stop
+
+    void loop();
+#ifndef __linux__
+    std::map<std::string,std::filesystem::file_time_type> times;
+    /// names changed since the last scan
+    std::vector<std::string> scan();
+#endif
+};
+
+#endif
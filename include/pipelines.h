@@ -0,0 +1,103 @@
+#ifndef PIPELINES_H
+#define PIPELINES_H
+#include <vulkan/vulkan.h>
+#include <alib-g3/alogger.h>
+#include <array>
+#include <list>
+#include <mutex>
+#include <span>
+#include <unordered_map>
+
+/// Everything that tells two graphics pipelines apart.
+/// Compared and hashed as plain data,so handles must stay alive while the key is in use.
+struct PipelineKey{
+    static constexpr uint32_t max_bindings = 4;
+    static constexpr uint32_t max_attributes = 8;
+
+    VkShaderModule vert { VK_NULL_HANDLE };
+    VkShaderModule frag { VK_NULL_HANDLE };
+    VkPipelineLayout layout { VK_NULL_HANDLE };
+    VkRenderPass renderPass { VK_NULL_HANDLE };
+    uint32_t subpass { 0 };
+
+    VkPrimitiveTopology topology { VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST };
+    VkPolygonMode polygonMode { VK_POLYGON_MODE_FILL };
+    VkCullModeFlags cullMode { VK_CULL_MODE_BACK_BIT };
+    VkFrontFace frontFace { VK_FRONT_FACE_CLOCKWISE };
+    VkBool32 blend { VK_FALSE }; ///< premultiplied alpha blending on attachment 0
+    uint32_t dynamicStates { (1u << VK_DYNAMIC_STATE_VIEWPORT) | (1u << VK_DYNAMIC_STATE_SCISSOR) }; ///< bit n = VkDynamicState n
+
+    uint32_t bindingCount { 0 };
+    uint32_t attributeCount { 0 };
+    std::array<VkVertexInputBindingDescription,max_bindings> bindings {};
+    std::array<VkVertexInputAttributeDescription,max_attributes> attributes {};
+
+    /// false if there are too many bindings or attributes
+    bool setVertexInput(std::span<const VkVertexInputBindingDescription> b,
+                        std::span<const VkVertexInputAttributeDescription> a);
+    /// shaders,layout and render pass,pipelines sharing it can derive from each other
+    uint64_t familyHash() const;
+    uint64_t hash() const;
+    bool operator==(const PipelineKey & other) const;
+};
+
+struct PipelineKeyHash{
+    inline size_t operator()(const PipelineKey & key) const{
+        return key.hash();
+    }
+};
+
+/// In memory cache of graphics pipelines on top of a VkPipelineCache.
+/// The first pipeline of a family becomes the base the others are derived from.
+/// Pipelines unused for maxIdle frames are destroyed once the GPU is done with them.
+/// Thread safe.
+class PipelineLibrary{
+public:
+    static constexpr uint64_t default_max_idle = 3600; ///< frames
+
+    void init(VkDevice device,VkPipelineCache cache,uint64_t maxIdle = default_max_idle);
+    void destroy();
+
+    /// cached pipeline for key,created on a miss,VK_NULL_HANDLE if creation failed.
+    /// frame is the serial of the frame that will use it,0 for the newest frame seen so far.
+    /// Creation runs outside the lock,so a slow compile on one thread doesn't block hits on others
+    VkPipeline get(const PipelineKey & key,uint64_t frame = 0);
+    /// remove key from the cache without destroying it,the caller destroys it when the GPU is done
+    VkPipeline take(const PipelineKey & key);
+    /// returns how many pipelines were destroyed
+    uint32_t evict(uint64_t frame,uint64_t completedFrame);
+
+    inline size_t size(){
+        std::lock_guard guard(lock);
+        return entries.size();
+    }
+    void report(alib::g3::LogFactory & lg);
+
+private:
+    struct Entry{
+        PipelineKey key;
+        VkPipeline pipeline;
+        uint64_t lastUsed;
+    };
+
+    VkDevice device { VK_NULL_HANDLE };
+    VkPipelineCache cache { VK_NULL_HANDLE };
+    uint64_t maxIdle { default_max_idle };
+    uint64_t lastFrame { 0 };
+    uint32_t creating { 0 }; ///< creations in progress,their base pipelines must not be evicted
+
+    std::mutex lock;
+    std::list<Entry> lru; ///< most recently used first
+    std::unordered_map<PipelineKey,std::list<Entry>::iterator,PipelineKeyHash> entries;
+    std::unordered_map<uint64_t,VkPipeline> bases; ///< familyHash -> base pipeline
+
+    uint64_t hits { 0 };
+    uint64_t misses { 0 };
+    uint64_t derived { 0 };
+    uint64_t evicted { 0 };
+    double createTime { 0 }; ///< ms spent in vkCreateGraphicsPipelines
+
+    VkPipeline create(const PipelineKey & key,VkPipeline base);
+};
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+#include <vulkan/vulkan.h>
+#include "vkdispatch.h"
+#include <alib-g3/alogger.h>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+/// CPU scopes and GPU timestamp sections of every frame.
+/// Results go to a rolling p50/p95/p99 summary and,if a path is set,to a Chrome trace
+/// (chrome://tracing or ui.perfetto.dev).GPU queries live in one pool per frame slot and
+/// are read after that slot's fence signalled,so reading never stalls.
+/// When disabled every call is a single branch.
+class Profiler{
+public:
+    static constexpr uint32_t max_sections = 32; ///< GPU sections per frame
+    static constexpr size_t window = 512; ///< samples kept per name for the percentiles
+    static constexpr size_t max_events = 1u << 20; ///< trace events kept,later ones only feed the summary
+
+    bool enabled { false };
+    std::string tracePath; ///< Chrome trace json written by destroy(),empty for none
+
+    /// RAII CPU span
+    class Scope{
+    public:
+        inline Scope(Profiler & prof,const char * n){
+            if(!prof.enabled)return;
+            p = &prof;
+            name = n;
+            begin = prof.now();
+        }
+        inline ~Scope(){
+            if(p)p->addCpu(name,begin,p->now());
+        }
+    private:
+        Profiler * p { nullptr };
+        const char * name { nullptr };
+        double begin { 0 };
+    };
+
+    void init(VkPhysicalDevice physicalDevice,VkDevice device,const VkDispatch & vkd,uint32_t queueFamily,uint32_t frames);
+    /// writes the trace if tracePath is set
+    void destroy(alib::g3::LogFactory & lg);
+
+    /// microseconds since init
+    inline double now() const{
+        return std::chrono::duration<double,std::micro>(std::chrono::steady_clock::now() - origin).count();
+    }
+    /// thread safe,name must outlive the profiler (string literals)
+    void addCpu(const char * name,double begin,double end);
+
+    /// reset the slot's queries,must be recorded outside of a render pass before any gpuBegin
+    void gpuFrameBegin(VkCommandBuffer buf,uint32_t slot);
+    /// returns a section id for gpuEnd
+    uint32_t gpuBegin(VkCommandBuffer buf,uint32_t slot,const char * name);
+    void gpuEnd(VkCommandBuffer buf,uint32_t slot,uint32_t section);
+    /// call right after the slot's command buffer was submitted
+    void frameSubmitted(uint32_t slot);
+    /// call after the slot's fence signalled,reads its timestamps without waiting
+    void collect(uint32_t slot);
+
+    /// p in [0,1] of the recent samples of a scope,GPU sections are named "gpu "+name;nullopt if none
+    std::optional<double> percentile(const std::string & name,double p);
+    /// forget the summary samples,e.g. between benchmark cases
+    void clearSamples();
+    /// percentiles of every scope seen
+    void report(alib::g3::LogFactory & lg);
+
+private:
+    struct Event{
+        const char * name;
+        uint32_t tid;
+        double begin; ///< us
+        double duration;
+    };
+    struct Section{
+        const char * name;
+        uint32_t query;
+    };
+    struct Samples{
+        std::vector<double> values; ///< ring of durations in ms
+        size_t next { 0 };
+    };
+    struct Slot{
+        VkQueryPool pool { VK_NULL_HANDLE };
+        std::vector<Section> sections;
+        uint32_t queries { 0 }; ///< queries written by the last recording
+        uint32_t submitted { 0 }; ///< queries of the last submission,0 if nothing to read
+        double submitTime { 0 };
+    };
+
+    VkDevice device { VK_NULL_HANDLE };
+    PFN_vkCmdResetQueryPool cmdResetQueryPool { nullptr };
+    PFN_vkCmdWriteTimestamp cmdWriteTimestamp { nullptr };
+    PFN_vkGetQueryPoolResults getQueryPoolResults { nullptr };
+    bool gpu { false };
+    double timestampPeriod { 1 }; ///< ns per tick
+    uint64_t timestampMask { ~0ull };
+    std::chrono::steady_clock::time_point origin { std::chrono::steady_clock::now() };
+    std::vector<Slot> slots;
+
+    std::mutex lock;
+    std::vector<Event> events;
+    std::map<std::string,Samples> samples;
+
+    void add(const char * name,uint32_t tid,double begin,double end,bool isGpu);
+};
+
+#define PROFILE_CONCAT_IMPL(a,b) a##b
+#define PROFILE_CONCAT(a,b) PROFILE_CONCAT_IMPL(a,b)
+/// time the rest of the enclosing block
+#define PROFILE_SCOPE(prof,name) Profiler::Scope PROFILE_CONCAT(profile_scope_,__LINE__) (prof,name)
+
+#endif
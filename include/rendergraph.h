@@ -0,0 +1,147 @@
+#ifndef RENDER_GRAPH_H
+#define RENDER_GRAPH_H
+#include <vulkan/vulkan.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include "vkdispatch.h"
+#include "vkmemory.h"
+
+/// How a pass touches a resource,decides stage,access and image layout
+enum class RGUsage : uint8_t{
+    ColorAttachment,
+    Sampled,
+    TransferSrc,
+    TransferDst,
+    StorageRead,
+    StorageWrite,
+    StorageReadWrite, ///< atomics,counters
+    IndirectRead,
+    VertexRead
+};
+
+/// Passes declare the images and buffers they use,compile() works out the rest:
+/// passes whose results nobody needs are culled,barriers and layout transitions are
+/// inserted only where a hazard or layout change exists,and transient images whose
+/// lifetimes don't overlap share memory (lazily allocated memory when the device has it).
+/// Compile once,then rebind the imported handles and execute() every frame.
+class RenderGraph{
+public:
+    using Id = uint32_t;
+    using Record = std::function<void(VkCommandBuffer)>;
+    static constexpr Id none = ~0u;
+
+    struct State{
+        VkPipelineStageFlags stage { VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT };
+        VkAccessFlags access { 0 };
+        VkImageLayout layout { VK_IMAGE_LAYOUT_UNDEFINED }; ///< as a final state UNDEFINED means leave it
+    };
+    struct ImageDesc{
+        VkFormat format { VK_FORMAT_UNDEFINED };
+        VkExtent2D extent {};
+        VkImageUsageFlags usage { 0 };
+        VkImageAspectFlags aspect { VK_IMAGE_ASPECT_COLOR_BIT };
+    };
+
+    RenderGraph() = default;
+    RenderGraph(const RenderGraph &) = delete;
+    RenderGraph & operator=(const RenderGraph &) = delete;
+
+    void init(VkDevice device,MemoryAllocator & allocator,const VkDispatch & vkd);
+
+    /// owned outside,bind the handle with bindImage() before execute()
+    Id importImage(std::string name,VkImageAspectFlags aspect,State initial,State final);
+    Id importBuffer(std::string name,State initial,State final);
+    /// created and aliased by compile(),lives as long as the graph
+    Id createImage(std::string name,const ImageDesc & desc);
+    Id addPass(std::string name,Record fn);
+    void use(Id pass,Id resource,RGUsage usage);
+    /// keeps the passes producing resource alive
+    void output(Id resource);
+
+    bool compile();
+    inline const std::string & error() const{
+        return lastError;
+    }
+
+    void bindImage(Id resource,VkImage image);
+    void bindBuffer(Id resource,VkBuffer buffer);
+    VkImage image(Id resource) const;
+    /// transient images only
+    VkImageView view(Id resource) const;
+
+    void execute(VkCommandBuffer buf) const;
+
+    /// the compiled order,culled passes,lifetimes,alias slots and barriers as text
+    std::string dump() const;
+    inline uint32_t barrierCount() const{
+        return barriers;
+    }
+
+    /// moves the transient images out and returns the function destroying them,the graph is empty afterwards
+    std::function<void()> release();
+
+private:
+    struct Use{
+        Id resource;
+        RGUsage usage;
+        State state;
+        bool write;
+    };
+    struct Pass{
+        std::string name;
+        Record fn;
+        std::vector<Use> uses;
+        bool alive { false };
+    };
+    struct Resource{
+        std::string name;
+        bool image { true };
+        bool transient { false };
+        bool output { false };
+        VkImageAspectFlags aspect { VK_IMAGE_ASPECT_COLOR_BIT };
+        ImageDesc desc;
+        State initial;
+        State final;
+        VkImage img { VK_NULL_HANDLE };
+        VkImageView imgView { VK_NULL_HANDLE };
+        VkBuffer buffer { VK_NULL_HANDLE };
+        uint32_t first { ~0u }; ///< lifetime in compiled order
+        uint32_t last { 0 };
+        uint32_t slot { ~0u }; ///< alias slot of a transient
+    };
+    struct Barrier{
+        Id resource;
+        State src;
+        State dst;
+    };
+    struct Step{
+        Id pass; ///< none for the final transitions
+        std::vector<Barrier> barriers;
+    };
+    struct Slot{
+        VkMemoryRequirements req {};
+        Allocation alloc;
+        std::vector<Id> members;
+        uint32_t end { 0 };
+        bool lazy { true };
+    };
+
+    VkDevice device { VK_NULL_HANDLE };
+    MemoryAllocator * allocator { nullptr };
+    PFN_vkCmdPipelineBarrier cmdPipelineBarrier { nullptr };
+
+    std::vector<Pass> passes;
+    std::vector<Resource> resources;
+    std::vector<Step> steps; ///< compiled
+    std::vector<Slot> slots;
+    uint32_t barriers { 0 };
+    uint32_t culled { 0 };
+    std::string lastError;
+
+    bool fail(std::string msg);
+    std::vector<Id> order();
+    bool allocateTransients();
+};
+
+#endif
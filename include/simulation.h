@@ -0,0 +1,113 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+/// Single producer,single consumer handoff without locks.
+/// The writer fills its own slot and swaps it with the middle one,the reader swaps the
+/// middle slot with its own only when something new was published.Neither side ever waits,
+/// the reader always sees the latest complete value.
+template<class T> class TripleBuffer{
+public:
+    /// writer only
+    inline T & back(){
+        return slots[backIndex].value;
+    }
+    inline void publish(){
+        backIndex = middle.exchange(backIndex | fresh_bit,std::memory_order_acq_rel) & index_mask;
+    }
+
+    /// reader only,false when nothing was published since the last call
+    inline bool update(){
+        if(!(middle.load(std::memory_order_relaxed) & fresh_bit))return false;
+        frontIndex = middle.exchange(frontIndex,std::memory_order_acq_rel) & index_mask;
+        return true;
+    }
+    inline const T & front() const{
+        return slots[frontIndex].value;
+    }
+
+private:
+    static constexpr uint8_t fresh_bit = 4;
+    static constexpr uint8_t index_mask = 3;
+
+    // 三个槽分开放，写线程和读线程不会抢同一条cache line
+    struct alignas(64) Slot{
+        T value {};
+    };
+    Slot slots[3];
+    alignas(64) std::atomic<uint8_t> middle { 1 };
+    uint8_t backIndex { 0 };
+    alignas(64) uint8_t frontIndex { 2 };
+};
+
+/// Everything the simulation owns,copied whole into every snapshot
+struct SimState{
+    uint64_t tick { 0 };
+    double time { 0 }; ///< simulated seconds
+    float angle { 0 }; ///< rotation of the scene
+    float spin { 0.5f }; ///< radians per second
+
+    static SimState lerp(const SimState & a,const SimState & b,float t);
+};
+
+/// What the render thread gets:the last two ticks and when the newer one was scheduled
+struct SimSnapshot{
+    SimState prev;
+    SimState curr;
+    std::chrono::steady_clock::time_point stamp {};
+};
+
+/// Fixed timestep simulation on its own thread.
+/// Ticks are paced by the wall clock,a slow frame doesn't slow it down and it never waits
+/// for the renderer.The renderer samples the latest snapshot and interpolates between
+/// its two ticks,so the picture is one tick behind but moves smoothly at any frame rate.
+class Simulation{
+public:
+    static constexpr double default_rate = 60;
+    static constexpr uint32_t max_catch_up = 8; ///< ticks run back to back before giving up on the lost time
+
+    Simulation() = default;
+    Simulation(const Simulation &) = delete;
+    ~Simulation();
+
+    void start(double rate = default_rate);
+    void stop();
+    inline bool running() const{
+        return thread.joinable();
+    }
+
+    /// written by the input thread,read once per tick
+    std::atomic<float> spinInput { 0 };
+
+    /// render thread only,state interpolated for now
+    SimState sample();
+
+    inline double rate() const{
+        return tickRate;
+    }
+    /// ticks run since start
+    inline uint64_t ticks() const{
+        return tickCount.load(std::memory_order_relaxed);
+    }
+    /// time lost to max_catch_up,ms
+    inline double dropped() const{
+        return droppedMs.load(std::memory_order_relaxed);
+    }
+
+private:
+    TripleBuffer<SimSnapshot> snapshots;
+    SimSnapshot latest; ///< reader side copy
+    std::thread thread;
+    std::atomic<bool> quit { false };
+    std::atomic<uint64_t> tickCount { 0 };
+    std::atomic<double> droppedMs { 0 };
+    double tickRate { default_rate };
+
+    void loop();
+    static void step(SimState & s,double dt,float input);
+};
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef TASK_GRAPH_H
+#define TASK_GRAPH_H
+#include <alib-g3/alogger.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+/// A tiny dependency graph runner used for startup.
+/// Tasks can only depend on tasks added before them,so the graph is always acyclic.
+/// Worker tasks get their own thread as soon as their dependencies finish,
+/// main thread tasks (GLFW window creation...) run on the thread that calls run().
+class TaskGraph{
+public:
+    using TaskId = size_t;
+
+    TaskId add(std::string name,std::function<void()> fn,std::vector<TaskId> deps = {},bool mainThread = false);
+    /// block until every task finished
+    void run();
+    /// log when every task started and how long it took
+    void report(alib::g3::LogFactory & lg) const;
+
+private:
+    struct Task{
+        std::string name;
+        std::function<void()> fn;
+        std::vector<TaskId> deps;
+        std::vector<TaskId> next;
+        bool mainThread;
+        double begin { 0 }; ///< ms since run()
+        double end { 0 };
+    };
+    std::vector<Task> tasks;
+    double total { 0 };
+};
+
+#endif
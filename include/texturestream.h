@@ -0,0 +1,72 @@
+#ifndef TEXTURE_STREAM_H
+#define TEXTURE_STREAM_H
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// RGBA8 pixels ready to be uploaded
+struct DecodedImage{
+    std::string name;
+    uint32_t width { 0 };
+    uint32_t height { 0 };
+    std::vector<uint8_t> pixels; ///< tightly packed rows
+};
+
+/// CPU half of texture streaming:decode jobs run on their own threads and the results
+/// wait in a bounded queue until the render thread has staging space and budget for them.
+/// Decoders stall while the queue is full,so a burst of requests can't pile up decoded memory.
+class TextureStreamer{
+public:
+    using Decoder = std::function<bool(DecodedImage & out)>;
+    static constexpr uint32_t max_ready = 16; ///< decoded images waiting for upload
+
+    TextureStreamer() = default;
+    TextureStreamer(const TextureStreamer &) = delete;
+    ~TextureStreamer();
+
+    void start(uint32_t threads);
+    /// pending and decoded images are dropped
+    void stop();
+
+    /// thread safe,decode runs on a streaming thread and fills out,false drops the request
+    void request(std::string name,Decoder decode);
+    /// render thread,the oldest decoded image or null
+    DecodedImage * front();
+    /// render thread,drop what front() returned
+    void pop();
+
+    /// requests not handed to the renderer yet:queued,decoding and decoded
+    uint32_t depth();
+    /// requests whose decoder failed
+    inline uint64_t failures(){
+        std::lock_guard guard(lock);
+        return failed;
+    }
+
+    /// binary PPM (P6,maxval 255),alpha is set to opaque
+    static bool decode_ppm(const std::string & path,DecodedImage & out);
+
+private:
+    struct Job{
+        std::string name;
+        Decoder decode;
+    };
+
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    std::condition_variable wake; ///< new job,space in ready or quit
+    std::deque<Job> jobs;
+    std::deque<DecodedImage> ready;
+    uint32_t decoding { 0 };
+    uint64_t failed { 0 };
+    bool quit { false };
+
+    void loop();
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef VALIDATION_LOG_H
+#define VALIDATION_LOG_H
+#include <vulkan/vulkan.h>
+#include <alib-g3/alogger.h>
+#include <array>
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+
+/// Debug messenger sink that keeps the validation layers off the frame path.
+/// The callback never formats or locks:a message id seen before only bumps its counter,
+/// a new one is copied into a bounded lock-free queue,retried on later occurrences while it's full.
+/// A background thread logs new messages and,every summaryInterval ms,how often the known ones repeated.
+/// Severities and types are chosen at messenger creation,so filtered messages are never generated.
+class ValidationLog{
+public:
+    static constexpr uint32_t queue_size = 256; ///< power of two
+    static constexpr uint32_t table_size = 1024; ///< distinct message ids counted,power of two
+    static constexpr uint32_t max_name = 64;
+    static constexpr uint32_t max_text = 1024; ///< longer messages are cut
+    static constexpr double default_summary_interval = 10000;
+    static constexpr int drain_ms = 20;
+
+    VkDebugUtilsMessageSeverityFlagsEXT severities { VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT |
+                                                     VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT };
+    VkDebugUtilsMessageTypeFlagsEXT types { VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
+                                            VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
+                                            VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT };
+    double summaryInterval { default_summary_interval }; ///< ms
+
+    ValidationLog();
+    ValidationLog(const ValidationLog &) = delete;
+    ~ValidationLog();
+
+    void start(alib::g3::LogFactory & lg);
+    /// drains the queue and logs the totals,call after the instance is gone
+    void stop();
+
+    /// severities,types,callback and user data of a messenger feeding this log
+    void fill(VkDebugUtilsMessengerCreateInfoEXT & info);
+
+    /// minimum severity by name:verbose,info,warning or error
+    static VkDebugUtilsMessageSeverityFlagsEXT parse_severity(std::string_view name);
+    /// comma separated general,validation,performance
+    static VkDebugUtilsMessageTypeFlagsEXT parse_types(std::string_view names);
+
+private:
+    struct Message{
+        std::atomic<uint32_t> seq { 0 };
+        uint32_t slot; ///< counter in table,table_size if it was full
+        uint32_t key;
+        VkDebugUtilsMessageSeverityFlagBitsEXT severity;
+        char name[max_name];
+        char text[max_text];
+    };
+    struct Counter{
+        std::atomic<uint32_t> key { 0 }; ///< 0 is free
+        std::atomic<uint64_t> count { 0 };
+        std::atomic<bool> delivered { false }; ///< the first message is queued,cleared again if the queue was full
+    };
+    /// logger thread only
+    struct Known{
+        std::string name;
+        VkDebugUtilsMessageSeverityFlagBitsEXT severity;
+        uint64_t reported;
+    };
+
+    std::array<Message,queue_size> queue;
+    alignas(64) std::atomic<uint32_t> head { 0 }; ///< next slot to write
+    alignas(64) uint32_t tail { 0 }; ///< next slot to read,logger thread only
+    std::array<Counter,table_size> table;
+    std::atomic<uint64_t> dropped { 0 }; ///< queue was full
+    std::atomic<uint64_t> total { 0 };
+
+    alib::g3::LogFactory * lg { nullptr };
+    std::map<uint32_t,Known> known;
+    std::thread thread;
+    std::atomic<bool> quit { false };
+
+    static VKAPI_ATTR VkBool32 VKAPI_CALL callback(VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+        VkDebugUtilsMessageTypeFlagsEXT type,const VkDebugUtilsMessengerCallbackDataEXT * data,void * user);
+    /// returns the counter slot,first is set when the caller should queue the message:
+    /// key was never seen or none of its earlier occurrences made it into the queue
+    uint32_t count(uint32_t key,bool & first);
+    bool push(uint32_t slot,uint32_t key,VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+              const char * name,const char * text);
+    void drain();
+    void summary(bool final);
+    void loop();
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef VK_DISPATCH_H
+#define VK_DISPATCH_H
+#include <vulkan/vulkan.h>
+
+/// Instance level functions that the loader doesn't export
+#define VK_DISPATCH_INSTANCE(X) \
+    X(vkCreateDebugUtilsMessengerEXT) \
+    X(vkDestroyDebugUtilsMessengerEXT) \
+    X(vkGetPhysicalDeviceFeatures2KHR) \
+    X(vkGetPhysicalDeviceProperties2KHR)
+
+/// Device level functions on the per frame path,called straight into the driver
+#define VK_DISPATCH_DEVICE(X) \
+    X(vkWaitForFences) \
+    X(vkGetFenceStatus) \
+    X(vkResetFences) \
+    X(vkQueueSubmit) \
+    X(vkAcquireNextImageKHR) \
+    X(vkQueuePresentKHR) \
+    X(vkResetCommandPool) \
+    X(vkResetCommandBuffer) \
+    X(vkBeginCommandBuffer) \
+    X(vkEndCommandBuffer) \
+    X(vkCmdBeginRenderPass) \
+    X(vkCmdEndRenderPass) \
+    X(vkCmdExecuteCommands) \
+    X(vkCmdBindPipeline) \
+    X(vkCmdSetViewport) \
+    X(vkCmdSetScissor) \
+    X(vkCmdBindDescriptorSets) \
+    X(vkCmdBindVertexBuffers) \
+    X(vkCmdBindIndexBuffer) \
+    X(vkCmdDrawIndexed) \
+    X(vkCmdDrawIndexedIndirect) \
+    X(vkCmdPipelineBarrier) \
+    X(vkCmdDispatch) \
+    X(vkCmdPushConstants) \
+    X(vkCmdUpdateBuffer) \
+    X(vkCmdCopyBuffer) \
+    X(vkCmdCopyBufferToImage) \
+    X(vkCmdBlitImage) \
+    X(vkCmdCopyImageToBuffer) \
+    X(vkCmdResetQueryPool) \
+    X(vkCmdWriteTimestamp) \
+    X(vkGetQueryPoolResults)
+
+/// Function pointers fetched with vkGetInstanceProcAddr/vkGetDeviceProcAddr.
+/// Device functions skip the loader trampoline that looks the dispatch table up on every call.
+/// Functions of extensions that aren't enabled stay null.
+struct VkDispatch{
+#define VK_DISPATCH_MEMBER(name) PFN_##name name { nullptr };
+    VK_DISPATCH_INSTANCE(VK_DISPATCH_MEMBER)
+    VK_DISPATCH_DEVICE(VK_DISPATCH_MEMBER)
+#undef VK_DISPATCH_MEMBER
+
+    void loadInstance(VkInstance instance);
+    /// returns how many device functions could not be found
+    uint32_t loadDevice(VkDevice device);
+};
+
+#endif
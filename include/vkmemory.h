@@ -0,0 +1,193 @@
+#ifndef VK_MEMORY_H
+#define VK_MEMORY_H
+#include <vulkan/vulkan.h>
+#include <alib-g3/alogger.h>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <vector>
+
+/// Buffers and linear images never share a buddy block with optimal images,
+/// so bufferImageGranularity can't bite
+enum class ResourceKind : uint8_t{
+    Linear,
+    Optimal
+};
+
+/// A range inside one of the allocator's VkDeviceMemory blocks
+struct Allocation{
+    VkDeviceMemory memory { VK_NULL_HANDLE };
+    VkDeviceSize offset { 0 };
+    VkDeviceSize size { 0 }; ///< requested size
+    void * mapped { nullptr }; ///< already points at offset,null unless the memory is host visible
+    uint32_t memoryType { 0 };
+    uint32_t block { 0 }; ///< index of the block in its pool
+    uint8_t pool { 0 }; ///< which pool of memoryType,see ResourceKind
+    uint8_t order { 0 }; ///< buddy node size is min_node << order
+    bool dedicated { false }; ///< owns memory alone
+
+    inline operator bool() const{
+        return memory != VK_NULL_HANDLE;
+    }
+};
+
+struct GpuBuffer{
+    VkBuffer buffer { VK_NULL_HANDLE };
+    Allocation alloc;
+    VkDeviceSize size { 0 };
+};
+
+struct GpuImage{
+    VkImage image { VK_NULL_HANDLE };
+    Allocation alloc;
+};
+
+struct MemoryStats{
+    VkDeviceSize reserved { 0 }; ///< bytes held in VkDeviceMemory
+    VkDeviceSize used { 0 }; ///< bytes the callers asked for
+    VkDeviceSize wasted { 0 }; ///< rounding up to buddy nodes and alignment
+    VkDeviceSize free { 0 };
+    VkDeviceSize largestFree { 0 }; ///< biggest node that can still be handed out
+    size_t blocks { 0 };
+    size_t dedicated { 0 };
+    size_t allocations { 0 };
+
+    /// 0 when all free memory is one node,close to 1 when it is shredded
+    inline double fragmentation() const{
+        return free ? 1.0 - (double)largestFree / free : 0.0;
+    }
+};
+
+/// Sub allocates long lived resources from big VkDeviceMemory blocks,so a resource doesn't
+/// cost a vkAllocateMemory of its own (maxMemoryAllocationCount can be as low as 4096).
+/// Every memory type keeps a pool of buddy blocks per ResourceKind.Requests above half a
+/// block get a dedicated allocation.Host visible blocks stay mapped.
+/// All public functions are thread safe.
+class MemoryAllocator{
+public:
+    static constexpr VkDeviceSize default_block_size = 64ull << 20;
+    static constexpr VkDeviceSize min_node = 256;
+
+    void init(VkPhysicalDevice physicalDevice,VkDevice device,VkDeviceSize blockSize = default_block_size);
+    /// free every block,allocations still alive become dangling
+    void destroy();
+
+    /// memory type must have all of required,types having preferred too are tried first
+    std::optional<Allocation> allocate(const VkMemoryRequirements & req,ResourceKind kind,
+                                       VkMemoryPropertyFlags required,VkMemoryPropertyFlags preferred = 0);
+    void free(Allocation & alloc);
+
+    /// create a buffer and bind it to a fresh allocation
+    bool createBuffer(VkDeviceSize size,VkBufferUsageFlags usage,VkMemoryPropertyFlags required,
+                      VkMemoryPropertyFlags preferred,GpuBuffer & out);
+    void destroyBuffer(GpuBuffer & buf);
+    /// create an image and bind it to a fresh allocation
+    bool createImage(const VkImageCreateInfo & info,VkMemoryPropertyFlags required,
+                     VkMemoryPropertyFlags preferred,GpuImage & out);
+    void destroyImage(GpuImage & img);
+
+    bool isCoherent(uint32_t memoryType) const;
+    /// VkDeviceMemory objects currently held
+    size_t blockCount() const;
+    uint32_t maxAllocationCount() const;
+
+    MemoryStats stats() const;
+    /// one line per memory type in use plus a total
+    void report(alib::g3::LogFactory & lg) const;
+
+private:
+    struct Block{
+        VkDeviceMemory memory { VK_NULL_HANDLE };
+        VkDeviceSize size { 0 };
+        void * mapped { nullptr };
+        bool dedicated { false };
+        std::vector<std::set<VkDeviceSize>> freeNodes; ///< free node offsets per order
+        VkDeviceSize used { 0 };
+        VkDeviceSize wasted { 0 };
+        size_t allocations { 0 };
+    };
+    using Pool = std::vector<Block>;
+
+    VkPhysicalDevice physicalDevice { VK_NULL_HANDLE };
+    VkDevice device { VK_NULL_HANDLE };
+    VkDeviceSize blockSize { default_block_size };
+    VkDeviceSize granularity { 1 };
+    VkPhysicalDeviceMemoryProperties memProps {};
+    uint32_t maxAllocations { 0 };
+    std::vector<std::array<Pool,2>> pools; ///< [memory type][ResourceKind]
+    mutable std::mutex lock;
+
+    std::optional<Allocation> allocateFromType(uint32_t type,uint8_t pool,VkDeviceSize size,VkDeviceSize alignment);
+    bool newBlock(uint32_t type,VkDeviceSize size,bool dedicated,Block & out);
+    void releaseBlock(Block & block);
+};
+
+struct BufferSlice{
+    VkBuffer buffer { VK_NULL_HANDLE };
+    VkDeviceSize offset { 0 };
+    VkDeviceSize size { 0 };
+    void * mapped { nullptr };
+};
+
+/// Per frame bump allocator over one persistently mapped,host coherent buffer.
+/// The buffer is split in one region per frame in flight,beginFrame() rewinds the
+/// region of a frame slot once its fence signalled,nothing is ever freed one by one.
+/// allocate() is lock free and can be called from several recording threads.
+class LinearPool{
+public:
+    static constexpr VkDeviceSize region_alignment = 256; ///< largest minUniformBufferOffsetAlignment allowed
+
+    bool init(MemoryAllocator & allocator,VkDeviceSize frameSize,uint32_t frames,VkBufferUsageFlags usage);
+    void destroy(MemoryAllocator & allocator);
+
+    void beginFrame(uint32_t frame);
+    /// nullopt when this frame's region is full
+    std::optional<BufferSlice> allocate(VkDeviceSize size,VkDeviceSize alignment);
+
+    inline VkBuffer buffer() const{ return buf.buffer; }
+    inline VkDeviceSize frameSize() const{ return regionSize; }
+    /// most bytes a single frame used so far
+    inline VkDeviceSize peak() const{ return peakUsed; }
+
+private:
+    GpuBuffer buf;
+    VkDeviceSize regionSize { 0 };
+    VkDeviceSize regionBase { 0 };
+    std::atomic<VkDeviceSize> head { 0 }; ///< bytes used in the current region
+    VkDeviceSize peakUsed { 0 };
+};
+
+/// Ring allocator over one persistently mapped,host coherent buffer,for uploads of any size.
+/// Every allocation is tagged with the frame serial that reads it and release() hands the space
+/// back once that frame completed,so the ring frees in submission order.Render thread only.
+class StagingRing{
+public:
+    bool init(MemoryAllocator & allocator,VkDeviceSize size);
+    void destroy(MemoryAllocator & allocator);
+
+    /// nullopt when no contiguous range is free,try again once frames completed
+    std::optional<BufferSlice> allocate(VkDeviceSize size,VkDeviceSize alignment,uint64_t serial);
+    /// reclaim everything allocated for frames <= completed
+    void release(uint64_t completed);
+
+    inline VkDeviceSize capacity() const{ return buf.size; }
+    /// bytes held by frames in flight,padding and skipped ends included
+    inline VkDeviceSize inUse() const{ return used; }
+
+private:
+    struct Span{
+        uint64_t serial;
+        VkDeviceSize end; ///< tail moves here once it is released
+        VkDeviceSize bytes;
+    };
+    GpuBuffer buf;
+    VkDeviceSize head { 0 }; ///< next byte to hand out
+    VkDeviceSize tail { 0 }; ///< oldest byte still in use
+    VkDeviceSize used { 0 };
+    std::deque<Span> spans; ///< ascending serial
+};
+
+#endif
@@ -11,22 +11,44 @@
 struct QueueFamilyIndices{
     std::optional<uint32_t> graphicsFamily;
     std::optional<uint32_t> presentFamily;
+    std::optional<uint32_t> transferFamily; ///< transfer only family if there is one,else graphicsFamily
+    std::optional<uint32_t> computeFamily; ///< compute without graphics if there is one,else graphicsFamily
+    std::vector<uint32_t> queueCounts; ///< queueCount of every family of the device
 
     inline bool ok(){
         return graphicsFamily && presentFamily;
     }
 
+    inline bool dedicatedTransfer() const{
+        return transferFamily != graphicsFamily;
+    }
+
+    inline bool dedicatedCompute() const{
+        return computeFamily != graphicsFamily;
+    }
+
     inline std::vector<uint32_t> gen(){
         if(!ok())return {};
         std::set<uint32_t> unique_data;
 
         unique_data.insert(*presentFamily);
         unique_data.insert(*graphicsFamily);
+        if(transferFamily)unique_data.insert(*transferFamily);
+        if(computeFamily)unique_data.insert(*computeFamily);
 
         return std::vector(unique_data.begin(),unique_data.end());
     }
 };
 
+/// What the frame loop optimizes for,decides present mode and swapchain image count
+enum class FramePacing{
+    LowLatency, ///< FIFO,fewest images,wait for the last frame before sampling input
+    Throughput, ///< MAILBOX when available,one spare image,no cap
+    Capped ///< like Throughput but the loop sleeps to a fixed frame rate
+};
+
+const char * frame_pacing_name(FramePacing pacing);
+
 struct SwapChainsSupportDetails{
     VkSurfaceCapabilitiesKHR capabilities;
     std::vector<VkSurfaceFormatKHR> formats;
@@ -39,8 +61,11 @@ struct SwapChainsSupportDetails{
 
 bool check_validation_layer_support(std::span<const char *> data);
 
-std::vector<const char *> get_required_extensions(bool enableValidate);
+/// VK_KHR_get_physical_device_properties2 is added too when the loader has it
+std::vector<const char *> get_required_extensions(bool enableValidate,bool windowed = true);
 
+/// surface can be VK_NULL_HANDLE (headless),then the graphics family doubles as the present family.
+/// A graphics family that can present is preferred,so that both share one queue
 QueueFamilyIndices find_queue_family(VkPhysicalDevice dev,VkSurfaceKHR surface);
 
 bool check_device_extension_support(VkPhysicalDevice device,std::span<const char*>);
@@ -49,10 +74,27 @@ SwapChainsSupportDetails get_swapchains_support_detail(VkPhysicalDevice dev,VkSu
 
 VkSurfaceFormatKHR choose_surface_format(std::span<VkSurfaceFormatKHR> formats);
 
-VkPresentModeKHR choose_swapchains_present_mode(std::span<VkPresentModeKHR> modes);
+VkPresentModeKHR choose_swapchains_present_mode(std::span<VkPresentModeKHR> modes,FramePacing pacing);
+
+uint32_t choose_swapchain_image_count(const VkSurfaceCapabilitiesKHR & cap,FramePacing pacing);
 
 VkExtent2D choose_swap_extent(const VkSurfaceCapabilitiesKHR & cap,GLFWwindow*);
 
+/// whole file,empty if it can't be opened
+std::vector<char> read_file(std::string_view fp);
+
 VkShaderModule create_shader_module(VkDevice,const std::vector<char>& code);
 
+/// 2D color view over mip levels [0,mipLevels),VK_NULL_HANDLE on failure
+VkImageView create_image_view(VkDevice dev,VkImage image,VkFormat format,uint32_t mipLevels = 1);
+
+/// floor(log2(max(width,height)))+1,the full chain down to 1x1
+uint32_t mip_level_count(uint32_t width,uint32_t height);
+
+/// whether data starts with a pipeline cache header written by this exact device/driver
+bool check_pipeline_cache_header(std::span<const char> data,const VkPhysicalDeviceProperties & props);
+
+/// first memory type allowed by typeBits that has all of props
+std::optional<uint32_t> find_memory_type(VkPhysicalDevice dev,uint32_t typeBits,VkMemoryPropertyFlags props);
+
 #endif
\ No newline at end of file
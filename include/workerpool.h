@@ -0,0 +1,39 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// A fixed set of threads running one parallel job at a time.
+/// The thread calling run() works as worker 0,so a pool of size N owns N-1 threads.
+class WorkerPool{
+public:
+    WorkerPool() = default;
+    WorkerPool(const WorkerPool &) = delete;
+    ~WorkerPool();
+
+    /// stop the old threads and start count-1 new ones
+    void start(uint32_t count);
+    void stop();
+    inline uint32_t size() const{
+        return threads.size() + 1;
+    }
+    /// call fn(worker) once for every worker and wait until all of them returned
+    void run(const std::function<void(uint32_t)> & fn);
+
+private:
+    std::vector<std::thread> threads;
+    std::mutex m;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(uint32_t)> * job { nullptr };
+    uint64_t generation { 0 };
+    uint32_t pending { 0 };
+    bool quit { false };
+
+    void loop(uint32_t index,uint64_t seen);
+};
+
+#endif
@@ -14,6 +14,7 @@ using namespace alib::g3;
 
 Logger * Logger::instance;
 THREAD_LOCAL std::string LogFactory::cachedStr = "";
+THREAD_LOCAL int LogFactory::defLogType = LOG_TRACE;
 std::mutex lot::Console::global_lock;
 
 void Logger::flush(){
@@ -218,7 +219,6 @@ void LogFactory::warn(dstring msg){i->log(LOG_WARN,msg,head);}
 
 LogFactory::LogFactory(dstring a,Logger & c){
     head = a;
-    defLogType = LOG_TRACE;
     i = &c;
     cachedStr = "";
     cachedStr.reserve(LOG_RESERVE_SIZE);
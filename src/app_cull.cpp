@@ -0,0 +1,118 @@
+#include "application.h"
+#include <cstring>
+
+void Application::vk_createCulling(){
+    VkDescriptorSetLayoutBinding bindings[4] {};
+    for(uint32_t i = 0;i < 4;++i){
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+    VkDescriptorSetLayoutCreateInfo layoutInfo {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = 4;
+    layoutInfo.pBindings = bindings;
+    cullSetLayout = descriptors.layout(layoutInfo);
+    if(!cullSetLayout){
+        lg(LOG_CRITI) << "Failed to create cull descriptor set layout!" << endlog;
+        std::exit(-1);
+    }
+
+    // set 0和图形管线共用同一个uniform
+    VkDescriptorSetLayout sets[] = {uniformSetLayout,cullSetLayout};
+    VkPushConstantRange push {};
+    push.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    push.offset = 0;
+    push.size = sizeof(uint32_t) * 3;
+    VkPipelineLayoutCreateInfo pipeInfo {};
+    pipeInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipeInfo.setLayoutCount = 2;
+    pipeInfo.pSetLayouts = sets;
+    pipeInfo.pushConstantRangeCount = 1;
+    pipeInfo.pPushConstantRanges = &push;
+    if(VkResult r = vkCreatePipelineLayout(device,&pipeInfo,nullptr,&cullLayout);r != VK_SUCCESS){
+        lg(LOG_CRITI) << "Failed to create cull pipeline layout:" << (int)r << endlog;
+        std::exit(-1);
+    }
+
+    VkShaderModule module = create_shader_module(device,cullCode);
+    if(!module){
+        lg(LOG_CRITI) << "Failed to create cull shader!" << endlog;
+        std::exit(-1);
+    }
+    VkComputePipelineCreateInfo info {};
+    info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    info.stage.module = module;
+    info.stage.pName = "main";
+    info.layout = cullLayout;
+    VkResult r = vkCreateComputePipelines(device,pipelineCache,1,&info,nullptr,&cullPipeline);
+    vkDestroyShaderModule(device,module,nullptr);
+    if(r != VK_SUCCESS){
+        lg(LOG_CRITI) << "Failed to create cull pipeline:" << (int)r << endlog;
+        std::exit(-1);
+    }
+
+    if(!allocator.createBuffer(sizeof(uint32_t) * framesInFlight,VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,0,cullStatsBuffer)){
+        lg(LOG_CRITI) << "Failed to create cull stats buffer!" << endlog;
+        std::exit(-1);
+    }
+    std::memset(cullStatsBuffer.alloc.mapped,0,sizeof(uint32_t) * framesInFlight);
+
+    updateDescriptorSets();
+    lg(LOG_INFO) << "vkCulling:OK" << endlog;
+}
+
+void Application::collectCullStats(uint32_t slot){
+    // fence之后读，下一次用这个槽之前清零；CPU只看总数，不碰每个物体
+    auto counts = (uint32_t*)cullStatsBuffer.alloc.mapped;
+    if(drawPath == DrawPath::Culled)cullVisible = counts[slot];
+    counts[slot] = 0;
+}
+
+void Application::setDrawPath(DrawPath path){
+    if(path == drawPath)return;
+    drawPath = path;
+    retire(frameGraph.release());
+    vk_createFrameGraph();
+    invalidateRecording();
+}
+
+int Application::runCullBenchmark(){
+    if(!headless)lg(LOG_WARN) << "bench-cull:frame times are capped by the present mode,use --headless" << endlog;
+    setInstances(app_bench_cull_objects);
+
+    const std::pair<DrawPath,const char*> paths[] = {
+        {DrawPath::Instanced,"instanced"},
+        {DrawPath::Culled,"culled"}
+    };
+    for(auto [path,name] : paths){
+        setDrawPath(path);
+        for(uint32_t i = 0;i < 10;++i)benchFrame();
+        profiler.clearSamples();
+
+        Clock clk;
+        for(uint32_t i = 0;i < app_bench_frames;++i)benchFrame();
+        waitFrames();
+        double elapsed = clk.getAllTime();
+        collectCullStats((currentFrame + framesInFlight - 1) % framesInFlight);
+
+        lg(LOG_INFO) << "bench-cull:" << instanceCount << " objects," << name << ":frame " << (elapsed / app_bench_frames) << "ms";
+        if(path == DrawPath::Culled){
+            lg << ",visible " << cullVisible << ",culled " << (instanceCount - cullVisible);
+            if(auto t = profiler.percentile("gpu cull",0.5))lg << ",gpu cull p50 " << *t << "ms";
+        }
+        if(auto t = profiler.percentile("gpu renderPass",0.5))lg << ",gpu renderPass p50 " << *t << "ms";
+        lg << endlog;
+    }
+    return 0;
+}
+
+void Application::cleanupCulling(){
+    vkDestroyPipeline(device,cullPipeline,nullptr);
+    vkDestroyPipelineLayout(device,cullLayout,nullptr);
+    allocator.destroyBuffer(cullStatsBuffer);
+}
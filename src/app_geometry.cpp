@@ -0,0 +1,313 @@
+#include "application.h"
+#include "vkutil.h"
+#include <cmath>
+#include <cstring>
+
+void Application::vk_createAllocator(){
+    allocator.init(physicalDevice,device);
+    lg(LOG_INFO) << "vkAllocator:OK,allocation limit " << allocator.maxAllocationCount() << endlog;
+}
+
+void Application::vk_createUploadContext(){
+    VkCommandPoolCreateInfo pin {};
+    pin.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pin.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    pin.queueFamilyIndex = *queueFamilies.transferFamily;
+    if(VkResult r = vkCreateCommandPool(device,&pin,nullptr,&uploadPool);r != VK_SUCCESS){
+        lg(LOG_CRITI) << "Failed to create upload command pool:" << (int)r << endlog;
+        std::exit(-1);
+    }
+
+    VkCommandBufferAllocateInfo alloc {};
+    alloc.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc.commandBufferCount = 2;
+    alloc.commandPool = uploadPool;
+    alloc.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    if(VkResult r = vkAllocateCommandBuffers(device,&alloc,uploadCommandBuffers);r != VK_SUCCESS){
+        lg(LOG_CRITI) << "Failed to create upload command buffers:" << (int)r << endlog;
+        std::exit(-1);
+    }
+
+    VkFenceCreateInfo fenc {};
+    fenc.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenc.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+    for(auto & f : uploadFences){
+        if(VkResult r = vkCreateFence(device,&fenc,nullptr,&f);r != VK_SUCCESS){
+            lg(LOG_CRITI) << "Failed to create upload fences:" << (int)r << endlog;
+            std::exit(-1);
+        }
+    }
+
+    if(!allocator.createBuffer(app_staging_size,VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,0,stagingBuffer)){
+        lg(LOG_CRITI) << "Failed to create staging buffer!" << endlog;
+        std::exit(-1);
+    }
+    lg(LOG_INFO) << "vkUploadContext:OK,staging " << (app_staging_size >> 20) << "MB" << endlog;
+}
+
+void Application::uploadBuffer(const GpuBuffer & dst,const void * data,VkDeviceSize size,VkDeviceSize dstOffset){
+    // UMA设备上device local也可能是host visible的，直接写就行
+    if(dst.alloc.mapped && allocator.isCoherent(dst.alloc.memoryType)){
+        std::memcpy((char*)dst.alloc.mapped + dstOffset,data,size);
+        return;
+    }
+
+    std::lock_guard guard(uploadLock);
+    const char * src = (const char*)data;
+    VkDeviceSize half = stagingBuffer.size / 2;
+    uint32_t slot = 0;
+    // 两半轮流用，CPU往一半里拷的时候GPU在复制另一半
+    for(VkDeviceSize done = 0;done < size;done += half,slot ^= 1){
+        VkDeviceSize chunk = std::min(half,size - done);
+        vkd.vkWaitForFences(device,1,&uploadFences[slot],VK_TRUE,UINT64_MAX);
+        vkd.vkResetFences(device,1,&uploadFences[slot]);
+        std::memcpy((char*)stagingBuffer.alloc.mapped + slot * half,src + done,chunk);
+
+        VkCommandBuffer cmd = uploadCommandBuffers[slot];
+        vkd.vkResetCommandBuffer(cmd,0);
+        VkCommandBufferBeginInfo begInfo {};
+        begInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkd.vkBeginCommandBuffer(cmd,&begInfo);
+        VkBufferCopy region {};
+        region.srcOffset = slot * half;
+        region.dstOffset = dstOffset + done;
+        region.size = chunk;
+        vkd.vkCmdCopyBuffer(cmd,stagingBuffer.buffer,dst.buffer,1,&region);
+
+        if(queueFamilies.dedicatedTransfer() && done + chunk == size){
+            // 同一个队列上之前的块都在这个barrier的范围里，整段一起release给图形族
+            VkBufferMemoryBarrier release {};
+            release.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            release.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            release.dstAccessMask = 0;
+            release.srcQueueFamilyIndex = *queueFamilies.transferFamily;
+            release.dstQueueFamilyIndex = *queueFamilies.graphicsFamily;
+            release.buffer = dst.buffer;
+            release.offset = dstOffset;
+            release.size = size;
+            vkd.vkCmdPipelineBarrier(cmd,VK_PIPELINE_STAGE_TRANSFER_BIT,VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,0,
+                                 0,nullptr,1,&release,0,nullptr);
+
+            // 对应的acquire在下一帧开头由图形队列执行
+            VkBufferMemoryBarrier acquire = release;
+            acquire.srcAccessMask = 0;
+            acquire.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+                                    VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+            pendingAcquires.push_back(acquire);
+        }
+        vkd.vkEndCommandBuffer(cmd);
+
+        VkSubmitInfo submitInfo {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &cmd;
+        if(VkResult r = vkd.vkQueueSubmit(transferQueue,1,&submitInfo,uploadFences[slot]);r != VK_SUCCESS){
+            lg(LOG_ERROR) << "Failed to submit upload:" << (int)r << endlog;
+        }
+    }
+    vkd.vkWaitForFences(device,2,uploadFences,VK_TRUE,UINT64_MAX);
+}
+
+VkCommandBuffer Application::recordAcquires(){
+    std::lock_guard guard(uploadLock);
+    if(pendingAcquires.empty() && pendingImageAcquires.empty())return VK_NULL_HANDLE;
+
+    // release已经随上传的fence完成了，这里只需要在图形族上acquire
+    VkCommandBuffer cmd = acquireCommandBuffers[currentFrame];
+    vkd.vkResetCommandBuffer(cmd,0);
+    VkCommandBufferBeginInfo begInfo {};
+    begInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkd.vkBeginCommandBuffer(cmd,&begInfo);
+    vkd.vkCmdPipelineBarrier(cmd,VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+                         VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0,0,nullptr,pendingAcquires.size(),pendingAcquires.data(),
+                         pendingImageAcquires.size(),pendingImageAcquires.data());
+    vkd.vkEndCommandBuffer(cmd);
+    pendingAcquires.clear();
+    pendingImageAcquires.clear();
+    return cmd;
+}
+
+bool Application::createMesh(std::span<const Vertex> vertices,std::span<const uint32_t> indices,Mesh & out){
+    if(!allocator.createBuffer(vertices.size_bytes(),VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                               0,VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,out.vertices)){
+        return false;
+    }
+    if(!allocator.createBuffer(indices.size_bytes(),VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                               0,VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,out.indices)){
+        allocator.destroyBuffer(out.vertices);
+        return false;
+    }
+    uploadBuffer(out.vertices,vertices.data(),vertices.size_bytes());
+    uploadBuffer(out.indices,indices.data(),indices.size_bytes());
+    out.indexCount = indices.size();
+    out.radius = 0;
+    for(auto & v : vertices)out.radius = std::max(out.radius,std::hypot(v.pos.x,v.pos.y));
+    return true;
+}
+
+void Application::destroyBuffer(GpuBuffer & buf){
+    {
+        // 还没acquire就销毁的话，barrier不能再引用它
+        std::lock_guard guard(uploadLock);
+        std::erase_if(pendingAcquires,[&](const VkBufferMemoryBarrier & b){ return b.buffer == buf.buffer; });
+    }
+    if(!buf.buffer)return;
+    // 在途的帧可能还在读它
+    retire([this,old = buf]() mutable { allocator.destroyBuffer(old); });
+    buf = {};
+}
+
+void Application::destroyMesh(Mesh & m){
+    destroyBuffer(m.vertices);
+    destroyBuffer(m.indices);
+    m.indexCount = 0;
+}
+
+void Application::vk_createMesh(){
+    const Vertex vertices[] = {
+        {{-0.5f,-0.5f},{1.0f,0.0f,0.0f}},
+        {{0.5f,-0.5f},{0.0f,1.0f,0.0f}},
+        {{0.5f,0.5f},{0.0f,0.0f,1.0f}},
+        {{-0.5f,0.5f},{1.0f,1.0f,1.0f}}
+    };
+    const uint32_t indices[] = {0,1,2,2,3,0};
+
+    if(!createMesh(vertices,indices,mesh)){
+        lg(LOG_CRITI) << "Failed to create mesh buffers!" << endlog;
+        std::exit(-1);
+    }
+    setInstances(instanceCount);
+    lg(LOG_INFO) << "vkMesh:OK," << instanceCount << " instances" << endlog;
+}
+
+void Application::setInstances(uint32_t count){
+    count = std::max(count,1u);
+    // 排成正方形网格，每格里放一个缩小的网格
+    uint32_t side = (uint32_t)std::ceil(std::sqrt((double)count));
+    float cell = 2.0f / side;
+    std::vector<Instance> instances (count);
+    for(uint32_t i = 0;i < count;++i){
+        instances[i].offset = {-1.0f + cell * (i % side + 0.5f),-1.0f + cell * (i / side + 0.5f)};
+        instances[i].scale = count == 1 ? 1.0f : cell * 0.8f;
+        instances[i].texture = textures.empty() ? defaultTexture.slot : textures[i % textures.size()].slot;
+    }
+
+    VkDrawIndexedIndirectCommand cmd {};
+    cmd.indexCount = mesh.indexCount;
+    cmd.instanceCount = count;
+    cmd.firstIndex = 0;
+    cmd.vertexOffset = 0;
+    cmd.firstInstance = 0;
+
+    destroyBuffer(instanceBuffer);
+    destroyBuffer(indirectBuffer);
+    destroyBuffer(visibleBuffer);
+    destroyBuffer(cullDrawBuffer);
+    // 剔除用的两个缓冲只在GPU上写，不用上传
+    if(!allocator.createBuffer(sizeof(Instance) * count,VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                               VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,0,VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,instanceBuffer) ||
+       !allocator.createBuffer(sizeof(cmd),VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                               0,VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,indirectBuffer) ||
+       !allocator.createBuffer(sizeof(Instance) * count,VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                               0,VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,visibleBuffer) ||
+       !allocator.createBuffer(sizeof(cmd),VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                               VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,0,VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,cullDrawBuffer)){
+        lg(LOG_CRITI) << "Failed to create instance buffers!" << endlog;
+        std::exit(-1);
+    }
+    uploadBuffer(instanceBuffer,instances.data(),sizeof(Instance) * count);
+    uploadBuffer(indirectBuffer,&cmd,sizeof(cmd));
+
+    instanceCount = count;
+    instanceData = std::move(instances);
+    streamInstanceNext = count;
+    // 旧缓冲退休后句柄可能被新对象重用，缓存里指着它们的set都不能再命中
+    descriptors.invalidate(frameSerial + 1);
+    updateDescriptorSets();
+    invalidateRecording();
+}
+
+int Application::runDrawBenchmark(){
+    const uint32_t counts[] = {1,1000,100000};
+    const std::pair<DrawPath,const char*> paths[] = {
+        {DrawPath::PerObject,"per-object"},
+        {DrawPath::Instanced,"instanced"},
+        {DrawPath::Indirect,"indirect"},
+        {DrawPath::Culled,"culled"}
+    };
+    if(!headless)lg(LOG_WARN) << "bench-draw:frame times are capped by the present mode,use --headless" << endlog;
+
+    for(uint32_t n : counts){
+        for(auto [path,name] : paths){
+            setDrawPath(path);
+            setInstances(n);
+            for(uint32_t i = 0;i < 10;++i)benchFrame();
+
+            recordTime = 0;
+            recordCount = 0;
+            Clock clk;
+            for(uint32_t i = 0;i < app_bench_frames;++i)benchFrame();
+            waitFrames();
+            double elapsed = clk.getAllTime();
+
+            lg(LOG_INFO) << "bench-draw:" << n << " instances," << name << ":record "
+                         << (recordCount ? recordTime / recordCount : 0.0) << "ms,frame "
+                         << (elapsed / app_bench_frames) << "ms" << endlog;
+        }
+    }
+    return 0;
+}
+
+int Application::runUploadBenchmark(){
+    const uint32_t counts[] = {1000,10000,100000,1000000,10000000};
+    lg(LOG_INFO) << "bench-upload:" << (mesh.vertices.alloc.mapped ? "direct writes (host visible device memory)" : "staging copies")
+                 << ",vertex " << sizeof(Vertex) << "B" << endlog;
+
+    for(uint32_t n : counts){
+        std::vector<Vertex> vertices (n);
+        std::vector<uint32_t> indices (n);
+        for(uint32_t i = 0;i < n;++i){
+            float t = (float)i / n;
+            vertices[i] = {{t * 2 - 1,(float)(i % 3) - 1},{t,1 - t,0.5f}};
+            indices[i] = i;
+        }
+
+        Mesh m;
+        Clock clk;
+        if(!createMesh(vertices,indices,m)){
+            lg(LOG_ERROR) << "bench-upload:out of memory at " << n << " vertices" << endlog;
+            break;
+        }
+        double elapsed = clk.getAllTime();
+        double mb = (vertices.size() * sizeof(Vertex) + indices.size() * sizeof(uint32_t)) / (1024.0 * 1024.0);
+        lg(LOG_INFO) << "bench-upload:" << n << " vertices," << mb << "MB in " << elapsed << "ms,"
+                     << (mb * 1000.0 / std::max(elapsed,1e-3)) << "MB/s,memory blocks " << allocator.blockCount()
+                     << "/" << allocator.maxAllocationCount() << endlog;
+        destroyMesh(m);
+        // 没有帧用过它，立刻释放，不然下一轮的块数不准
+        deletionQueue.flush(completedSerial);
+    }
+    allocator.report(lg);
+    return 0;
+}
+
+void Application::cleanupGeometry(){
+    allocator.report(lg);
+    destroyMesh(mesh);
+    destroyBuffer(instanceBuffer);
+    destroyBuffer(indirectBuffer);
+    destroyBuffer(visibleBuffer);
+    destroyBuffer(cullDrawBuffer);
+    allocator.destroyBuffer(stagingBuffer);
+    for(auto f : uploadFences)vkDestroyFence(device,f,nullptr);
+    vkDestroyCommandPool(device,uploadPool,nullptr);
+    // 退休的缓冲要在分配器之前还回去
+    deletionQueue.flush();
+    allocator.destroy();
+}
@@ -0,0 +1,99 @@
+#include "application.h"
+#include <fstream>
+
+void Application::vk_createFrameGraph(){
+    frameGraph.init(device,allocator,vkd);
+
+    // 交换链图像每帧都是新拿到的，内容不要；窗口模式最后转成PRESENT_SRC
+    RenderGraph::State acquired {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,0,VK_IMAGE_LAYOUT_UNDEFINED};
+    RenderGraph::State presented {VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,0,
+                                  headless ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR};
+    rgBackbuffer = frameGraph.importImage("backbuffer",VK_IMAGE_ASPECT_COLOR_BIT,acquired,presented);
+
+    // 剔除的输出被上一帧的绘制读着，同一队列上的屏障会等它读完
+    RenderGraph::State keep {};
+    rgInstances = frameGraph.importBuffer("instances",keep,keep);
+    rgVisible = frameGraph.importBuffer("visible",{VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,0,VK_IMAGE_LAYOUT_UNDEFINED},keep);
+    rgCullDraw = frameGraph.importBuffer("cullDraw",{VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,0,VK_IMAGE_LAYOUT_UNDEFINED},keep);
+    rgCullStats = frameGraph.importBuffer("cullStats",keep,{VK_PIPELINE_STAGE_HOST_BIT,VK_ACCESS_HOST_READ_BIT,VK_IMAGE_LAYOUT_UNDEFINED});
+
+    // 不走剔除路径时没有pass读它们的结果，这两个pass会被图剔掉
+    RenderGraph::Id cullReset = frameGraph.addPass("cullReset",[this](VkCommandBuffer buf){
+        VkDrawIndexedIndirectCommand cmd {mesh.indexCount,0,0,0,0};
+        vkd.vkCmdUpdateBuffer(buf,cullDrawBuffer.buffer,0,sizeof(cmd),&cmd);
+    });
+    frameGraph.use(cullReset,rgCullDraw,RGUsage::TransferDst);
+
+    RenderGraph::Id cull = frameGraph.addPass("cull",[this](VkCommandBuffer buf){
+        uint32_t gpuCull = profiler.gpuBegin(buf,currentFrame,"cull");
+        vkd.vkCmdBindPipeline(buf,VK_PIPELINE_BIND_POINT_COMPUTE,cullPipeline);
+        VkDescriptorSet sets[] = {frameUniformSet(0),cullSet};
+        vkd.vkCmdBindDescriptorSets(buf,VK_PIPELINE_BIND_POINT_COMPUTE,cullLayout,0,2,sets,1,&frameUniformOffset);
+        struct{
+            uint32_t count;
+            float radius;
+            uint32_t statSlot;
+        } params {instanceCount,mesh.radius,currentFrame};
+        vkd.vkCmdPushConstants(buf,cullLayout,VK_SHADER_STAGE_COMPUTE_BIT,0,sizeof(params),&params);
+        vkd.vkCmdDispatch(buf,(instanceCount + app_cull_group_size - 1) / app_cull_group_size,1,1);
+        profiler.gpuEnd(buf,currentFrame,gpuCull);
+    });
+    frameGraph.use(cull,rgInstances,RGUsage::StorageRead);
+    frameGraph.use(cull,rgVisible,RGUsage::StorageWrite);
+    frameGraph.use(cull,rgCullDraw,RGUsage::StorageReadWrite);
+    frameGraph.use(cull,rgCullStats,RGUsage::StorageReadWrite);
+
+    RenderGraph::Id scene = frameGraph.addPass("scene",[this](VkCommandBuffer buf){
+        VkRenderPassBeginInfo renderInfo {};
+        renderInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderInfo.renderPass = renderPass;
+        renderInfo.framebuffer = swapChainFramebuffers[graphImage];
+        renderInfo.renderArea.offset = {0,0};
+        renderInfo.renderArea.extent = swapChainExtent;
+        renderInfo.clearValueCount = 1;
+        renderInfo.pClearValues = &clearColor;
+
+        uint32_t gpuPass = profiler.gpuBegin(buf,currentFrame,"renderPass");
+        if(recordThreads){
+            // 各线程录secondary，这里只负责执行
+            vkd.vkCmdBeginRenderPass(buf,&renderInfo,VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+            auto secondaries = recordSecondaries(graphImage);
+            vkd.vkCmdExecuteCommands(buf,secondaries.size(),secondaries.data());
+        }else{
+            vkd.vkCmdBeginRenderPass(buf,&renderInfo,VK_SUBPASS_CONTENTS_INLINE);
+            recordDraws(buf,0,instanceCount,0);
+        }
+        vkd.vkCmdEndRenderPass(buf);
+        profiler.gpuEnd(buf,currentFrame,gpuPass);
+    });
+    frameGraph.use(scene,rgBackbuffer,RGUsage::ColorAttachment);
+    if(drawPath == DrawPath::Culled){
+        frameGraph.use(scene,rgCullDraw,RGUsage::IndirectRead);
+        frameGraph.use(scene,rgVisible,RGUsage::VertexRead);
+    }
+
+    if(headless){
+        // CPU在fence之后读，最后要让传输写对host可见
+        RenderGraph::State host {VK_PIPELINE_STAGE_HOST_BIT,VK_ACCESS_HOST_READ_BIT,VK_IMAGE_LAYOUT_UNDEFINED};
+        rgReadback = frameGraph.importBuffer("readback",host,host);
+        RenderGraph::Id readback = frameGraph.addPass("readback",[this](VkCommandBuffer buf){
+            uint32_t gpuReadback = profiler.gpuBegin(buf,currentFrame,"readback");
+            vk_recordReadback(buf,graphImage);
+            profiler.gpuEnd(buf,currentFrame,gpuReadback);
+        });
+        frameGraph.use(readback,rgBackbuffer,RGUsage::TransferSrc);
+        frameGraph.use(readback,rgReadback,RGUsage::TransferDst);
+        frameGraph.output(rgReadback);
+    }else frameGraph.output(rgBackbuffer);
+
+    if(!frameGraph.compile()){
+        lg(LOG_CRITI) << "Failed to compile the frame graph:" << frameGraph.error() << endlog;
+        std::exit(-1);
+    }
+    if(!graphDumpPath.empty()){
+        std::ofstream out (graphDumpPath);
+        out << frameGraph.dump();
+        if(!out)lg(LOG_WARN) << "Failed to write the frame graph to " << graphDumpPath << endlog;
+    }
+    lg(LOG_INFO) << "vkFrameGraph:OK," << frameGraph.barrierCount() << " barriers" << endlog;
+}
@@ -0,0 +1,232 @@
+#include "application.h"
+#include "vkutil.h"
+#include <cstdio>
+#include <filesystem>
+
+/// write a tightly packed RGBA8 image as a binary PPM (alpha dropped)
+static bool writePPM(const std::string & path,const uint8_t * rgba,uint32_t w,uint32_t h){
+    FILE * f = std::fopen(path.c_str(),"wb");
+    if(!f)return false;
+    std::fprintf(f,"P6\n%u %u\n255\n",w,h);
+    std::vector<uint8_t> row (w * 3);
+    for(uint32_t y = 0;y < h;++y){
+        const uint8_t * src = rgba + (size_t)y * w * 4;
+        for(uint32_t x = 0;x < w;++x){
+            row[x * 3 + 0] = src[x * 4 + 0];
+            row[x * 3 + 1] = src[x * 4 + 1];
+            row[x * 3 + 2] = src[x * 4 + 2];
+        }
+        std::fwrite(row.data(),1,row.size(),f);
+    }
+    std::fclose(f);
+    return true;
+}
+
+void Application::vk_createOffscreenTargets(){
+    swapChainImageFormat = app_headless_format;
+    swapChainExtent = {(uint32_t)win_width,(uint32_t)win_height};
+
+    // 一帧一张图，图片与帧槽一一对应
+    swapChainImages.resize(framesInFlight);
+    offscreenAllocations.resize(framesInFlight);
+    for(uint32_t i = 0;i < framesInFlight;++i){
+        VkImageCreateInfo info {};
+        info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        info.imageType = VK_IMAGE_TYPE_2D;
+        info.format = swapChainImageFormat;
+        info.extent = {swapChainExtent.width,swapChainExtent.height,1};
+        info.mipLevels = 1;
+        info.arrayLayers = 1;
+        info.samples = VK_SAMPLE_COUNT_1_BIT;
+        info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        GpuImage img;
+        if(!allocator.createImage(info,0,VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,img)){
+            lg(LOG_CRITI) << "Failed to create offscreen image " << i << endlog;
+            std::exit(-1);
+        }
+        swapChainImages[i] = img.image;
+        offscreenAllocations[i] = img.alloc;
+    }
+    lg(LOG_INFO) << "vkOffscreenTargets:OK," << framesInFlight << " images " << swapChainExtent.width
+                 << "x" << swapChainExtent.height << endlog;
+}
+
+void Application::vk_createReadbackBuffers(){
+    VkDeviceSize size = (VkDeviceSize)swapChainExtent.width * swapChainExtent.height * 4;
+
+    readbackBuffers.resize(framesInFlight);
+    readbackMemories.resize(framesInFlight);
+    readbackMapped.resize(framesInFlight);
+    readbackSerials.assign(framesInFlight,0);
+    for(uint32_t i = 0;i < framesInFlight;++i){
+        VkBufferCreateInfo info {};
+        info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        info.size = size;
+        info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        if(VkResult r = vkCreateBuffer(device,&info,nullptr,&readbackBuffers[i]);r != VK_SUCCESS){
+            lg(LOG_CRITI) << "Failed to create readback buffer:" << (int)r << endlog;
+            std::exit(-1);
+        }
+
+        VkMemoryRequirements req;
+        vkGetBufferMemoryRequirements(device,readbackBuffers[i],&req);
+        // CPU要读，优先cached
+        VkMemoryPropertyFlags props = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+        auto type = find_memory_type(physicalDevice,req.memoryTypeBits,props);
+        if(!type){
+            props = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+            type = find_memory_type(physicalDevice,req.memoryTypeBits,props);
+        }
+        if(!type){
+            lg(LOG_CRITI) << "No host visible memory for readback!" << endlog;
+            std::exit(-1);
+        }
+        VkPhysicalDeviceMemoryProperties memProps;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice,&memProps);
+        readbackCoherent = memProps.memoryTypes[*type].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+        VkMemoryAllocateInfo alloc {};
+        alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        alloc.allocationSize = req.size;
+        alloc.memoryTypeIndex = *type;
+        if(VkResult r = vkAllocateMemory(device,&alloc,nullptr,&readbackMemories[i]);r != VK_SUCCESS){
+            lg(LOG_CRITI) << "Failed to allocate readback memory:" << (int)r << endlog;
+            std::exit(-1);
+        }
+        vkBindBufferMemory(device,readbackBuffers[i],readbackMemories[i],0);
+        // 一直映射着，读的时候不用再map/unmap
+        vkMapMemory(device,readbackMemories[i],0,VK_WHOLE_SIZE,0,&readbackMapped[i]);
+    }
+    lg(LOG_INFO) << "vkReadbackBuffers:OK" << (readbackCoherent ? "" : ",non-coherent") << endlog;
+}
+
+void Application::vk_recordReadback(VkCommandBuffer buf,uint32_t index){
+    // 布局转换和对host可见的屏障由frame graph插入
+    VkBufferImageCopy region {};
+    region.bufferOffset = 0;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = {0,0,0};
+    region.imageExtent = {swapChainExtent.width,swapChainExtent.height,1};
+    vkd.vkCmdCopyImageToBuffer(buf,swapChainImages[index],VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,readbackBuffers[index],1,&region);
+}
+
+void Application::consumeReadback(uint32_t slot){
+    uint64_t serial = readbackSerials[slot];
+    if(!serial)return;
+    readbackSerials[slot] = 0;
+
+    if(dumpDir.empty())return;
+    bool last = serial == headlessFrames;
+    if(!last && (!dumpEvery || serial % dumpEvery))return;
+
+    if(!readbackCoherent){
+        VkMappedMemoryRange range {};
+        range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+        range.memory = readbackMemories[slot];
+        range.offset = 0;
+        range.size = VK_WHOLE_SIZE;
+        vkInvalidateMappedMemoryRanges(device,1,&range);
+    }
+
+    char name[64];
+    std::snprintf(name,sizeof(name),"frame_%05llu.ppm",(unsigned long long)serial);
+    std::string path = (std::filesystem::path(dumpDir) / name).string();
+    if(!writePPM(path,(const uint8_t*)readbackMapped[slot],swapChainExtent.width,swapChainExtent.height)){
+        lg(LOG_ERROR) << "Failed to dump frame to " << path << endlog;
+    }
+}
+
+void Application::drawFrameHeadless(){
+    PROFILE_SCOPE(profiler,"frame");
+    {
+        PROFILE_SCOPE(profiler,"waitFence");
+        vkd.vkWaitForFences(device,1,&fen_inFlight[currentFrame],VK_TRUE,UINT64_MAX);
+    }
+    completedSerial = std::max(completedSerial,frameSerials[currentFrame]);
+    deletionQueue.flush(completedSerial);
+    profiler.collect(currentFrame);
+    // 这个槽上一次的结果已经完成，在覆盖之前先取走
+    consumeReadback(currentFrame);
+
+    vkd.vkResetFences(device,1,&fen_inFlight[currentFrame]);
+
+    refreshPipelines();
+    // 先把传完的纹理放进表里，没有descriptor indexing时这一帧的set就能带上它们
+    publishStreamed();
+    refreshTextures();
+    descriptors.beginFrame(currentFrame,frameSerial + 1,completedSerial);
+    updateDescriptorSets();
+    updateFrameUniforms();
+    collectCullStats(currentFrame);
+    VkCommandBuffer acquire = recordAcquires();
+    VkCommandBuffer stream = recordStreaming();
+    VkCommandBuffer commandBuffer = prepareCommandBuffer(currentFrame);
+
+    VkSubmitInfo submitInfo {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    // 有刚上传完的缓冲的话，先在图形队列上把所有权拿过来，流式上传的纹理也排在帧前面
+    VkCommandBuffer submitBuffers[3];
+    uint32_t submitCount = 0;
+    if(acquire)submitBuffers[submitCount++] = acquire;
+    if(stream)submitBuffers[submitCount++] = stream;
+    submitBuffers[submitCount++] = commandBuffer;
+    submitInfo.commandBufferCount = submitCount;
+    submitInfo.pCommandBuffers = submitBuffers;
+
+    if(VkResult r = vkd.vkQueueSubmit(graphicsQueue,1,&submitInfo,fen_inFlight[currentFrame]);r != VK_SUCCESS){
+        lg(LOG_ERROR) << "Failed to submit this frame:" << (int)r << endlog;
+    }
+    profiler.frameSubmitted(currentFrame);
+    frameSerials[currentFrame] = ++frameSerial;
+    readbackSerials[currentFrame] = frameSerial;
+
+    currentFrame = (currentFrame + 1) % framesInFlight;
+}
+
+int Application::runHeadless(){
+    if(!dumpDir.empty())std::filesystem::create_directories(dumpDir);
+    lg(LOG_INFO) << "headless:rendering " << headlessFrames << " frames" << endlog;
+
+    Clock clk;
+    uint64_t ticks = simulation.ticks();
+    for(uint64_t i = 0;i < headlessFrames;++i){
+        drawFrameHeadless();
+        if(!i)lg(LOG_INFO) << "time to first frame:" << startClock.getAllTime() << "ms" << endlog;
+    }
+    vkDeviceWaitIdle(device);
+    double elapsed = clk.getAllTime();
+    for(uint32_t i = 0;i < framesInFlight;++i){
+        consumeReadback(i);
+        profiler.collect(i);
+    }
+
+    lg(LOG_INFO) << "headless:" << headlessFrames << " frames in " << elapsed << "ms,avg frame time "
+                 << (elapsed / headlessFrames) << "ms (" << (headlessFrames * 1000.0 / elapsed) << " fps),update rate "
+                 << ((simulation.ticks() - ticks) * 1000.0 / elapsed) << " Hz";
+    if(streamBytes)lg << ",streamed " << streamPublished << " textures," << (streamBytes / headlessFrames >> 10) << "KB/frame";
+    lg << endlog;
+    profiler.report(lg);
+    return 0;
+}
+
+void Application::cleanupHeadless(){
+    for(uint32_t i = 0;i < readbackBuffers.size();++i){
+        vkUnmapMemory(device,readbackMemories[i]);
+        vkDestroyBuffer(device,readbackBuffers[i],nullptr);
+        vkFreeMemory(device,readbackMemories[i],nullptr);
+    }
+    for(uint32_t i = 0;i < swapChainImages.size();++i){
+        vkDestroyImage(device,swapChainImages[i],nullptr);
+        allocator.free(offscreenAllocations[i]);
+    }
+}
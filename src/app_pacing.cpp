@@ -0,0 +1,22 @@
+#include "application.h"
+
+void Application::waitBeforeRecord(){
+    if(!frameSerial)return;
+    // 上一帧做完了再采输入、录制，输入到画面之间不再排着别的帧
+    uint32_t last = (currentFrame + framesInFlight - 1) % framesInFlight;
+    PROFILE_SCOPE(profiler,"waitBeforeRecord");
+    vkd.vkWaitForFences(device,1,&fen_inFlight[last],VK_TRUE,UINT64_MAX);
+}
+
+void Application::pollLatency(){
+    double now = startClock.getAllTime();
+    for(uint32_t i = 0;i < framesInFlight;++i){
+        if(inputStamps[i] < 0 || vkd.vkGetFenceStatus(device,fen_inFlight[i]) != VK_SUCCESS)continue;
+        // 只能看到GPU什么时候做完，真正上屏还要再等最多一次刷新
+        double latency = now - inputStamps[i];
+        inputStamps[i] = -1;
+        latencySum += latency;
+        latencyMax = std::max(latencyMax,latency);
+        ++latencyCount;
+    }
+}
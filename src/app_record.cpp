@@ -0,0 +1,166 @@
+#include "application.h"
+#include "vkutil.h"
+
+void Application::vk_createRecordContexts(){
+    if(!recordThreads)return;
+    if(staticRecording){
+        // static buffer会被反复提交，而secondary所在的池每帧都要整个重置
+        lg(LOG_WARN) << "threaded recording is ignored with --static-recording" << endlog;
+        recordThreads = 0;
+        return;
+    }
+
+    // 和图形队列用同一个族，就是vk_createLogicalDevice选的那个
+    VkCommandPoolCreateInfo pin {};
+    pin.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pin.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    pin.queueFamilyIndex = *queueFamilies.graphicsFamily;
+
+    recordPools.assign(recordThreads,std::vector<VkCommandPool>(framesInFlight));
+    recordBuffers.assign(recordThreads,std::vector<VkCommandBuffer>(framesInFlight));
+    for(uint32_t w = 0;w < recordThreads;++w){
+        for(uint32_t f = 0;f < framesInFlight;++f){
+            if(VkResult r = vkCreateCommandPool(device,&pin,nullptr,&recordPools[w][f]);r != VK_SUCCESS){
+                lg(LOG_CRITI) << "Failed to create recording command pool:" << (int)r << endlog;
+                std::exit(-1);
+            }
+            VkCommandBufferAllocateInfo alloc {};
+            alloc.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            alloc.commandBufferCount = 1;
+            alloc.commandPool = recordPools[w][f];
+            alloc.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            if(VkResult r = vkAllocateCommandBuffers(device,&alloc,&recordBuffers[w][f]);r != VK_SUCCESS){
+                lg(LOG_CRITI) << "Failed to create secondary command buffers:" << (int)r << endlog;
+                std::exit(-1);
+            }
+        }
+    }
+    recordWorkers.start(recordThreads);
+    lg(LOG_INFO) << "vkRecordContexts:OK," << recordThreads << " threads" << endlog;
+}
+
+void Application::destroyRecordContexts(){
+    recordWorkers.stop();
+    if(!recordPools.empty()){
+        retire([this,pools = std::move(recordPools)]{
+            for(auto & ps : pools){
+                for(auto p : ps)vkDestroyCommandPool(device,p,nullptr);
+            }
+        });
+    }
+    recordPools.clear();
+    recordBuffers.clear();
+}
+
+std::vector<VkCommandBuffer> Application::recordSecondaries(uint32_t index){
+    uint32_t n = recordWorkers.size();
+    uint32_t per = (instanceCount + n - 1) / n;
+    std::vector<VkCommandBuffer> out (n);
+
+    recordWorkers.run([&](uint32_t w){
+        PROFILE_SCOPE(profiler,"recordSecondary");
+        // 这个帧槽的fence已经等过了，整个池一起重置，不用一个个reset
+        vkd.vkResetCommandPool(device,recordPools[w][currentFrame],0);
+        VkCommandBuffer buf = recordBuffers[w][currentFrame];
+
+        VkCommandBufferInheritanceInfo inherit {};
+        inherit.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        inherit.renderPass = renderPass;
+        inherit.subpass = 0;
+        inherit.framebuffer = swapChainFramebuffers[index];
+
+        VkCommandBufferBeginInfo begInfo {};
+        begInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        begInfo.pInheritanceInfo = &inherit;
+        vkd.vkBeginCommandBuffer(buf,&begInfo);
+
+        uint32_t first = std::min(instanceCount,w * per);
+        recordDraws(buf,first,std::min(per,instanceCount - first),w);
+        vkd.vkEndCommandBuffer(buf);
+        out[w] = buf;
+    });
+    return out;
+}
+
+void Application::benchFrame(){
+    if(headless)return drawFrameHeadless();
+    glfwPollEvents();
+    drawFrame();
+}
+
+int Application::runRecordBenchmark(){
+    uint32_t maxThreads = std::max(1u,std::thread::hardware_concurrency());
+    std::vector<uint32_t> threads = {0};
+    for(uint32_t t = 1;t < maxThreads;t *= 2)threads.push_back(t);
+    threads.push_back(maxThreads);
+
+    drawPath = DrawPath::PerObject;
+    setInstances(app_bench_record_instances);
+
+    double base = 0;
+    for(uint32_t t : threads){
+        destroyRecordContexts();
+        recordThreads = t;
+        vk_createRecordContexts();
+        for(uint32_t i = 0;i < 10;++i)benchFrame();
+
+        recordTime = 0;
+        recordCount = 0;
+        Clock clk;
+        for(uint32_t i = 0;i < app_bench_frames;++i)benchFrame();
+        waitFrames();
+        double elapsed = clk.getAllTime();
+        double record = recordCount ? recordTime / recordCount : 0.0;
+        if(!t)base = record;
+
+        lg(LOG_INFO) << "bench-record:" << app_bench_record_instances << " draws,";
+        if(t)lg << t << " threads";
+        else lg << "inline";
+        lg << ":record " << record << "ms (x" << (record > 0 ? base / record : 0.0) << "),frame "
+           << (elapsed / app_bench_frames) << "ms" << endlog;
+    }
+    return 0;
+}
+
+int Application::runDispatchBenchmark(){
+    waitFrames();
+    VkCommandBuffer buf = commandBuffers[0];
+    VkCommandBufferBeginInfo begInfo {};
+    begInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    // 状态命令在render pass外面也能录，驱动里的开销很小，差别主要就是那层跳转
+    auto measure = [&](bool table){
+        vkResetCommandBuffer(buf,0);
+        vkBeginCommandBuffer(buf,&begInfo);
+        Clock clk;
+        if(table){
+            for(uint32_t i = 0;i < app_bench_dispatch_calls;i += 2){
+                vkd.vkCmdSetViewport(buf,0,1,&viewport);
+                vkd.vkCmdSetScissor(buf,0,1,&scissor);
+            }
+        }else{
+            for(uint32_t i = 0;i < app_bench_dispatch_calls;i += 2){
+                vkCmdSetViewport(buf,0,1,&viewport);
+                vkCmdSetScissor(buf,0,1,&scissor);
+            }
+        }
+        double ms = clk.getAllTime();
+        vkEndCommandBuffer(buf);
+        return ms * 1e6 / app_bench_dispatch_calls;
+    };
+
+    measure(false);
+    measure(true);
+    double loader = 1e30,table = 1e30;
+    for(uint32_t i = 0;i < 5;++i){
+        loader = std::min(loader,measure(false));
+        table = std::min(table,measure(true));
+    }
+    vkResetCommandBuffer(buf,0);
+
+    lg(LOG_INFO) << "bench-dispatch:" << app_bench_dispatch_calls << " commands,loader " << loader << "ns/call,table "
+                 << table << "ns/call (" << (loader > 0 ? (loader - table) * 100.0 / loader : 0.0) << "% saved)" << endlog;
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include "application.h"
+#include <cstdlib>
+
+static constexpr const char * shader_dir = "data/shaders";
+
+void Application::vk_createShaderWatcher(){
+    if(!shaderWatcher.start(shader_dir,[this](const std::vector<std::string> & names){ reloadShaders(names); })){
+        lg(LOG_WARN) << "Failed to watch " << shader_dir << ",shader hot reload is off" << endlog;
+        return;
+    }
+    lg(LOG_INFO) << "vkShaderWatcher:OK,watching " << shader_dir << endlog;
+}
+
+// 源码变了就用glslc重新编译，写出的spv会再触发一次
+static bool compile_shader(const std::string & src,const std::string & out,const std::string & flags = ""){
+    std::string cmd = "glslc " + flags + src + " -o " + out;
+    return std::system(cmd.c_str()) == 0;
+}
+
+void Application::reloadShaders(const std::vector<std::string> & names){
+    // 片元着色器有两个变体，只换正在用的那个
+    const char * frag = bindless.indexed() ? "frag_bindless.spv" : "frag.spv";
+    std::string dir = shader_dir;
+    bool spv = false;
+    for(auto & name : names){
+        if(name == "shader.vert"){
+            if(!compile_shader(dir + "/" + name,dir + "/vert.spv"))lg(LOG_WARN) << "glslc failed on " << name << endlog;
+        }else if(name == "shader.frag"){
+            if(!compile_shader(dir + "/" + name,dir + "/" + frag,bindless.indexed() ? "-DBINDLESS " : "")){
+                lg(LOG_WARN) << "glslc failed on " << name << endlog;
+            }
+        }else if(name == "vert.spv" || name == frag)spv = true;
+    }
+    if(!spv)return;
+
+    Clock clk;
+    std::vector<char> vcode = read_file(dir + "/vert.spv");
+    std::vector<char> fcode = read_file(dir + "/" + frag);
+    if(vcode.empty() || fcode.empty() || vcode.size() % 4 || fcode.size() % 4){
+        lg(LOG_WARN) << "Shader reload skipped,SPIR-V is missing or truncated" << endlog;
+        return;
+    }
+    ShaderReload reload;
+    reload.vert = create_shader_module(device,vcode);
+    reload.frag = create_shader_module(device,fcode);
+    if(!reload.vert || !reload.frag){
+        lg(LOG_WARN) << "Shader reload failed,keeping the old shaders" << endlog;
+        if(reload.vert)vkDestroyShaderModule(device,reload.vert,nullptr);
+        if(reload.frag)vkDestroyShaderModule(device,reload.frag,nullptr);
+        return;
+    }
+    {
+        std::lock_guard guard(reloadLock);
+        reload.key = pipelineKey;
+    }
+    reload.key.vert = reload.vert;
+    reload.key.frag = reload.frag;
+
+    // 在这个线程上编译，渲染循环照常跑
+    if(!pipelines.get(reload.key)){
+        lg(LOG_WARN) << "Pipeline rebuild failed,keeping the old shaders" << endlog;
+        vkDestroyShaderModule(device,reload.vert,nullptr);
+        vkDestroyShaderModule(device,reload.frag,nullptr);
+        return;
+    }
+
+    std::lock_guard guard(reloadLock);
+    if(pendingReload){
+        // 上一次的还没换上就又改了，GPU从没用过它，直接销毁
+        if(VkPipeline stale = pipelines.take(pendingReload->key))vkDestroyPipeline(device,stale,nullptr);
+        vkDestroyShaderModule(device,pendingReload->vert,nullptr);
+        vkDestroyShaderModule(device,pendingReload->frag,nullptr);
+    }
+    pendingReload = reload;
+    reloadReady.store(true,std::memory_order_release);
+    lg(LOG_INFO) << "shaders rebuilt in " << clk.getAllTime() << "ms,swapping at the next frame" << endlog;
+}
+
+void Application::applyShaderReload(){
+    if(!reloadReady.load(std::memory_order_acquire))return;
+    std::lock_guard guard(reloadLock);
+    reloadReady.store(false,std::memory_order_relaxed);
+    if(!pendingReload)return;
+
+    // 在途的帧还在用旧管线，等它们完成再销毁
+    retire([this,pipe = pipelines.take(pipelineKey),vert = vertModule,frag = fragModule]{
+        if(pipe)vkDestroyPipeline(device,pipe,nullptr);
+        vkDestroyShaderModule(device,vert,nullptr);
+        vkDestroyShaderModule(device,frag,nullptr);
+    });
+
+    pipelineKey = pendingReload->key;
+    vertModule = pendingReload->vert;
+    fragModule = pendingReload->frag;
+    pendingReload.reset();
+}
@@ -1,10 +1,70 @@
 #include "application.h"
+#include <ctime>
 
 int Application::run(){
-    
+    if(benchUpload)return runUploadBenchmark();
+    if(benchDraw)return runDrawBenchmark();
+    if(benchRecord)return runRecordBenchmark();
+    if(benchDispatch)return runDispatchBenchmark();
+    if(benchCull)return runCullBenchmark();
+    if(headless)return runHeadless();
+
+    Clock clk;
+    Trigger statTrigger(clk,app_stat_interval);
+    uint64_t frames = 0;
+    uint64_t ticks = simulation.ticks();
+    // 进程的CPU时间，所有线程加起来
+    std::clock_t cpu = std::clock();
+    RateLimiter limiter(fpsCap);
+
     while(!glfwWindowShouldClose(window)){
+        if(pacing == FramePacing::LowLatency)waitBeforeRecord();
+        pollLatency();
         glfwPollEvents();
+        inputStamp = startClock.getAllTime();
+        // 输入在主线程收，模拟线程下一步读
+        float spin = (glfwGetKey(window,GLFW_KEY_RIGHT) == GLFW_PRESS) - (glfwGetKey(window,GLFW_KEY_LEFT) == GLFW_PRESS);
+        simulation.spinInput.store(spin,std::memory_order_relaxed);
         drawFrame();
+        if(pacing == FramePacing::Capped){
+            PROFILE_SCOPE(profiler,"frameCap");
+            limiter.wait();
+        }
+
+        if(!frameSerial)continue;
+        if(frameSerial == 1 && !frames){
+            lg(LOG_INFO) << "time to first frame:" << startClock.getAllTime() << "ms" << endlog;
+        }
+        ++frames;
+        if(statTrigger.test()){
+            double elapsed = clk.getOffset();
+            clk.clearOffset();
+            lg(LOG_INFO) << frame_pacing_name(pacing) << ",frames in flight " << framesInFlight << ": avg frame time "
+                         << (elapsed / frames) << "ms (" << (frames * 1000.0 / elapsed) << " fps)";
+            uint64_t now = simulation.ticks();
+            lg << ", update rate " << ((now - ticks) * 1000.0 / elapsed) << " Hz";
+            ticks = now;
+            std::clock_t cpuNow = std::clock();
+            lg << ", cpu " << ((cpuNow - cpu) * 100000.0 / CLOCKS_PER_SEC / elapsed) << "%";
+            cpu = cpuNow;
+            if(latencyCount){
+                lg << ", input latency avg " << (latencySum / latencyCount) << "ms max " << latencyMax << "ms";
+            }
+            latencySum = latencyMax = 0;
+            latencyCount = 0;
+            if(drawPath == DrawPath::Culled)lg << ", visible " << cullVisible << "/" << instanceCount;
+            if(staticRecording)lg << ", static recordings:" << staticRecordCount;
+            uint32_t streamDepth = streamer.depth() + streamInFlight.size();
+            if(streamDepth || streamBytes){
+                lg << ", streaming queue " << streamDepth << ", uploaded " << (streamBytes / frames >> 10) << "KB/frame";
+            }
+            streamBytes = 0;
+            MemoryStats mem = allocator.stats();
+            lg << ", memory " << (mem.used >> 10) << "KB in " << mem.blocks << " blocks";
+            lg << endlog;
+            profiler.report(lg);
+            frames = 0;
+        }
     }
 
     vkDeviceWaitIdle(device);
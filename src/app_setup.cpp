@@ -1,24 +1,74 @@
 #define GLFW_INCLUDE_VULKAN
 #include "application.h"
 #include "vkutil.h"
+#include "taskgraph.h"
+#include <filesystem>
+#include <map>
 
 extern std::vector<const char *> app_validation_layers;
 extern std::vector<const char*> app_device_extensions;
 
 void Application::setupVulkan(){
-    vk_createInstance();
-    vk_setupDebugMessenger();
-    vk_createSurface();
-    vk_pickPhysicalDevice();
-    vk_createLogicalDevice();
-    vk_createSwapChain();
-    vk_createImageViews();
-    vk_createRenderPass();
-    vk_createGraphicePipeline();
-    vk_createFramebuffers();
-    vk_createCommandPool();
-    vk_createCommandBuffer();
-    vk_createSyncObjects();
+    using Id = TaskGraph::TaskId;
+    TaskGraph graph;
+
+    // 不依赖设备的准备工作和实例/设备的创建并行
+    Id shaders = graph.add("loadShaders",[this]{ loadShaders(); });
+    Id layers = graph.add("checkValidationLayers",[this]{ vk_checkValidationLayers(); });
+    Id instance = graph.add("createInstance",[this]{ vk_createInstance(); },{layers});
+    graph.add("listInstanceExtensions",[this]{ vk_listInstanceExtensions(); },{instance});
+    graph.add("setupDebugMessenger",[this]{ vk_setupDebugMessenger(); },{instance});
+    Id surface = instance;
+    if(!headless){
+        // GLFW要求窗口在主线程创建
+        Id window = graph.add("setupWindow",[this]{ setupWindow(); },{},true);
+        surface = graph.add("createSurface",[this]{ vk_createSurface(); },{instance,window});
+    }
+    Id pick = graph.add("pickPhysicalDevice",[this]{ vk_pickPhysicalDevice(); },{surface});
+    Id dev = graph.add("createLogicalDevice",[this]{ vk_createLogicalDevice(); },{pick});
+    Id memory = graph.add("createAllocator",[this]{ vk_createAllocator(); },{dev});
+    // 离屏图像从分配器里拿内存
+    Id swap = graph.add(headless ? "createOffscreenTargets" : "createSwapChain",[this]{
+        if(headless)vk_createOffscreenTargets();
+        else vk_createSwapChain();
+    },{dev,memory});
+    Id views = graph.add("createImageViews",[this]{ vk_createImageViews(); },{swap});
+    Id rpass = graph.add("createRenderPass",[this]{ vk_createRenderPass(); },{swap});
+    Id cache = graph.add("createPipelineCache",[this]{ vk_createPipelineCache(); },{dev});
+    // 管线编译最慢，放到worker上，和下面的framebuffer/command buffer等一起跑
+    Id descriptors = graph.add("createDescriptorAllocator",[this]{ vk_createDescriptorAllocator(); },{dev});
+    Id uniforms = graph.add("createUniformRing",[this]{ vk_createUniformRing(); },{memory,descriptors});
+    Id upload = graph.add("createUploadContext",[this]{ vk_createUploadContext(); },{memory});
+    // 管线布局里有纹理表的set layout
+    Id textures = graph.add("createTextures",[this]{ vk_createTextures(); },{upload});
+    Id pipeline = graph.add("createGraphicsPipeline",[this]{ vk_createGraphicePipeline(); },{rpass,cache,shaders,uniforms,textures});
+    if(!headless)graph.add("createShaderWatcher",[this]{ vk_createShaderWatcher(); },{pipeline});
+    Id fbs = graph.add("createFramebuffers",[this]{ vk_createFramebuffers(); },{rpass,views});
+    Id cpool = graph.add("createCommandPool",[this]{ vk_createCommandPool(); },{dev});
+    Id cmdbufs = graph.add("createCommandBuffers",[this]{ vk_createCommandBuffer(); },{cpool,fbs});
+    // setInstances会把static command buffer标脏，得等它们分配完；剔除在mesh之后，也跟着排在后面
+    Id mesh = graph.add("createMesh",[this]{ vk_createMesh(); },{upload,textures,cmdbufs});
+    graph.add("createStreaming",[this]{ vk_createStreaming(); },{cpool,textures});
+    graph.add("createRecordContexts",[this]{ vk_createRecordContexts(); },{dev});
+    graph.add("createProfiler",[this]{
+        profiler.init(physicalDevice,device,vkd,queueFamilies.graphicsFamily.value(),framesInFlight);
+    },{dev});
+    Id sync = graph.add("createSyncObjects",[this]{ vk_createSyncObjects(); },{swap});
+    Id readback = sync;
+    if(headless)readback = graph.add("createReadbackBuffers",[this]{ vk_createReadbackBuffers(); },{swap,sync});
+    Id culling = graph.add("createCulling",[this]{ vk_createCulling(); },{mesh,uniforms,cache,shaders});
+    graph.add("createFrameGraph",[this]{ vk_createFrameGraph(); },{fbs,readback,memory,culling});
+
+    graph.run();
+    graph.report(lg);
+}
+
+void Application::loadShaders(){
+    vertCode = read_file("data/shaders/vert.spv");
+    // 设备还没建好，不知道用哪个，两个都读
+    fragCode = read_file("data/shaders/frag.spv");
+    fragIndexedCode = read_file("data/shaders/frag_bindless.spv");
+    cullCode = read_file("data/shaders/cull.spv");
 }
 
 void Application::vk_createSyncObjects(){
@@ -29,19 +79,39 @@ void Application::vk_createSyncObjects(){
     fenc.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
     fenc.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-    if(VkResult r = vkCreateSemaphore(device,&semc,nullptr,&sem_imgAva);r != VK_SUCCESS){
-        lg(LOG_CRITI) << "Failed to create semaphores:" << (int)r << endlog;
-        std::exit(-1);
-    }
-    if(VkResult r = vkCreateSemaphore(device,&semc,nullptr,&sem_renderFin);r != VK_SUCCESS){
-        lg(LOG_CRITI) << "Failed to create semaphores:" << (int)r << endlog;
-        std::exit(-1);
+    sem_imgAva.resize(framesInFlight);
+    fen_inFlight.resize(framesInFlight);
+    for(uint32_t i = 0;i < framesInFlight;++i){
+        if(VkResult r = vkCreateSemaphore(device,&semc,nullptr,&sem_imgAva[i]);r != VK_SUCCESS){
+            lg(LOG_CRITI) << "Failed to create semaphores:" << (int)r << endlog;
+            std::exit(-1);
+        }
+        if(VkResult r = vkCreateFence(device,&fenc,nullptr,&fen_inFlight[i]);r != VK_SUCCESS){
+            lg(LOG_CRITI) << "Failed to create fences:" << (int)r << endlog;
+            std::exit(-1);
+        }
     }
-    if(VkResult r = vkCreateFence(device,&fenc,nullptr,&fen_inFlight);r != VK_SUCCESS){
-        lg(LOG_CRITI) << "Failed to create fences:" << (int)r << endlog;
-        std::exit(-1);
+
+    frameSerials.assign(framesInFlight,0);
+    inputStamps.assign(framesInFlight,-1);
+
+    vk_createPresentSemaphores();
+
+    lg(LOG_INFO) << "vkSync:OK,frames in flight:" << framesInFlight << endlog;
+}
+
+void Application::vk_createPresentSemaphores(){
+    VkSemaphoreCreateInfo semc {};
+    semc.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    sem_renderFin.resize(swapChainImages.size());
+    for(auto & sem : sem_renderFin){
+        if(VkResult r = vkCreateSemaphore(device,&semc,nullptr,&sem);r != VK_SUCCESS){
+            lg(LOG_CRITI) << "Failed to create semaphores:" << (int)r << endlog;
+            std::exit(-1);
+        }
     }
-    lg(LOG_INFO) << "vkSync:OK" << endlog;
+    fen_imagesInFlight.assign(swapChainImages.size(),VK_NULL_HANDLE);
 }
 
 void Application::vk_recordCommandBuffer(VkCommandBuffer buf,uint32_t index){
@@ -51,46 +121,104 @@ void Application::vk_recordCommandBuffer(VkCommandBuffer buf,uint32_t index){
     begInfo.flags = 0;
     begInfo.pInheritanceInfo = nullptr;
 
-    if((r = vkBeginCommandBuffer(buf,&begInfo)) != VK_SUCCESS){
+    if((r = vkd.vkBeginCommandBuffer(buf,&begInfo)) != VK_SUCCESS){
         lg(LOG_ERROR) << "Failed to begin command buffer:" << (int)r << endlog;
         return;
     }
-    VkRenderPassBeginInfo renderInfo {};
-    renderInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    renderInfo.renderPass = renderPass;
-    renderInfo.framebuffer = swapChainFramebuffers[index];
-    renderInfo.renderArea.offset = {0,0};
-    renderInfo.renderArea.extent = swapChainExtent;
-    
-    VkClearValue clearColor = {{{0,0,0,1}}};
-    renderInfo.clearValueCount = 1;
-    renderInfo.pClearValues = &clearColor;
-
-    vkCmdBeginRenderPass(buf,&renderInfo,VK_SUBPASS_CONTENTS_INLINE);
-    vkCmdBindPipeline(buf,VK_PIPELINE_BIND_POINT_GRAPHICS,graphicsPipeline);
-    vkCmdSetViewport(buf,0,1,&viewport);
-    vkCmdSetScissor(buf,0,1,&scissor);
-
-    vkCmdDraw(buf,3,1,0,0);
-    vkCmdEndRenderPass(buf);
-
-    if((r = vkEndCommandBuffer(buf)) != VK_SUCCESS){
+    // 图像每帧绑定一次，屏障都是编译时算好的
+    frameGraph.bindImage(rgBackbuffer,swapChainImages[index]);
+    if(headless)frameGraph.bindBuffer(rgReadback,readbackBuffers[index]);
+    frameGraph.bindBuffer(rgInstances,instanceBuffer.buffer);
+    frameGraph.bindBuffer(rgVisible,visibleBuffer.buffer);
+    frameGraph.bindBuffer(rgCullDraw,cullDrawBuffer.buffer);
+    frameGraph.bindBuffer(rgCullStats,cullStatsBuffer.buffer);
+    graphImage = index;
+
+    profiler.gpuFrameBegin(buf,currentFrame);
+    frameGraph.execute(buf);
+
+    if((r = vkd.vkEndCommandBuffer(buf)) != VK_SUCCESS){
         lg(LOG_ERROR) << "Failed to begin command buffer:" << (int)r << endlog;
         return;
     }
 }
 
+void Application::recordDraws(VkCommandBuffer buf,uint32_t first,uint32_t count,uint32_t thread){
+    vkd.vkCmdBindPipeline(buf,VK_PIPELINE_BIND_POINT_GRAPHICS,graphicsPipeline);
+    vkd.vkCmdSetViewport(buf,0,1,&viewport);
+    vkd.vkCmdSetScissor(buf,0,1,&scissor);
+    VkDescriptorSet sets[] = {frameUniformSet(thread),bindless.set()};
+    vkd.vkCmdBindDescriptorSets(buf,VK_PIPELINE_BIND_POINT_GRAPHICS,pipelineLayout,0,2,sets,1,&frameUniformOffset);
+    // 没有描述符索引时一次draw只能用一张纹理，由push constant给
+    uint32_t material = textures.empty() ? defaultTexture.slot : textures.front().slot;
+    if(!bindless.indexed())vkd.vkCmdPushConstants(buf,pipelineLayout,VK_SHADER_STAGE_FRAGMENT_BIT,0,sizeof(material),&material);
+
+    // 剔除后的实例由cull pass紧凑地写在visibleBuffer里
+    VkBuffer vertexBuffers[] = {mesh.vertices.buffer,drawPath == DrawPath::Culled ? visibleBuffer.buffer : instanceBuffer.buffer};
+    VkDeviceSize offsets[] = {0,0};
+    vkd.vkCmdBindVertexBuffers(buf,0,2,vertexBuffers,offsets);
+    vkd.vkCmdBindIndexBuffer(buf,mesh.indices.buffer,0,VK_INDEX_TYPE_UINT32);
+    switch(drawPath){
+    case DrawPath::PerObject:
+        for(uint32_t i = first;i < first + count;++i){
+            // 退化模式下换材质就得打断合批，每个物体推一次自己的纹理
+            if(!bindless.indexed() && !textures.empty()){
+                material = textures[i % textures.size()].slot;
+                vkd.vkCmdPushConstants(buf,pipelineLayout,VK_SHADER_STAGE_FRAGMENT_BIT,0,sizeof(material),&material);
+            }
+            vkd.vkCmdDrawIndexed(buf,mesh.indexCount,1,0,0,i);
+        }
+        break;
+    case DrawPath::Instanced:
+        if(count)vkd.vkCmdDrawIndexed(buf,mesh.indexCount,count,0,0,first);
+        break;
+    case DrawPath::Indirect:
+        // 只有一条间接命令，交给拿到第一个实例的那一段
+        if(!first)vkd.vkCmdDrawIndexedIndirect(buf,indirectBuffer.buffer,0,1,sizeof(VkDrawIndexedIndirectCommand));
+        break;
+    case DrawPath::Culled:
+        if(!first)vkd.vkCmdDrawIndexedIndirect(buf,cullDrawBuffer.buffer,0,1,sizeof(VkDrawIndexedIndirectCommand));
+        break;
+    }
+}
+
 void Application::vk_createCommandBuffer(){
     VkCommandBufferAllocateInfo alloc {};
     alloc.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    alloc.commandBufferCount = 1;
+    alloc.commandBufferCount = framesInFlight;
     alloc.commandPool = pool;
     alloc.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
 
-    if(VkResult r = vkAllocateCommandBuffers(device,&alloc,&commandBuffer);r != VK_SUCCESS){
+    commandBuffers.resize(framesInFlight);
+    acquireCommandBuffers.resize(framesInFlight);
+    if(VkResult r = vkAllocateCommandBuffers(device,&alloc,commandBuffers.data());r != VK_SUCCESS){
+        lg(LOG_CRITI) << "Failed to create command buffers:" << (int)r << endlog;
+        std::exit(-1);
+    }
+    if(VkResult r = vkAllocateCommandBuffers(device,&alloc,acquireCommandBuffers.data());r != VK_SUCCESS){
         lg(LOG_CRITI) << "Failed to create command buffers:" << (int)r << endlog;
         std::exit(-1);
     }
+
+    if(staticRecording){
+        vk_allocateStaticCommandBuffers();
+        lg(LOG_INFO) << "vkCommandBuffer:static recording enabled" << endlog;
+    }
+}
+
+void Application::vk_allocateStaticCommandBuffers(){
+    VkCommandBufferAllocateInfo alloc {};
+    alloc.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc.commandBufferCount = swapChainFramebuffers.size() * framesInFlight;
+    alloc.commandPool = pool;
+    alloc.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+    staticCommandBuffers.resize(alloc.commandBufferCount);
+    if(VkResult r = vkAllocateCommandBuffers(device,&alloc,staticCommandBuffers.data());r != VK_SUCCESS){
+        lg(LOG_CRITI) << "Failed to create static command buffers:" << (int)r << endlog;
+        std::exit(-1);
+    }
+    invalidateRecording();
 }
 
 void Application::vk_createCommandPool(){
@@ -142,8 +270,9 @@ void Application::vk_createRenderPass(){
     colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    // 进出render pass的布局转换交给frame graph
+    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
     VkAttachmentReference colorAttachmentRef {};
     colorAttachmentRef.attachment = 0;
@@ -154,22 +283,12 @@ void Application::vk_createRenderPass(){
     subpass.colorAttachmentCount = 1;
     subpass.pColorAttachments = &colorAttachmentRef;
 
-    VkSubpassDependency dep {};
-    dep.srcSubpass = VK_SUBPASS_EXTERNAL;
-    dep.dstSubpass = 0;
-    dep.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dep.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dep.srcAccessMask = 0;
-    dep.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
     VkRenderPassCreateInfo renderPassInfo {};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
     renderPassInfo.attachmentCount = 1;
     renderPassInfo.pAttachments = &colorAttachment;
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dep;
 
 
     if(VkResult r = vkCreateRenderPass(device,&renderPassInfo,nullptr,&renderPass);r != VK_SUCCESS){
@@ -178,63 +297,73 @@ void Application::vk_createRenderPass(){
     }else lg(LOG_INFO) << "vkRenderPass:OK" << endlog;
 }
 
-static std::vector<char> readFile(std::string_view fp){
-    std::ifstream ifs(std::string(fp),std::ios::ate | std::ios::binary);
-    if(!ifs.is_open()){
-        return {};
+void Application::vk_createPipelineCache(){
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physicalDevice,&props);
+
+    std::vector<char> data = read_file(app_pipeline_cache_path);
+    if(!data.empty() && !check_pipeline_cache_header(data,props)){
+        // 换了显卡/驱动或者文件坏了，当作没有缓存
+        lg(LOG_WARN) << "Pipeline cache " << app_pipeline_cache_path << " is stale or corrupt,ignored" << endlog;
+        data.clear();
+    }
+
+    VkPipelineCacheCreateInfo info {};
+    info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    info.initialDataSize = data.size();
+    info.pInitialData = data.empty() ? nullptr : data.data();
+
+    VkResult r = vkCreatePipelineCache(device,&info,nullptr,&pipelineCache);
+    if(r != VK_SUCCESS && !data.empty()){
+        lg(LOG_WARN) << "Driver rejected pipeline cache data:" << (int)r << ",starting cold" << endlog;
+        data.clear();
+        info.initialDataSize = 0;
+        info.pInitialData = nullptr;
+        r = vkCreatePipelineCache(device,&info,nullptr,&pipelineCache);
     }
-    size_t fsize = ifs.tellg();
-    std::vector<char> buf (fsize,0);
-    ifs.seekg(0);
-    ifs.read(buf.data(),fsize);
-    ifs.close();
-    return buf;
+    if(r != VK_SUCCESS){
+        lg(LOG_ERROR) << "Failed to create pipeline cache:" << (int)r << endlog;
+        pipelineCache = VK_NULL_HANDLE;
+        return;
+    }
+    pipelineCacheWarm = !data.empty();
+    lg(LOG_INFO) << "vkPipelineCache:OK," << data.size() << " bytes loaded" << endlog;
+}
+
+void Application::vk_savePipelineCache(){
+    if(!pipelineCache)return;
+    size_t size = 0;
+    if(vkGetPipelineCacheData(device,pipelineCache,&size,nullptr) != VK_SUCCESS || !size)return;
+    std::vector<char> data (size);
+    if(vkGetPipelineCacheData(device,pipelineCache,&size,data.data()) != VK_SUCCESS)return;
+
+    // 先写临时文件再改名，中途崩溃也不会留下半个缓存
+    std::string tmp = std::string(app_pipeline_cache_path) + ".tmp";
+    {
+        std::ofstream ofs(tmp,std::ios::binary | std::ios::trunc);
+        if(!ofs.is_open()){
+            lg(LOG_WARN) << "Failed to write pipeline cache " << tmp << endlog;
+            return;
+        }
+        ofs.write(data.data(),size);
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp,app_pipeline_cache_path,ec);
+    if(ec)lg(LOG_WARN) << "Failed to save pipeline cache:" << ec.message() << endlog;
+    else lg(LOG_INFO) << "Pipeline cache saved," << size << " bytes" << endlog;
 }
 
 void Application::vk_createGraphicePipeline(){
-    VkShaderModule vert = create_shader_module(device,readFile("data/shaders/vert.spv"));
-    VkShaderModule frag = create_shader_module(device,readFile("data/shaders/frag.spv"));
+    // 模块一直留着，PipelineKey里存的是句柄
+    vertModule = create_shader_module(device,vertCode);
+    fragModule = create_shader_module(device,bindless.indexed() ? fragIndexedCode : fragCode);
 
-    if(!frag || !vert){
+    if(!fragModule || !vertModule){
         lg(LOG_CRITI) << "Failed to create vertex or fragment shaders!" << endlog;
         std::exit(-1);
     }
     lg(LOG_INFO) << "vkShaderModule:OK" << endlog;
 
-    // 我服了，这我都能踩到雷。。。
-    VkPipelineShaderStageCreateInfo infos[2] = {{},{}};
-    infos[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    infos[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
-    infos[0].module = vert;
-    infos[0].pName = "main";
-
-    infos[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    infos[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    infos[1].module = frag;
-    infos[1].pName = "main";
-
-    std::vector<VkDynamicState> dynamicStatse = {
-        VK_DYNAMIC_STATE_VIEWPORT,
-        VK_DYNAMIC_STATE_SCISSOR
-    };
-
-    VkPipelineDynamicStateCreateInfo dinfo {};
-    dinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-    dinfo.dynamicStateCount = dynamicStatse.size();
-    dinfo.pDynamicStates = dynamicStatse.data();
-
-    VkPipelineVertexInputStateCreateInfo vin {};
-    vin.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vin.vertexBindingDescriptionCount = 0;
-    vin.pVertexBindingDescriptions = nullptr;
-    vin.vertexAttributeDescriptionCount = 0;
-    vin.pVertexAttributeDescriptions = nullptr;
-
-    VkPipelineInputAssemblyStateCreateInfo assem {};
-    assem.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    assem.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-    assem.primitiveRestartEnable = VK_FALSE;
-
     viewport.x = 0.f;
     viewport.y = 0.f;
     viewport.width = swapChainExtent.width;
@@ -245,114 +374,48 @@ void Application::vk_createGraphicePipeline(){
     scissor.offset = {0,0};
     scissor.extent = swapChainExtent;
 
-    VkPipelineViewportStateCreateInfo vps {};
-    vps.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-    vps.viewportCount = 1;
-    vps.pViewports = &viewport;
-    vps.scissorCount = 1;
-    vps.pScissors = &scissor;
-
-    VkPipelineRasterizationStateCreateInfo raster {};
-    raster.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-    raster.depthClampEnable = VK_FALSE;
-    raster.rasterizerDiscardEnable = VK_FALSE;
-    raster.polygonMode = VK_POLYGON_MODE_FILL;
-    raster.lineWidth = 1.0f;
-    raster.cullMode = VK_CULL_MODE_BACK_BIT;
-    raster.frontFace = VK_FRONT_FACE_CLOCKWISE;
-    raster.depthBiasEnable = VK_FALSE;
-    raster.depthBiasClamp = 0.0f;
-    raster.depthBiasConstantFactor = 0.f;
-    raster.depthBiasSlopeFactor = 0.f;
-
-    VkPipelineMultisampleStateCreateInfo msamp {};
-    msamp.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-    msamp.sampleShadingEnable = VK_FALSE;
-    msamp.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-    msamp.minSampleShading = 1.0f;
-    msamp.pSampleMask = nullptr;
-    msamp.alphaToCoverageEnable = VK_FALSE;
-    msamp.alphaToOneEnable = VK_FALSE;
-
-    VkPipelineColorBlendAttachmentState cblend {};
-    cblend.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
-                            VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    cblend.blendEnable = VK_FALSE;
-    cblend.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-    cblend.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
-    cblend.colorBlendOp = VK_BLEND_OP_ADD;
-    cblend.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-    cblend.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-    cblend.alphaBlendOp = VK_BLEND_OP_ADD;
-
-    VkPipelineColorBlendStateCreateInfo scblend {};
-    scblend.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-    scblend.logicOpEnable = VK_FALSE;
-    scblend.logicOp = VK_LOGIC_OP_COPY;
-    scblend.attachmentCount = 1;
-    scblend.pAttachments = &cblend;
-
     VkPipelineLayoutCreateInfo pipeInfo {};
     pipeInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipeInfo.setLayoutCount = 0;
-    pipeInfo.pSetLayouts = nullptr;
-    pipeInfo.pushConstantRangeCount = 0;
-    pipeInfo.pPushConstantRanges = nullptr;
+    VkDescriptorSetLayout setLayouts[] = {uniformSetLayout,bindless.layout()};
+    VkPushConstantRange push {};
+    push.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    push.offset = 0;
+    push.size = sizeof(uint32_t);
+    pipeInfo.setLayoutCount = 2;
+    pipeInfo.pSetLayouts = setLayouts;
+    pipeInfo.pushConstantRangeCount = 1;
+    pipeInfo.pPushConstantRanges = &push;
     if(VkResult r = vkCreatePipelineLayout(device,&pipeInfo,nullptr,&pipelineLayout);r != VK_SUCCESS){
         lg(LOG_CRITI) << "Failed to create pipeline layout:" << (int)r << endlog;
         std::exit(-1);
     }else lg(LOG_INFO) << "vkPipelineLayout:OK" << endlog;
 
-    VkGraphicsPipelineCreateInfo gpipe {};
-    gpipe.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    gpipe.stageCount = 2;
-    gpipe.pStages = infos;
-    gpipe.pVertexInputState = &vin;
-    gpipe.pInputAssemblyState = &assem;
-    gpipe.pViewportState = &vps;
-    gpipe.pRasterizationState = &raster;
-    gpipe.pMultisampleState = &msamp;
-    gpipe.pDepthStencilState = nullptr;
-    gpipe.pColorBlendState = &scblend;
-    gpipe.pDynamicState = &dinfo;
-    gpipe.layout = pipelineLayout;
-    gpipe.renderPass = renderPass;
-    gpipe.subpass = 0;
-    gpipe.basePipelineHandle = VK_NULL_HANDLE;
-    gpipe.basePipelineIndex = -1;
-    
-    if(VkResult r = vkCreateGraphicsPipelines(device,VK_NULL_HANDLE,1,&gpipe,nullptr,&graphicsPipeline);
-        r != VK_SUCCESS){
-        lg(LOG_CRITI) << "Failed to create pipeline:" << (int)r << endlog;
-    }else lg(LOG_INFO) << "vkPipeline:OK" << endlog;
-
-    vkDestroyShaderModule(device,vert,nullptr);
-    vkDestroyShaderModule(device,frag,nullptr);
+    VkVertexInputBindingDescription bindings[] = {Vertex::binding(),Instance::binding()};
+    std::vector<VkVertexInputAttributeDescription> attributes;
+    for(auto & a : Vertex::attributes())attributes.push_back(a);
+    for(auto & a : Instance::attributes())attributes.push_back(a);
+
+    pipelineKey.vert = vertModule;
+    pipelineKey.frag = fragModule;
+    pipelineKey.layout = pipelineLayout;
+    pipelineKey.renderPass = renderPass;
+    pipelineKey.setVertexInput(bindings,attributes);
+
+    pipelines.init(device,pipelineCache);
+    Clock clk;
+    graphicsPipeline = pipelines.get(pipelineKey,frameSerial + 1);
+    if(!graphicsPipeline){
+        lg(LOG_CRITI) << "Failed to create pipeline!" << endlog;
+    }else lg(LOG_INFO) << "vkPipeline:OK," << (pipelineCacheWarm ? "warm" : "cold") << " cache,"
+                       << clk.getAllTime() << "ms" << endlog;
 }
 
 void Application::vk_createImageViews(){
     swapChainImageViews.resize(swapChainImages.size());
     for(size_t i = 0;i < swapChainImages.size();++i){
-        VkImageViewCreateInfo createInfo {};
-        createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-        createInfo.image = swapChainImages[i];
-        createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-        createInfo.format = swapChainImageFormat;
-        createInfo.components = {
-            VK_COMPONENT_SWIZZLE_IDENTITY,
-            VK_COMPONENT_SWIZZLE_IDENTITY,
-            VK_COMPONENT_SWIZZLE_IDENTITY,
-            VK_COMPONENT_SWIZZLE_IDENTITY
-        };
-        createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        createInfo.subresourceRange.baseMipLevel = 0;
-        createInfo.subresourceRange.levelCount = 1;
-        createInfo.subresourceRange.baseArrayLayer = 0;
-        createInfo.subresourceRange.layerCount = 1;
-
-        if(VkResult r = vkCreateImageView(device,&createInfo,nullptr,&swapChainImageViews[i]);
-            r != VK_SUCCESS){
-            lg(LOG_CRITI) << "Failed to create image view for index " << i << ":" << (int)r << endlog; 
+        swapChainImageViews[i] = create_image_view(device,swapChainImages[i],swapChainImageFormat);
+        if(!swapChainImageViews[i]){
+            lg(LOG_CRITI) << "Failed to create image view for index " << i << endlog;
             std::exit(-1);
         }
     }
@@ -362,13 +425,10 @@ void Application::vk_createImageViews(){
 void Application::vk_createSwapChain(){
     SwapChainsSupportDetails det = get_swapchains_support_detail(physicalDevice,surface);
     auto fmt = choose_surface_format(det.formats);
-    auto mode = choose_swapchains_present_mode(det.presentModes);
+    auto mode = choose_swapchains_present_mode(det.presentModes,pacing);
     auto extent = choose_swap_extent(det.capabilities,window);
 
-    uint32_t imageCount = det.capabilities.minImageCount + 1;
-    if(det.capabilities.maxImageCount > 0 && imageCount > det.capabilities.maxImageCount){
-        imageCount = det.capabilities.maxImageCount;
-    }
+    uint32_t imageCount = choose_swapchain_image_count(det.capabilities,pacing);
 
     VkSwapchainCreateInfoKHR createInfo {};
     createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
@@ -397,12 +457,13 @@ void Application::vk_createSwapChain(){
     createInfo.presentMode = mode;
     createInfo.clipped = VK_TRUE;
 
-    createInfo.oldSwapchain = VK_NULL_HANDLE;
+    // 重建时把旧的交给驱动，方便它回收图像
+    createInfo.oldSwapchain = swapChain;
 
     if(VkResult result = vkCreateSwapchainKHR(device,&createInfo,nullptr,&swapChain);result != VK_SUCCESS){
         lg(LOG_CRITI) << "Failed to create Vulkan swapchains:" << (int)result << endlog;
         std::exit(-1);
-    }else lg(LOG_INFO) << "vkSwapChain:OK" << endlog;
+    }
 
     vkGetSwapchainImagesKHR(device,swapChain,&imageCount,nullptr);
     swapChainImages.resize(imageCount);
@@ -410,6 +471,8 @@ void Application::vk_createSwapChain(){
 
     swapChainImageFormat = fmt.format;
     swapChainExtent = extent;
+    lg(LOG_INFO) << "vkSwapChain:OK," << frame_pacing_name(pacing) << ",present mode " << (int)mode << ","
+                 << imageCount << " images" << endlog;
 }
 
 void Application::vk_createSurface(){
@@ -427,16 +490,35 @@ void Application::vk_createLogicalDevice(){
         std::exit(-1);
     }
 
+    // 每个角色尽量拿一个自己的队列，族里的队列不够了就和前一个角色共用
+    std::map<uint32_t,uint32_t> wanted;
+    auto take = [&](uint32_t family){
+        uint32_t index = wanted[family];
+        if(index < ind.queueCounts[family]){
+            wanted[family] = index + 1;
+            return index;
+        }
+        return index - 1;
+    };
+    uint32_t graphicsIndex = take(*ind.graphicsFamily);
+    uint32_t presentIndex = ind.presentFamily == ind.graphicsFamily ? graphicsIndex : take(*ind.presentFamily);
+    uint32_t transferIndex = take(*ind.transferFamily);
+    uint32_t computeIndex = take(*ind.computeFamily);
+
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos {};
     VkPhysicalDeviceFeatures deviceFeatures {};
-    float queuePriority = 1;
+    VkPhysicalDeviceFeatures supported;
+    vkGetPhysicalDeviceFeatures(physicalDevice,&supported);
+    // 固定纹理数组用push constant下标
+    deviceFeatures.shaderSampledImageArrayDynamicIndexing = supported.shaderSampledImageArrayDynamicIndexing;
+    std::vector<float> queuePriorities (4,1.0f);
 
-    for(auto family : ind.gen()){
+    for(auto [family,count] : wanted){
         VkDeviceQueueCreateInfo queueCreateInfo {};
         queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
         queueCreateInfo.queueFamilyIndex = family;
-        queueCreateInfo.queueCount = 1;
-        queueCreateInfo.pQueuePriorities = &queuePriority;
+        queueCreateInfo.queueCount = count;
+        queueCreateInfo.pQueuePriorities = queuePriorities.data();
 
         queueCreateInfos.push_back(queueCreateInfo);
     }
@@ -446,8 +528,19 @@ void Application::vk_createLogicalDevice(){
     createInfo.pQueueCreateInfos = queueCreateInfos.data();
     createInfo.queueCreateInfoCount = queueCreateInfos.size();
     createInfo.pEnabledFeatures = &deviceFeatures;
-    createInfo.enabledExtensionCount = app_device_extensions.size();
-    createInfo.ppEnabledExtensionNames = app_device_extensions.data();
+    // 离屏渲染用不到swapchain
+    std::vector<const char*> extensions;
+    if(!headless)extensions = app_device_extensions;
+    // 支持描述符索引就开，纹理表用运行时大小的数组，不支持就退回固定数组
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures = BindlessTextures::features();
+    bindlessLimit = 0;
+    if(useBindless && BindlessTextures::query(vkd,physicalDevice,bindlessLimit)){
+        auto exts = BindlessTextures::extensions();
+        extensions.insert(extensions.end(),exts.begin(),exts.end());
+        createInfo.pNext = &indexingFeatures;
+    }else bindlessLimit = 0;
+    createInfo.enabledExtensionCount = extensions.size();
+    createInfo.ppEnabledExtensionNames = extensions.data();
 
     if(app_enable_validation){
         createInfo.enabledLayerCount = app_validation_layers.size();
@@ -459,8 +552,20 @@ void Application::vk_createLogicalDevice(){
         std::exit(-1);
     }else lg(LOG_INFO) << "vkDevice:Ok" << endlog;
 
-    vkGetDeviceQueue(device,*ind.graphicsFamily,0,&graphicsQueue);
-    vkGetDeviceQueue(device,*ind.presentFamily,0,&presentQueue);
+    vkGetDeviceQueue(device,*ind.graphicsFamily,graphicsIndex,&graphicsQueue);
+    vkGetDeviceQueue(device,*ind.presentFamily,presentIndex,&presentQueue);
+    vkGetDeviceQueue(device,*ind.transferFamily,transferIndex,&transferQueue);
+    vkGetDeviceQueue(device,*ind.computeFamily,computeIndex,&computeQueue);
+    queueFamilies = ind;
+
+    // 无头模式没开swapchain扩展，那两个会是空的
+    uint32_t missing = vkd.loadDevice(device);
+    lg(LOG_INFO) << "vkDispatch:OK," << missing << " functions unavailable" << endlog;
+
+    lg(LOG_INFO) << "queues:graphics " << *ind.graphicsFamily << "/" << graphicsIndex << ",present "
+                 << *ind.presentFamily << "/" << presentIndex << ",transfer " << *ind.transferFamily << "/"
+                 << transferIndex << (ind.dedicatedTransfer() ? " (dedicated)" : "") << ",compute "
+                 << *ind.computeFamily << "/" << computeIndex << (ind.dedicatedCompute() ? " (async)" : "") << endlog;
 }
 
 void Application::vk_pickPhysicalDevice(){
@@ -489,8 +594,11 @@ void Application::vk_pickPhysicalDevice(){
         ++i;
 
         /// find queue families
-        if(!find_queue_family(dev,surface).ok() || !check_device_extension_support(dev,app_device_extensions)
-          || !get_swapchains_support_detail(dev,surface).ok()){
+        if(!find_queue_family(dev,surface).ok()){
+            continue;
+        }
+        if(!headless && (!check_device_extension_support(dev,app_device_extensions)
+          || !get_swapchains_support_detail(dev,surface).ok())){
             continue;
         }
 
@@ -518,52 +626,13 @@ void Application::vk_pickPhysicalDevice(){
 
 }
 
-static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
-    VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
-    VkDebugUtilsMessageTypeFlagsEXT messageType,
-    const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
-    void* pUserData) {
-    LogFactory & lg = *((LogFactory*)pUserData);
-    
-    int serverity;
-    switch(messageSeverity){
-    case VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT:
-        serverity = LOG_ERROR;
-        break;
-    case VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT:
-        serverity = LOG_WARN;
-        break;
-    default:
-        serverity = LOG_INFO;
-        break;
-    }
-
-    lg(serverity) << pCallbackData->pMessage << endlog;
-
-    return VK_FALSE;
-}
-
-static void populateDebugCreateInfo(VkDebugUtilsMessengerCreateInfoEXT & createInfo,LogFactory & lg_v){
-    createInfo = {};
-    createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
-    createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT | 
-                                 VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT |
-                                 VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT;
-    createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
-                             VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
-                             VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
-    createInfo.pUserData = &lg_v;
-    createInfo.pfnUserCallback = debugCallback;
-}
-
 void Application::vk_setupDebugMessenger(){
     if(!app_enable_validation)return;
     VkDebugUtilsMessengerCreateInfoEXT createInfo {};
-    populateDebugCreateInfo(createInfo,lg_v);
-
-    auto fn = (PFN_vkCreateDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance,"vkCreateDebugUtilsMessengerEXT");
+    validationLog.fill(createInfo);
 
-    if(fn != nullptr && fn(instance,&createInfo,nullptr,&debugMessenger) == VK_SUCCESS){
+    if(vkd.vkCreateDebugUtilsMessengerEXT &&
+       vkd.vkCreateDebugUtilsMessengerEXT(instance,&createInfo,nullptr,&debugMessenger) == VK_SUCCESS){
         lg(LOG_INFO) << "vkDebugUtilsMessenger:OK" << endlog;
     }else{
         lg(LOG_CRITI) << "Failed to create debug messenger!" << endlog;
@@ -571,7 +640,7 @@ void Application::vk_setupDebugMessenger(){
     }
 }
 
-void Application::vk_createInstance(){
+void Application::vk_checkValidationLayers(){
     /// check validation compatibility
     if(app_enable_validation){
         if(!check_validation_layer_support(app_validation_layers)){
@@ -581,8 +650,9 @@ void Application::vk_createInstance(){
             lg(LOG_INFO) << "vkValidationLayer:OK" << endlog;
         }
     }
+}
 
-
+void Application::vk_createInstance(){
     VkApplicationInfo appInfo {};
 
     appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
@@ -593,7 +663,7 @@ void Application::vk_createInstance(){
     appInfo.apiVersion = app_api_version;
 
     VkInstanceCreateInfo createInfo {};
-    auto ext = get_required_extensions(app_enable_validation);
+    auto ext = get_required_extensions(app_enable_validation,!headless);
     createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
     createInfo.pApplicationInfo = &appInfo;
     //// fetch GLFW extensions
@@ -607,7 +677,8 @@ void Application::vk_createInstance(){
         createInfo.enabledLayerCount = app_validation_layers.size();
         createInfo.ppEnabledLayerNames = app_validation_layers.data();
     
-        populateDebugCreateInfo(debugCreateInfo,lg_v);
+        // 实例创建和销毁时的消息也走同一个队列
+        validationLog.fill(debugCreateInfo);
         createInfo.pNext = (VkDebugUtilsMessengerCreateInfoEXT*) &debugCreateInfo;
     }else{
         createInfo.enabledLayerCount = 0;
@@ -618,19 +689,20 @@ void Application::vk_createInstance(){
         result != VK_SUCCESS){
         lg(LOG_CRITI) << "Failed to create VkInstance:" << (int)result << endlog;
     }else lg(LOG_INFO) << "vkInstance:OK" << endlog;
+    vkd.loadInstance(instance);
+}
 
+void Application::vk_listInstanceExtensions(){
     /// fetch Vulkan Extensions
-    {
-        uint32_t vk_extc;
-        vkEnumerateInstanceExtensionProperties(nullptr,&vk_extc,nullptr);
+    uint32_t vk_extc;
+    vkEnumerateInstanceExtensionProperties(nullptr,&vk_extc,nullptr);
 
-        std::vector<VkExtensionProperties> extensions (vk_extc);
-        vkEnumerateInstanceExtensionProperties(nullptr,&vk_extc,extensions.data());
+    std::vector<VkExtensionProperties> extensions (vk_extc);
+    vkEnumerateInstanceExtensionProperties(nullptr,&vk_extc,extensions.data());
 
-        lg(LOG_INFO) << "available vulkan extensions:";
-        for(auto & ext : extensions){
-            lg << ext.extensionName << " ";
-        }
-        lg << endlog;
+    lg(LOG_INFO) << "available vulkan extensions:";
+    for(auto & ext : extensions){
+        lg << ext.extensionName << " ";
     }
+    lg << endlog;
 }
\ No newline at end of file
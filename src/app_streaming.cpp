@@ -0,0 +1,269 @@
+#include "application.h"
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+
+// 同心圆环加上随编号变的颜色，每张看起来都不一样
+static bool generate_texture(uint32_t seed,DecodedImage & out){
+    const uint32_t size = app_stream_texture_size;
+    out.width = size;
+    out.height = size;
+    out.pixels.resize((size_t)size * size * 4);
+    float hue = seed * 0.61803398875f;
+    for(uint32_t y = 0;y < size;++y){
+        for(uint32_t x = 0;x < size;++x){
+            float dx = x + 0.5f - size / 2.0f;
+            float dy = y + 0.5f - size / 2.0f;
+            float ring = 0.5f + 0.5f * std::cos(std::hypot(dx,dy) * (0.1f + 0.02f * (seed % 5)));
+            uint8_t * p = &out.pixels[((size_t)y * size + x) * 4];
+            for(int c = 0;c < 3;++c){
+                float tint = 0.5f + 0.5f * std::cos(6.2831853f * (hue + c / 3.0f));
+                p[c] = (uint8_t)(255 * (0.25f + 0.75f * ring * tint));
+            }
+            p[3] = 255;
+        }
+    }
+    return true;
+}
+
+// 整条mip链先转到TRANSFER_DST，0级从staging复制，之后每级从上一级blit下来，用完的一级转成采样布局
+static void record_texture_upload(const VkDispatch & vkd,VkCommandBuffer cmd,VkImage image,const BufferSlice & src,
+                                  uint32_t width,uint32_t height,uint32_t levels){
+    VkImageMemoryBarrier barrier {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT,0,levels,0,1};
+    vkd.vkCmdPipelineBarrier(cmd,VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,VK_PIPELINE_STAGE_TRANSFER_BIT,0,
+                             0,nullptr,0,nullptr,1,&barrier);
+
+    VkBufferImageCopy region {};
+    region.bufferOffset = src.offset;
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT,0,0,1};
+    region.imageExtent = {width,height,1};
+    vkd.vkCmdCopyBufferToImage(cmd,src.buffer,image,VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,1,&region);
+
+    barrier.subresourceRange.levelCount = 1;
+    int32_t w = width,h = height;
+    for(uint32_t i = 1;i < levels;++i){
+        barrier.subresourceRange.baseMipLevel = i - 1;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        vkd.vkCmdPipelineBarrier(cmd,VK_PIPELINE_STAGE_TRANSFER_BIT,VK_PIPELINE_STAGE_TRANSFER_BIT,0,
+                                 0,nullptr,0,nullptr,1,&barrier);
+
+        VkImageBlit blit {};
+        blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT,i - 1,0,1};
+        blit.srcOffsets[1] = {w,h,1};
+        w = std::max(w / 2,1);
+        h = std::max(h / 2,1);
+        blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT,i,0,1};
+        blit.dstOffsets[1] = {w,h,1};
+        vkd.vkCmdBlitImage(cmd,image,VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,image,VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           1,&blit,VK_FILTER_LINEAR);
+
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        vkd.vkCmdPipelineBarrier(cmd,VK_PIPELINE_STAGE_TRANSFER_BIT,VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,0,
+                                 0,nullptr,0,nullptr,1,&barrier);
+    }
+
+    barrier.subresourceRange.baseMipLevel = levels - 1;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    vkd.vkCmdPipelineBarrier(cmd,VK_PIPELINE_STAGE_TRANSFER_BIT,VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,0,
+                             0,nullptr,0,nullptr,1,&barrier);
+}
+
+void Application::vk_createStreaming(){
+    if(!streamRing.init(allocator,app_stream_staging_size)){
+        lg(LOG_CRITI) << "Failed to create the streaming staging ring!" << endlog;
+        std::exit(-1);
+    }
+
+    // blit要在图形队列上做，所以流式上传跟着帧一起提交
+    VkCommandBufferAllocateInfo alloc {};
+    alloc.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc.commandBufferCount = framesInFlight;
+    alloc.commandPool = pool;
+    alloc.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    streamCommandBuffers.resize(framesInFlight);
+    if(VkResult r = vkAllocateCommandBuffers(device,&alloc,streamCommandBuffers.data());r != VK_SUCCESS){
+        lg(LOG_CRITI) << "Failed to create streaming command buffers:" << (int)r << endlog;
+        std::exit(-1);
+    }
+
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice,VK_FORMAT_R8G8B8A8_UNORM,&props);
+    VkFormatFeatureFlags blit = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+                                VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    streamMips = (props.optimalTilingFeatures & blit) == blit;
+
+    streamer.start(std::max(1u,std::thread::hardware_concurrency() / 2));
+    for(uint32_t i = 0;i < streamTextureCount;++i){
+        streamer.request("procedural " + std::to_string(i),[i](DecodedImage & out){ return generate_texture(i,out); });
+    }
+    uint32_t files = 0;
+    if(!streamDir.empty()){
+        std::error_code ec;
+        for(auto & entry : std::filesystem::directory_iterator(streamDir,ec)){
+            if(entry.path().extension() != ".ppm")continue;
+            std::string path = entry.path().string();
+            streamer.request(path,[path](DecodedImage & out){ return TextureStreamer::decode_ppm(path,out); });
+            ++files;
+        }
+        if(ec)lg(LOG_WARN) << "Failed to list " << streamDir << ":" << ec.message() << endlog;
+    }
+    lg(LOG_INFO) << "vkStreaming:OK," << (streamMips ? "GPU mips" : "no mips") << ",budget " << (streamBudget >> 10)
+                 << "KB/frame," << (streamTextureCount + files) << " textures requested" << endlog;
+}
+
+VkCommandBuffer Application::recordStreaming(){
+    PROFILE_SCOPE(profiler,"stream");
+    streamRing.release(completedSerial);
+
+    VkCommandBuffer cmd = VK_NULL_HANDLE;
+    auto begin = [&]{
+        if(cmd)return;
+        cmd = streamCommandBuffers[currentFrame];
+        vkd.vkResetCommandBuffer(cmd,0);
+        VkCommandBufferBeginInfo begInfo {};
+        begInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkd.vkBeginCommandBuffer(cmd,&begInfo);
+    };
+    VkDeviceSize bytes = 0;
+    uint64_t serial = frameSerial + 1;
+    while(DecodedImage * img = streamer.front()){
+        VkDeviceSize size = img->pixels.size();
+        // 比预算大的图也得能传，所以每帧第一张不看预算
+        if(bytes && bytes + size > streamBudget)break;
+        if(size > streamRing.capacity()){
+            lg(LOG_WARN) << "Texture " << img->name << " doesn't fit in the staging ring,dropped" << endlog;
+            streamer.pop();
+            continue;
+        }
+        // 环满了就等在途的帧还回来
+        auto slice = streamRing.allocate(size,16,serial);
+        if(!slice)break;
+        std::memcpy(slice->mapped,img->pixels.data(),size);
+
+        uint32_t levels = streamMips ? mip_level_count(img->width,img->height) : 1;
+        VkImageCreateInfo info {};
+        info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        info.imageType = VK_IMAGE_TYPE_2D;
+        info.format = VK_FORMAT_R8G8B8A8_UNORM;
+        info.extent = {img->width,img->height,1};
+        info.mipLevels = levels;
+        info.arrayLayers = 1;
+        info.samples = VK_SAMPLE_COUNT_1_BIT;
+        info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        PendingTexture pending;
+        pending.name = std::move(img->name);
+        pending.serial = serial;
+        if(!allocator.createImage(info,0,VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,pending.texture.image)){
+            lg(LOG_WARN) << "Out of memory for texture " << pending.name << ",dropped" << endlog;
+            streamer.pop();
+            continue;
+        }
+        pending.texture.view = create_image_view(device,pending.texture.image.image,info.format,levels);
+        if(!pending.texture.view){
+            lg(LOG_WARN) << "Failed to create a view of texture " << pending.name << ",dropped" << endlog;
+            allocator.destroyImage(pending.texture.image);
+            streamer.pop();
+            continue;
+        }
+
+        begin();
+        record_texture_upload(vkd,cmd,pending.texture.image.image,*slice,img->width,img->height,levels);
+        streamInFlight.push_back(std::move(pending));
+        bytes += size;
+        streamer.pop();
+    }
+
+    // 实例的纹理号在CPU副本里已经改好，这里按剩下的预算拷一段进实例缓冲，拷不完下一帧接着拷
+    uint32_t remaining = instanceData.size() - streamInstanceNext;
+    VkDeviceSize room = std::min(bytes < streamBudget ? streamBudget - bytes : 0,streamRing.capacity());
+    uint32_t n = std::min<VkDeviceSize>(remaining,room / sizeof(Instance));
+    if(!n && !bytes)n = std::min(remaining,1u);
+    auto slice = n ? streamRing.allocate(sizeof(Instance) * n,16,serial) : std::nullopt;
+    if(slice){
+        std::memcpy(slice->mapped,&instanceData[streamInstanceNext],sizeof(Instance) * n);
+        begin();
+        // 之前的帧可能还在读实例缓冲，先等它们读完再写，写完再给顶点输入和剔除用
+        VkBufferMemoryBarrier barrier {};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = instanceBuffer.buffer;
+        barrier.offset = sizeof(Instance) * streamInstanceNext;
+        barrier.size = sizeof(Instance) * n;
+        vkd.vkCmdPipelineBarrier(cmd,VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_PIPELINE_STAGE_TRANSFER_BIT,0,0,nullptr,1,&barrier,0,nullptr);
+        VkBufferCopy region {};
+        region.srcOffset = slice->offset;
+        region.dstOffset = barrier.offset;
+        region.size = barrier.size;
+        vkd.vkCmdCopyBuffer(cmd,slice->buffer,instanceBuffer.buffer,1,&region);
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+        vkd.vkCmdPipelineBarrier(cmd,VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 0,0,nullptr,1,&barrier,0,nullptr);
+        streamInstanceNext += n;
+        bytes += sizeof(Instance) * n;
+    }
+
+    if(cmd)vkd.vkEndCommandBuffer(cmd);
+    streamBytes += bytes;
+    return cmd;
+}
+
+void Application::publishStreamed(){
+    // 上传它的那一帧做完了才进纹理表，渲染不会采到没传完的图
+    std::erase_if(streamInFlight,[this](PendingTexture & p){
+        if(p.serial > completedSerial)return false;
+        p.texture.slot = bindless.add(p.texture.view);
+        if(p.texture.slot == BindlessTextures::none){
+            lg(LOG_WARN) << "Texture table is full," << p.name << " dropped" << endlog;
+            destroyTexture(p.texture);
+            return true;
+        }
+        textures.push_back(p.texture);
+        ++streamPublished;
+        ++streamUnassigned;
+        return true;
+    });
+    // 一批都到了再分给实例，不要每来一张就重传一次；只改纹理号，recordStreaming分帧拷到GPU上
+    if(streamUnassigned && streamInFlight.empty() && !streamer.depth()){
+        for(size_t i = 0;i < instanceData.size();++i)instanceData[i].texture = textures[i % textures.size()].slot;
+        streamInstanceNext = 0;
+        lg(LOG_INFO) << "streaming:" << streamUnassigned << " textures published," << bindless.used() << "/"
+                     << bindless.capacity() << " slots in use" << endlog;
+        streamUnassigned = 0;
+    }
+}
+
+void Application::cleanupStreaming(){
+    streamer.stop();
+    for(auto & p : streamInFlight)destroyTexture(p.texture);
+    streamInFlight.clear();
+    streamRing.destroy(allocator);
+}
@@ -0,0 +1,163 @@
+#include "application.h"
+#include <cstring>
+
+void Application::vk_createTextures(){
+    const uint32_t white = 0xffffffff;
+    if(!createTexture(1,1,&white,defaultTexture)){
+        lg(LOG_CRITI) << "Failed to create the default texture!" << endlog;
+        std::exit(-1);
+    }
+    if(!bindless.init(device,bindlessLimit > 0,bindlessLimit,defaultTexture.view)){
+        lg(LOG_CRITI) << "Failed to create the bindless texture table!" << endlog;
+        std::exit(-1);
+    }
+    defaultTexture.slot = bindless.add(defaultTexture.view);
+
+    // 每张是不同颜色的棋盘格，格子大小也不一样，方便看出实例用的是哪张
+    std::vector<uint32_t> pixels (app_texture_size * app_texture_size);
+    for(uint32_t t = 0;t < app_texture_count;++t){
+        uint32_t color = 0xff000000 | ((t & 1) ? 0xff : 0x40) | ((t & 2) ? 0xff00 : 0x4000) | ((t & 4) ? 0xff0000 : 0x400000);
+        uint32_t cell = 4u << (t % 3);
+        for(uint32_t y = 0;y < app_texture_size;++y){
+            for(uint32_t x = 0;x < app_texture_size;++x){
+                pixels[y * app_texture_size + x] = ((x / cell + y / cell) & 1) ? color : 0xffffffff;
+            }
+        }
+        Texture tex;
+        if(!createTexture(app_texture_size,app_texture_size,pixels.data(),tex)){
+            lg(LOG_CRITI) << "Failed to create texture " << t << endlog;
+            std::exit(-1);
+        }
+        tex.slot = bindless.add(tex.view);
+        textures.push_back(tex);
+    }
+    lg(LOG_INFO) << "vkTextures:OK," << (bindless.indexed() ? "descriptor indexing," : "fixed array,")
+                 << bindless.used() << "/" << bindless.capacity() << " slots" << endlog;
+}
+
+bool Application::createTexture(uint32_t width,uint32_t height,const void * rgba,Texture & out){
+    VkImageCreateInfo info {};
+    info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    info.imageType = VK_IMAGE_TYPE_2D;
+    info.format = VK_FORMAT_R8G8B8A8_UNORM;
+    info.extent = {width,height,1};
+    info.mipLevels = 1;
+    info.arrayLayers = 1;
+    info.samples = VK_SAMPLE_COUNT_1_BIT;
+    info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    if(!allocator.createImage(info,0,VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,out.image))return false;
+
+    if(!uploadImage(out.image,width,height,rgba,(VkDeviceSize)width * height * 4)){
+        allocator.destroyImage(out.image);
+        return false;
+    }
+
+    out.view = create_image_view(device,out.image.image,info.format);
+    if(!out.view){
+        // 上传的acquire可能还挂着
+        destroyTexture(out);
+        return false;
+    }
+    return true;
+}
+
+bool Application::uploadImage(const GpuImage & dst,uint32_t width,uint32_t height,const void * data,VkDeviceSize size){
+    std::lock_guard guard(uploadLock);
+    // 纹理不分块，一半staging放不下就不传
+    if(size > stagingBuffer.size / 2)return false;
+    vkd.vkWaitForFences(device,1,&uploadFences[0],VK_TRUE,UINT64_MAX);
+    vkd.vkResetFences(device,1,&uploadFences[0]);
+    std::memcpy(stagingBuffer.alloc.mapped,data,size);
+
+    VkCommandBuffer cmd = uploadCommandBuffers[0];
+    vkd.vkResetCommandBuffer(cmd,0);
+    VkCommandBufferBeginInfo begInfo {};
+    begInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkd.vkBeginCommandBuffer(cmd,&begInfo);
+
+    VkImageMemoryBarrier barrier {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = dst.image;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT,0,1,0,1};
+    vkd.vkCmdPipelineBarrier(cmd,VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,VK_PIPELINE_STAGE_TRANSFER_BIT,0,
+                             0,nullptr,0,nullptr,1,&barrier);
+
+    VkBufferImageCopy region {};
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT,0,0,1};
+    region.imageExtent = {width,height,1};
+    vkd.vkCmdCopyBufferToImage(cmd,stagingBuffer.buffer,dst.image,VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,1,&region);
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    if(queueFamilies.dedicatedTransfer()){
+        // 布局转换在release和acquire两边写成一样的，执行一次
+        barrier.dstAccessMask = 0;
+        barrier.srcQueueFamilyIndex = *queueFamilies.transferFamily;
+        barrier.dstQueueFamilyIndex = *queueFamilies.graphicsFamily;
+        vkd.vkCmdPipelineBarrier(cmd,VK_PIPELINE_STAGE_TRANSFER_BIT,VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,0,
+                                 0,nullptr,0,nullptr,1,&barrier);
+        VkImageMemoryBarrier acquire = barrier;
+        acquire.srcAccessMask = 0;
+        acquire.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        pendingImageAcquires.push_back(acquire);
+    }else{
+        // 传输队列就在图形族里，直接转到采样用的布局
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkd.vkCmdPipelineBarrier(cmd,VK_PIPELINE_STAGE_TRANSFER_BIT,VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,0,
+                                 0,nullptr,0,nullptr,1,&barrier);
+    }
+    vkd.vkEndCommandBuffer(cmd);
+
+    VkSubmitInfo submitInfo {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &cmd;
+    if(VkResult r = vkd.vkQueueSubmit(transferQueue,1,&submitInfo,uploadFences[0]);r != VK_SUCCESS){
+        lg(LOG_ERROR) << "Failed to submit image upload:" << (int)r << endlog;
+        return false;
+    }
+    vkd.vkWaitForFences(device,1,&uploadFences[0],VK_TRUE,UINT64_MAX);
+    return true;
+}
+
+void Application::destroyTexture(Texture & t){
+    {
+        std::lock_guard guard(uploadLock);
+        std::erase_if(pendingImageAcquires,[&](const VkImageMemoryBarrier & b){ return b.image == t.image.image; });
+    }
+    if(!t.image.image)return;
+    // 槽位要等在途的帧都不再采样它才能给别人
+    retire([this,old = t]() mutable {
+        if(old.slot != BindlessTextures::none)bindless.remove(old.slot);
+        if(old.view)vkDestroyImageView(device,old.view,nullptr);
+        allocator.destroyImage(old.image);
+    });
+    t = {};
+}
+
+void Application::refreshTextures(){
+    std::function<void()> old;
+    if(!bindless.refresh(old))return;
+    // 固定数组的set换了，录好的命令里绑的还是旧的
+    retire(std::move(old));
+    invalidateRecording();
+}
+
+void Application::cleanupTextures(){
+    for(auto & t : textures)destroyTexture(t);
+    textures.clear();
+    destroyTexture(defaultTexture);
+    deletionQueue.flush();
+    bindless.destroy();
+}
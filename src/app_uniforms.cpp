@@ -0,0 +1,109 @@
+#include "application.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <cstring>
+
+void Application::vk_createDescriptorAllocator(){
+    // 每个录制线程一条链，下标就是WorkerPool里的worker号，主线程是0；录制基准最多用到核数那么多线程
+    descriptors.init(device,framesInFlight,std::max({1u,std::thread::hardware_concurrency(),recordThreads}));
+    lg(LOG_INFO) << "vkDescriptorAllocator:OK" << endlog;
+}
+
+void Application::vk_createUniformRing(){
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physicalDevice,&props);
+    uniformAlignment = props.limits.minUniformBufferOffsetAlignment;
+
+    if(!uniformRing.init(allocator,app_uniform_frame_size,framesInFlight,VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT)){
+        lg(LOG_CRITI) << "Failed to create uniform ring buffer!" << endlog;
+        std::exit(-1);
+    }
+
+    VkDescriptorSetLayoutBinding binding {};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    binding.descriptorCount = 1;
+    binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = 1;
+    layoutInfo.pBindings = &binding;
+    uniformSetLayout = descriptors.layout(layoutInfo);
+    if(!uniformSetLayout){
+        lg(LOG_CRITI) << "Failed to create descriptor set layout!" << endlog;
+        std::exit(-1);
+    }
+
+    lg(LOG_INFO) << "vkUniformRing:OK," << (uniformRing.frameSize() >> 10) << "KB per frame,alignment "
+                 << uniformAlignment << endlog;
+}
+
+std::optional<uint32_t> Application::pushUniforms(const void * data,VkDeviceSize size){
+    auto slice = uniformRing.allocate(size,uniformAlignment);
+    if(!slice)return std::nullopt;
+    std::memcpy(slice->mapped,data,size);
+    return (uint32_t)slice->offset;
+}
+
+void Application::updateFrameUniforms(){
+    // 这个帧槽的fence已经等过了，它的那段可以重写
+    uniformRing.beginFrame(currentFrame);
+
+    // 模拟线程最新的两步之间插值，不等它
+    SimState sim = simulation.sample();
+    FrameUniforms u;
+    u.transform = glm::rotate(glm::mat4(1.0f),sim.angle,glm::vec3(0.0f,0.0f,1.0f));
+    u.time = glm::vec4((float)sim.time,0,0,0);
+
+    if(auto offset = pushUniforms(&u,sizeof(u)))frameUniformOffset = *offset;
+    else lg(LOG_ERROR) << "uniform ring is full!" << endlog;
+}
+
+void Application::updateDescriptorSets(){
+    if(!cullSetLayout)return;
+    // 内容没变查到的就是同一个set，不用重写；每帧都查一遍，缓存才知道它们还在用
+    uint64_t serial = frameSerial + 1;
+    DescriptorBinding uniform = DescriptorBinding::ofBuffer(0,VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                                                            uniformRing.buffer(),0,sizeof(FrameUniforms));
+    DescriptorBinding cull[] = {
+        DescriptorBinding::ofBuffer(0,VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,instanceBuffer.buffer),
+        DescriptorBinding::ofBuffer(1,VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,visibleBuffer.buffer),
+        DescriptorBinding::ofBuffer(2,VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,cullDrawBuffer.buffer),
+        DescriptorBinding::ofBuffer(3,VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,cullStatsBuffer.buffer)
+    };
+    VkDescriptorSet u = descriptors.get(0,uniformSetLayout,{&uniform,1},serial);
+    VkDescriptorSet c = descriptors.get(0,cullSetLayout,cull,serial);
+    if(!u || !c){
+        lg(LOG_CRITI) << "Failed to allocate descriptor sets!" << endlog;
+        std::exit(-1);
+    }
+    if(u != uniformSet || c != cullSet)invalidateRecording();
+    uniformSet = u;
+    cullSet = c;
+}
+
+VkDescriptorSet Application::frameUniformSet(uint32_t thread){
+    // 静态录制的命令会跨帧反复提交，只能绑缓存的set
+    if(staticRecording)return uniformSet;
+    // 每帧从这个线程自己的链上拿，帧槽回来时整池重置，不用一个个释放
+    VkDescriptorSet set = descriptors.allocate(currentFrame,thread,uniformSetLayout);
+    if(!set){
+        lg(LOG_ERROR) << "Failed to allocate a transient uniform set!" << endlog;
+        return uniformSet;
+    }
+    VkDescriptorBufferInfo info {uniformRing.buffer(),0,sizeof(FrameUniforms)};
+    VkWriteDescriptorSet write {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = set;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    write.pBufferInfo = &info;
+    vkUpdateDescriptorSets(device,1,&write,0,nullptr);
+    return set;
+}
+
+void Application::cleanupUniforms(){
+    lg(LOG_INFO) << "uniform ring peak:" << uniformRing.peak() << "/" << uniformRing.frameSize() << " bytes per frame" << endlog;
+    uniformRing.destroy(allocator);
+}
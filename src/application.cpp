@@ -1,40 +1,164 @@
 #include "application.h"
+#include <algorithm>
+#include <string_view>
+#include <cstdlib>
 
 void Application::setup(){
-    glfwInit();
-
     setupLogger();
-    setupWindow();
+    if(!headless)glfwInit();
+    // 窗口也在setupVulkan的启动任务图里创建
     setupVulkan();
+    simulation.start(tickRate);
+}
+
+static void framebufferResizeCallback(GLFWwindow * window,int,int){
+    auto app = (Application*)glfwGetWindowUserPointer(window);
+    app->framebufferResized = true;
+}
+
+void Application::parseArguments(int argc,char ** argv){
+    for(int i = 1;i < argc;++i){
+        std::string_view arg = argv[i];
+        if(arg == "--frames-in-flight" && i + 1 < argc){
+            framesInFlight = (uint32_t)std::clamp(std::atoi(argv[++i]),1,(int)app_max_frames_in_flight);
+        }else if(arg == "--static-recording"){
+            staticRecording = true;
+        }else if(arg == "--headless"){
+            headless = true;
+        }else if(arg == "--headless-frames" && i + 1 < argc){
+            headlessFrames = std::max<uint64_t>(1,std::strtoull(argv[++i],nullptr,10));
+        }else if(arg == "--dump" && i + 1 < argc){
+            dumpDir = argv[++i];
+        }else if(arg == "--dump-every" && i + 1 < argc){
+            dumpEvery = std::strtoull(argv[++i],nullptr,10);
+        }else if(arg == "--bench-upload"){
+            benchUpload = true;
+        }else if(arg == "--instances" && i + 1 < argc){
+            instanceCount = std::max<uint32_t>(1,std::strtoul(argv[++i],nullptr,10));
+        }else if(arg == "--draw-path" && i + 1 < argc){
+            std::string_view path = argv[++i];
+            if(path == "per-object")drawPath = DrawPath::PerObject;
+            else if(path == "indirect")drawPath = DrawPath::Indirect;
+            else if(path == "culled")drawPath = DrawPath::Culled;
+            else drawPath = DrawPath::Instanced;
+        }else if(arg == "--bench-draw"){
+            benchDraw = true;
+        }else if(arg == "--record-threads" && i + 1 < argc){
+            recordThreads = std::strtoul(argv[++i],nullptr,10);
+        }else if(arg == "--bench-record"){
+            benchRecord = true;
+        }else if(arg == "--bench-dispatch"){
+            benchDispatch = true;
+        }else if(arg == "--bench-cull"){
+            // GPU时间来自profiler
+            benchCull = true;
+            profiler.enabled = true;
+        }else if(arg == "--profile" && i + 1 < argc){
+            profiler.enabled = true;
+            profiler.tracePath = argv[++i];
+        }else if(arg == "--pacing" && i + 1 < argc){
+            std::string_view mode = argv[++i];
+            if(mode == "low-latency")pacing = FramePacing::LowLatency;
+            else if(mode == "capped")pacing = FramePacing::Capped;
+            else pacing = FramePacing::Throughput;
+        }else if(arg == "--fps-cap" && i + 1 < argc){
+            pacing = FramePacing::Capped;
+            fpsCap = std::clamp((float)std::atof(argv[++i]),1.0f,1000.0f);
+        }else if(arg == "--validation-severity" && i + 1 < argc){
+            validationLog.severities = ValidationLog::parse_severity(argv[++i]);
+        }else if(arg == "--validation-types" && i + 1 < argc){
+            if(auto types = ValidationLog::parse_types(argv[++i]))validationLog.types = types;
+        }else if(arg == "--validation-summary" && i + 1 < argc){
+            validationLog.summaryInterval = std::max(100.0,std::atof(argv[++i]) * 1000);
+        }else if(arg == "--tick-rate" && i + 1 < argc){
+            tickRate = std::clamp(std::atof(argv[++i]),1.0,10000.0);
+        }else if(arg == "--dump-graph" && i + 1 < argc){
+            graphDumpPath = argv[++i];
+        }else if(arg == "--no-bindless"){
+            useBindless = false;
+        }else if(arg == "--stream-textures" && i + 1 < argc){
+            streamTextureCount = std::strtoul(argv[++i],nullptr,10);
+        }else if(arg == "--stream-dir" && i + 1 < argc){
+            streamDir = argv[++i];
+        }else if(arg == "--stream-budget" && i + 1 < argc){
+            streamBudget = std::max<VkDeviceSize>(1,std::strtoull(argv[++i],nullptr,10)) << 10;
+        }
+    }
 }
 
 void Application::drawFrame(){
-    vkWaitForFences(device,1,&fen_inFlight,VK_TRUE,UINT64_MAX);
-    vkResetFences(device,1,&fen_inFlight);
+    PROFILE_SCOPE(profiler,"frame");
+    {
+        PROFILE_SCOPE(profiler,"waitFence");
+        vkd.vkWaitForFences(device,1,&fen_inFlight[currentFrame],VK_TRUE,UINT64_MAX);
+    }
+    profiler.collect(currentFrame);
+    pollLatency();
+    // 同一个队列按顺序执行，这一帧完成意味着之前的帧都完成了
+    completedSerial = std::max(completedSerial,frameSerials[currentFrame]);
+    deletionQueue.flush(completedSerial);
 
     uint32_t imgIndex;
-    vkAcquireNextImageKHR(device,swapChain,UINT64_MAX,sem_imgAva,VK_NULL_HANDLE,&imgIndex);
+    VkResult acq;
+    {
+        PROFILE_SCOPE(profiler,"acquire");
+        acq = vkd.vkAcquireNextImageKHR(device,swapChain,UINT64_MAX,sem_imgAva[currentFrame],VK_NULL_HANDLE,&imgIndex);
+    }
+    if(acq == VK_ERROR_OUT_OF_DATE_KHR){
+        // fence还没有reset，直接跳过这一帧即可
+        recreateSwapChain();
+        return;
+    }else if(acq != VK_SUCCESS && acq != VK_SUBOPTIMAL_KHR){
+        lg(LOG_ERROR) << "Failed to acquire swapchain image:" << (int)acq << endlog;
+        return;
+    }
 
-    vkResetCommandBuffer(commandBuffer,0);
-    vk_recordCommandBuffer(commandBuffer,imgIndex);
+    // 这张图片可能还被之前的某一帧占用着(图片数量与帧数不一定相等)
+    if(fen_imagesInFlight[imgIndex] != VK_NULL_HANDLE){
+        vkd.vkWaitForFences(device,1,&fen_imagesInFlight[imgIndex],VK_TRUE,UINT64_MAX);
+    }
+    fen_imagesInFlight[imgIndex] = fen_inFlight[currentFrame];
+
+    vkd.vkResetFences(device,1,&fen_inFlight[currentFrame]);
+
+    refreshPipelines();
+    // 先把传完的纹理放进表里，没有descriptor indexing时这一帧的set就能带上它们
+    publishStreamed();
+    refreshTextures();
+    descriptors.beginFrame(currentFrame,frameSerial + 1,completedSerial);
+    updateDescriptorSets();
+    updateFrameUniforms();
+    collectCullStats(currentFrame);
+    VkCommandBuffer acquire = recordAcquires();
+    VkCommandBuffer stream = recordStreaming();
+    VkCommandBuffer commandBuffer = prepareCommandBuffer(imgIndex);
 
     VkSubmitInfo submitInfo {};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-    VkSemaphore waitSemaphores[] = { sem_imgAva };
-    VkSemaphore signalSemaphores[] = { sem_renderFin };
+    VkSemaphore waitSemaphores[] = { sem_imgAva[currentFrame] };
+    VkSemaphore signalSemaphores[] = { sem_renderFin[imgIndex] };
     VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
     submitInfo.waitSemaphoreCount = 1;
     submitInfo.pWaitSemaphores = waitSemaphores;
     submitInfo.pWaitDstStageMask = waitStages;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
+    // 有刚上传完的缓冲的话，先在图形队列上把所有权拿过来，流式上传的纹理也排在帧前面
+    VkCommandBuffer submitBuffers[3];
+    uint32_t submitCount = 0;
+    if(acquire)submitBuffers[submitCount++] = acquire;
+    if(stream)submitBuffers[submitCount++] = stream;
+    submitBuffers[submitCount++] = commandBuffer;
+    submitInfo.commandBufferCount = submitCount;
+    submitInfo.pCommandBuffers = submitBuffers;
     submitInfo.signalSemaphoreCount = 1;
     submitInfo.pSignalSemaphores = signalSemaphores;
 
-    if(VkResult r = vkQueueSubmit(graphicsQueue,1,&submitInfo,fen_inFlight);r != VK_SUCCESS){
+    if(VkResult r = vkd.vkQueueSubmit(graphicsQueue,1,&submitInfo,fen_inFlight[currentFrame]);r != VK_SUCCESS){
         lg(LOG_ERROR) << "Failed to submit this frame:" << (int)r << endlog;
     }
+    profiler.frameSubmitted(currentFrame);
+    frameSerials[currentFrame] = ++frameSerial;
+    inputStamps[currentFrame] = inputStamp;
 
     VkSwapchainKHR swapChains[] = {swapChain};
     VkPresentInfoKHR presentInfo {};
@@ -46,36 +170,170 @@ void Application::drawFrame(){
     presentInfo.pImageIndices = &imgIndex;
     presentInfo.pResults = nullptr;
 
-    vkQueuePresentKHR(presentQueue,&presentInfo);
+    VkResult pre;
+    {
+        PROFILE_SCOPE(profiler,"present");
+        pre = vkd.vkQueuePresentKHR(presentQueue,&presentInfo);
+    }
+
+    currentFrame = (currentFrame + 1) % framesInFlight;
+
+    if(pre == VK_ERROR_OUT_OF_DATE_KHR || pre == VK_SUBOPTIMAL_KHR || acq == VK_SUBOPTIMAL_KHR || framebufferResized){
+        framebufferResized = false;
+        recreateSwapChain();
+    }else if(pre != VK_SUCCESS){
+        lg(LOG_ERROR) << "Failed to present swapchain image:" << (int)pre << endlog;
+    }
+}
+
+void Application::refreshPipelines(){
+    applyShaderReload();
+    // 每帧取一次，LRU里它就一直是最近用过的
+    VkPipeline pipe = pipelines.get(pipelineKey,frameSerial + 1);
+    if(pipe && pipe != graphicsPipeline){
+        graphicsPipeline = pipe;
+        invalidateRecording();
+    }
+    pipelines.evict(frameSerial + 1,completedSerial);
+}
+
+VkCommandBuffer Application::prepareCommandBuffer(uint32_t imgIndex){
+    VkCommandBuffer commandBuffer;
+    if(staticRecording){
+        // 调用前已经等过这张图片和这个帧槽的fence了，所以对应的buffer一定不在使用中
+        uint32_t index = staticIndex(imgIndex);
+        commandBuffer = staticCommandBuffers[index];
+        if(!staticDirty[index])return commandBuffer;
+        staticDirty[index] = false;
+        ++staticRecordCount;
+    }else{
+        commandBuffer = commandBuffers[currentFrame];
+    }
+
+    PROFILE_SCOPE(profiler,"record");
+    Clock clk;
+    vkd.vkResetCommandBuffer(commandBuffer,0);
+    vk_recordCommandBuffer(commandBuffer,imgIndex);
+    recordTime += clk.getAllTime();
+    ++recordCount;
+    return commandBuffer;
+}
+
+void Application::recreateSwapChain(){
+    int w = 0,h = 0;
+    glfwGetFramebufferSize(window,&w,&h);
+    while(w == 0 || h == 0){ // 最小化了，等窗口回来
+        glfwWaitEvents();
+        if(glfwWindowShouldClose(window))return;
+        glfwGetFramebufferSize(window,&w,&h);
+    }
+    Clock clk;
+
+    // 旧对象可能还被在途的帧引用，挂起来等它们完成再销毁，不用vkDeviceWaitIdle
+    retire([this,swap = swapChain,views = std::move(swapChainImageViews),fbs = std::move(swapChainFramebuffers),
+            sems = std::move(sem_renderFin),bufs = std::move(staticCommandBuffers)]{
+        if(!bufs.empty())vkFreeCommandBuffers(device,pool,bufs.size(),bufs.data());
+        for(auto sem : sems)vkDestroySemaphore(device,sem,nullptr);
+        for(auto fb : fbs)vkDestroyFramebuffer(device,fb,nullptr);
+        for(auto iv : views)vkDestroyImageView(device,iv,nullptr);
+        vkDestroySwapchainKHR(device,swap,nullptr);
+    });
+    swapChainImageViews.clear();
+    swapChainFramebuffers.clear();
+    sem_renderFin.clear();
+    staticCommandBuffers.clear();
+
+    vk_createSwapChain();
+    vk_createImageViews();
+    vk_createFramebuffers();
+    vk_createPresentSemaphores();
+    if(staticRecording)vk_allocateStaticCommandBuffers();
+    retire(frameGraph.release());
+    vk_createFrameGraph();
+
+    viewport.width = swapChainExtent.width;
+    viewport.height = swapChainExtent.height;
+    scissor.extent = swapChainExtent;
+
+    lg(LOG_INFO) << "swapchain rebuilt in " << clk.getAllTime() << "ms:" << swapChainExtent.width << "x"
+                 << swapChainExtent.height << "," << swapChainImages.size() << " images" << endlog;
+}
+
+void Application::waitFrames(){
+    if(!fen_inFlight.empty())vkd.vkWaitForFences(device,fen_inFlight.size(),fen_inFlight.data(),VK_TRUE,UINT64_MAX);
+    completedSerial = frameSerial;
+    deletionQueue.flush(completedSerial);
+}
+
+void Application::invalidateRecording(){
+    staticDirty.assign(staticCommandBuffers.size(),true);
+}
+
+void Application::setClearColor(float r,float g,float b,float a){
+    clearColor.color = {{r,g,b,a}};
+    invalidateRecording();
 }
 
 void Application::cleanup(){
-    vkDestroySemaphore(device,sem_imgAva,nullptr);
-    vkDestroySemaphore(device,sem_renderFin,nullptr);
-    vkDestroyFence(device,fen_inFlight,nullptr);
+    simulation.stop();
+    shaderWatcher.stop();
+    if(staticRecording){
+        lg(LOG_INFO) << "static command buffers were recorded " << staticRecordCount << " times" << endlog;
+    }
+    deletionQueue.flush();
+
+    for(uint32_t i = 0;i < framesInFlight;++i){
+        vkDestroySemaphore(device,sem_imgAva[i],nullptr);
+        vkDestroyFence(device,fen_inFlight[i],nullptr);
+    }
+    for(auto sem : sem_renderFin){
+        vkDestroySemaphore(device,sem,nullptr);
+    }
+    destroyRecordContexts();
     vkDestroyCommandPool(device,pool,nullptr);
     for(auto framebuffer : swapChainFramebuffers){
         vkDestroyFramebuffer(device,framebuffer,nullptr);
     }
-    vkDestroyPipeline(device,graphicsPipeline,nullptr);
+    if(pendingReload){
+        vkDestroyShaderModule(device,pendingReload->vert,nullptr);
+        vkDestroyShaderModule(device,pendingReload->frag,nullptr);
+    }
+    pipelines.report(lg);
+    pipelines.destroy();
+    descriptors.report(lg);
+    vkDestroyShaderModule(device,vertModule,nullptr);
+    vkDestroyShaderModule(device,fragModule,nullptr);
+    vk_savePipelineCache();
+    if(pipelineCache)vkDestroyPipelineCache(device,pipelineCache,nullptr);
     vkDestroyPipelineLayout(device,pipelineLayout,nullptr);
+    cleanupCulling();
+    cleanupStreaming();
+    cleanupTextures();
+    cleanupUniforms();
+    descriptors.destroy();
     vkDestroyRenderPass(device,renderPass,nullptr);
     for(auto iv : swapChainImageViews){
         vkDestroyImageView(device,iv,nullptr);
     }
-    vkDestroySwapchainKHR(device,swapChain,nullptr);
+    if(headless)cleanupHeadless();
+    else vkDestroySwapchainKHR(device,swapChain,nullptr);
+    frameGraph.release()();
+    cleanupGeometry();
+    profiler.destroy(lg);
+    deletionQueue.flush();
+    deletionQueue.report(lg);
     vkDestroyDevice(device,nullptr);
 
-    if(app_enable_validation){
-        auto func = (PFN_vkDestroyDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance,"vkDestroyDebugUtilsMessengerEXT");
-        if(func != nullptr)func(instance,debugMessenger,nullptr);
+    if(app_enable_validation && vkd.vkDestroyDebugUtilsMessengerEXT){
+        vkd.vkDestroyDebugUtilsMessengerEXT(instance,debugMessenger,nullptr);
     }
 
-    vkDestroySurfaceKHR(instance,surface,nullptr);
+    if(surface)vkDestroySurfaceKHR(instance,surface,nullptr);
     vkDestroyInstance(instance,nullptr);
+    validationLog.stop();
     // destroy window
     if(window)glfwDestroyWindow(window);
-    glfwTerminate();
+    if(!headless)glfwTerminate();
 }
 
 Application::~Application(){
@@ -93,12 +351,15 @@ void Application::setupWindow(){
 
     // no GL API
     glfwWindowHint(GLFW_CLIENT_API,GLFW_NO_API);
-    glfwWindowHint(GLFW_RESIZABLE,GLFW_FALSE);
+    glfwWindowHint(GLFW_RESIZABLE,GLFW_TRUE);
 
     // create GLFW context
     window = glfwCreateWindow(win_width,win_height,win_title,nullptr,nullptr);
+    glfwSetWindowUserPointer(window,this);
+    glfwSetFramebufferSizeCallback(window,framebufferResizeCallback);
 }
 
 void Application::setupLogger(){
     logger.appendLogOutputTarget("console",std::make_shared<lot::Console>());
+    if(app_enable_validation)validationLog.start(lg_v);
 }
\ No newline at end of file
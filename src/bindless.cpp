@@ -0,0 +1,213 @@
+#include "bindless.h"
+#include "vkutil.h"
+#include <algorithm>
+
+static constexpr VkDescriptorBindingFlagsEXT indexed_binding_flags =
+    VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT |
+    VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT_EXT;
+
+VkPhysicalDeviceDescriptorIndexingFeaturesEXT BindlessTextures::features(){
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT f {};
+    f.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    f.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+    f.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+    f.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+    f.descriptorBindingPartiallyBound = VK_TRUE;
+    f.descriptorBindingVariableDescriptorCount = VK_TRUE;
+    f.runtimeDescriptorArray = VK_TRUE;
+    return f;
+}
+
+std::span<const char * const> BindlessTextures::extensions(){
+    static const char * const exts[] = {
+        VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME,
+        VK_KHR_MAINTENANCE3_EXTENSION_NAME
+    };
+    return exts;
+}
+
+bool BindlessTextures::query(const VkDispatch & vkd,VkPhysicalDevice dev,uint32_t & limit){
+    if(!vkd.vkGetPhysicalDeviceFeatures2KHR || !vkd.vkGetPhysicalDeviceProperties2KHR)return false;
+    std::vector<const char*> exts (extensions().begin(),extensions().end());
+    if(!check_device_extension_support(dev,exts))return false;
+
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT has {};
+    has.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    VkPhysicalDeviceFeatures2KHR f2 {};
+    f2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+    f2.pNext = &has;
+    vkd.vkGetPhysicalDeviceFeatures2KHR(dev,&f2);
+    if(!has.shaderSampledImageArrayNonUniformIndexing || !has.descriptorBindingSampledImageUpdateAfterBind ||
+       !has.descriptorBindingUpdateUnusedWhilePending || !has.descriptorBindingPartiallyBound ||
+       !has.descriptorBindingVariableDescriptorCount || !has.runtimeDescriptorArray){
+        return false;
+    }
+
+    VkPhysicalDeviceDescriptorIndexingPropertiesEXT props {};
+    props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+    VkPhysicalDeviceProperties2KHR p2 {};
+    p2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+    p2.pNext = &props;
+    vkd.vkGetPhysicalDeviceProperties2KHR(dev,&p2);
+    limit = std::min({max_count,props.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                      props.maxDescriptorSetUpdateAfterBindSampledImages});
+    return limit > fallback_count;
+}
+
+bool BindlessTextures::init(VkDevice dev,bool indexed,uint32_t limit,VkImageView fallback){
+    device = dev;
+    indexing = indexed;
+    count = indexing ? std::min(limit,max_count) : fallback_count;
+    defaultView = fallback;
+
+    // 所有纹理共用一个采样器，写进布局里，着色器里是separate sampler
+    VkSamplerCreateInfo samplerInfo {};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+    if(vkCreateSampler(device,&samplerInfo,nullptr,&sampler) != VK_SUCCESS)return false;
+
+    VkDescriptorSetLayoutBinding bindings[2] {};
+    bindings[0].binding = 0;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+    bindings[0].descriptorCount = 1;
+    bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    bindings[0].pImmutableSamplers = &sampler;
+    bindings[1].binding = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    bindings[1].descriptorCount = count;
+    bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    VkDescriptorBindingFlagsEXT flags[2] = {0,indexed_binding_flags};
+    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT flagInfo {};
+    flagInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+    flagInfo.bindingCount = 2;
+    flagInfo.pBindingFlags = flags;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = 2;
+    layoutInfo.pBindings = bindings;
+    if(indexing){
+        layoutInfo.pNext = &flagInfo;
+        layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+    }
+    if(vkCreateDescriptorSetLayout(device,&layoutInfo,nullptr,&setLayout) != VK_SUCCESS)return false;
+
+    // 索引模式只有一个set，一直绑着；退化模式每次改动都换新的，旧的退休后还回池子
+    uint32_t sets = indexing ? 1 : fallback_sets;
+    VkDescriptorPoolSize sizes[2] {};
+    sizes[0].type = VK_DESCRIPTOR_TYPE_SAMPLER;
+    sizes[0].descriptorCount = sets;
+    sizes[1].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    sizes[1].descriptorCount = count * sets;
+    VkDescriptorPoolCreateInfo poolInfo {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.flags = indexing ? VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT : VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+    poolInfo.maxSets = sets;
+    poolInfo.poolSizeCount = 2;
+    poolInfo.pPoolSizes = sizes;
+    if(vkCreateDescriptorPool(device,&poolInfo,nullptr,&pool) != VK_SUCCESS)return false;
+
+    views.assign(count,VK_NULL_HANDLE);
+    freeSlots.clear();
+    next = 0;
+    usedSlots = 0;
+    dirty = false;
+    current = allocate();
+    if(!current)return false;
+    // 部分绑定的数组空着就行，固定数组的每个元素都得是有效的
+    if(!indexing)write(current,0,views);
+    return true;
+}
+
+void BindlessTextures::destroy(){
+    if(pool)vkDestroyDescriptorPool(device,pool,nullptr);
+    if(setLayout)vkDestroyDescriptorSetLayout(device,setLayout,nullptr);
+    if(sampler)vkDestroySampler(device,sampler,nullptr);
+    pool = VK_NULL_HANDLE;
+    setLayout = VK_NULL_HANDLE;
+    sampler = VK_NULL_HANDLE;
+    current = VK_NULL_HANDLE;
+    views.clear();
+}
+
+VkDescriptorSet BindlessTextures::allocate(){
+    VkDescriptorSetVariableDescriptorCountAllocateInfoEXT variable {};
+    variable.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO_EXT;
+    variable.descriptorSetCount = 1;
+    variable.pDescriptorCounts = &count;
+
+    VkDescriptorSetAllocateInfo alloc {};
+    alloc.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    alloc.pNext = indexing ? &variable : nullptr;
+    alloc.descriptorPool = pool;
+    alloc.descriptorSetCount = 1;
+    alloc.pSetLayouts = &setLayout;
+    VkDescriptorSet set = VK_NULL_HANDLE;
+    if(vkAllocateDescriptorSets(device,&alloc,&set) != VK_SUCCESS)return VK_NULL_HANDLE;
+    return set;
+}
+
+void BindlessTextures::write(VkDescriptorSet set,uint32_t first,std::span<const VkImageView> images){
+    std::vector<VkDescriptorImageInfo> infos (images.size());
+    for(size_t i = 0;i < images.size();++i){
+        infos[i].imageView = images[i] ? images[i] : defaultView;
+        infos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
+    VkWriteDescriptorSet w {};
+    w.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    w.dstSet = set;
+    w.dstBinding = 1;
+    w.dstArrayElement = first;
+    w.descriptorCount = infos.size();
+    w.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    w.pImageInfo = infos.data();
+    vkUpdateDescriptorSets(device,1,&w,0,nullptr);
+}
+
+uint32_t BindlessTextures::add(VkImageView view){
+    std::lock_guard guard(lock);
+    uint32_t slot;
+    if(!freeSlots.empty()){
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+    }else if(next < count)slot = next++;
+    else return none;
+
+    views[slot] = view;
+    ++usedSlots;
+    // 新槽没有在途的帧用过，UPDATE_UNUSED_WHILE_PENDING允许直接写进绑着的set
+    if(indexing)write(current,slot,{&view,1});
+    else dirty = true;
+    return slot;
+}
+
+void BindlessTextures::remove(uint32_t slot){
+    std::lock_guard guard(lock);
+    if(slot >= count || !views[slot])return;
+    views[slot] = VK_NULL_HANDLE;
+    freeSlots.push_back(slot);
+    --usedSlots;
+    // 部分绑定时旧描述符留着也没关系，没人再读它
+    if(!indexing)dirty = true;
+}
+
+bool BindlessTextures::refresh(std::function<void()> & old){
+    if(indexing)return false;
+    std::lock_guard guard(lock);
+    if(!dirty)return false;
+    // 池子满了说明退休的还没还回来，下一帧再试
+    VkDescriptorSet set = allocate();
+    if(!set)return false;
+    write(set,0,views);
+    old = [dev = device,p = pool,s = current]{ vkFreeDescriptorSets(dev,p,1,&s); };
+    current = set;
+    dirty = false;
+    return true;
+}
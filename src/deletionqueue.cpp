@@ -0,0 +1,40 @@
+#include "deletionqueue.h"
+#include <algorithm>
+
+using namespace alib::g3;
+
+void DeletionQueue::push(uint64_t frame,Deleter fn){
+    std::lock_guard guard(lock);
+    // 比队尾还早的帧并到队尾，晚一点销毁总是安全的
+    if(batches.empty() || batches.back().frame < frame)batches.push_back({frame,{}});
+    batches.back().deleters.push_back(std::move(fn));
+    peak = std::max(peak,++count);
+}
+
+uint32_t DeletionQueue::flush(uint64_t completed){
+    std::vector<Batch> ready;
+    {
+        std::lock_guard guard(lock);
+        while(!batches.empty() && batches.front().frame <= completed){
+            count -= batches.front().deleters.size();
+            ready.push_back(std::move(batches.front()));
+            batches.pop_front();
+        }
+    }
+    // 锁外执行，deleter里再push也不会死锁
+    uint32_t n = 0;
+    for(auto & b : ready){
+        for(auto & fn : b.deleters)fn();
+        n += b.deleters.size();
+    }
+    if(n){
+        std::lock_guard guard(lock);
+        destroyed += n;
+    }
+    return n;
+}
+
+void DeletionQueue::report(LogFactory & lg){
+    std::lock_guard guard(lock);
+    lg(LOG_INFO) << "deletion queue:" << destroyed << " destroyed,peak " << peak << " pending" << endlog;
+}
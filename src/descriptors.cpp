@@ -0,0 +1,285 @@
+#include "descriptors.h"
+#include <algorithm>
+
+using namespace alib::g3;
+
+static constexpr uint64_t fnv_offset = 14695981039346656037ull;
+
+static uint64_t fnv1a(uint64_t h,const void * data,size_t size){
+    auto p = (const uint8_t*)data;
+    for(size_t i = 0;i < size;++i){
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+template<class T> static uint64_t mix(uint64_t h,const T & v){
+    return fnv1a(h,&v,sizeof(v));
+}
+
+// 每个set平均要几个这种描述符，池子按set数乘上去
+static constexpr std::pair<VkDescriptorType,uint32_t> pool_ratios[] = {
+    {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,1},
+    {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,1},
+    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,4},
+    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,1},
+    {VK_DESCRIPTOR_TYPE_SAMPLER,1},
+    {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,4},
+    {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,4},
+    {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,1}
+};
+
+// 链上第index个池子的大小，一个比一个大一倍
+static uint32_t pool_sets(size_t index){
+    return std::min(DescriptorAllocator::min_pool_sets << std::min<size_t>(index,16),DescriptorAllocator::max_pool_sets);
+}
+
+static bool is_buffer(VkDescriptorType type){
+    return type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER || type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC ||
+           type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER || type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+}
+
+void DescriptorAllocator::init(VkDevice dev,uint32_t frames,uint32_t threads){
+    device = dev;
+    threadCount = std::max(threads,1u);
+    frameChains.assign(frames * threadCount,{});
+    caches = std::vector<ThreadCache>(threadCount);
+    completedFrame = 0;
+}
+
+void DescriptorAllocator::destroy(){
+    for(auto & c : frameChains)destroyChain(c);
+    for(auto & c : caches)destroyChain(c.chain);
+    frameChains.clear();
+    caches.clear();
+    std::lock_guard guard(lock);
+    for(auto & [h,e] : layouts)vkDestroyDescriptorSetLayout(device,e.layout,nullptr);
+    layouts.clear();
+}
+
+void DescriptorAllocator::destroyChain(Chain & chain){
+    for(auto p : chain.pools)vkDestroyDescriptorPool(device,p,nullptr);
+    chain.pools.clear();
+    chain.current = 0;
+    chain.sets = 0;
+}
+
+VkDescriptorSetLayout DescriptorAllocator::layout(const VkDescriptorSetLayoutCreateInfo & info){
+    VkDescriptorSetLayout out = VK_NULL_HANDLE;
+    if(info.pNext){
+        vkCreateDescriptorSetLayout(device,&info,nullptr,&out);
+        return out;
+    }
+
+    LayoutEntry entry;
+    entry.flags = info.flags;
+    uint64_t h = mix(fnv_offset,info.flags);
+    for(uint32_t i = 0;i < info.bindingCount;++i){
+        VkDescriptorSetLayoutBinding b = info.pBindings[i];
+        h = mix(h,b.binding);
+        h = mix(h,b.descriptorType);
+        h = mix(h,b.descriptorCount);
+        h = mix(h,b.stageFlags);
+        if(b.pImmutableSamplers){
+            for(uint32_t s = 0;s < b.descriptorCount;++s){
+                h = mix(h,b.pImmutableSamplers[s]);
+                entry.samplers.push_back(b.pImmutableSamplers[s]);
+            }
+        }
+        // 指针指向调用者的内存，之后只判断是不是空，具体的采样器在samplers里
+        entry.bindings.push_back(b);
+    }
+    auto same = [&](const LayoutEntry & e){
+        if(e.flags != entry.flags || e.bindings.size() != entry.bindings.size() || e.samplers != entry.samplers)return false;
+        for(size_t i = 0;i < e.bindings.size();++i){
+            const auto & x = e.bindings[i];
+            const auto & y = entry.bindings[i];
+            if(x.binding != y.binding || x.descriptorType != y.descriptorType || x.descriptorCount != y.descriptorCount ||
+               x.stageFlags != y.stageFlags || !x.pImmutableSamplers != !y.pImmutableSamplers)return false;
+        }
+        return true;
+    };
+
+    std::lock_guard guard(lock);
+    auto [beg,end] = layouts.equal_range(h);
+    for(auto it = beg;it != end;++it){
+        if(same(it->second))return it->second.layout;
+    }
+    if(vkCreateDescriptorSetLayout(device,&info,nullptr,&out) != VK_SUCCESS)return VK_NULL_HANDLE;
+    entry.layout = out;
+    layouts.emplace(h,std::move(entry));
+    return out;
+}
+
+VkDescriptorPool DescriptorAllocator::createPool(uint32_t sets){
+    VkDescriptorPoolSize sizes[std::size(pool_ratios)];
+    for(size_t i = 0;i < std::size(pool_ratios);++i){
+        sizes[i].type = pool_ratios[i].first;
+        sizes[i].descriptorCount = sets * pool_ratios[i].second;
+    }
+    // 只整池重置，不单独释放set
+    VkDescriptorPoolCreateInfo info {};
+    info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    info.maxSets = sets;
+    info.poolSizeCount = std::size(sizes);
+    info.pPoolSizes = sizes;
+    VkDescriptorPool pool = VK_NULL_HANDLE;
+    if(vkCreateDescriptorPool(device,&info,nullptr,&pool) != VK_SUCCESS)return VK_NULL_HANDLE;
+    ++poolsCreated;
+    return pool;
+}
+
+VkDescriptorSet DescriptorAllocator::allocateFrom(Chain & chain,VkDescriptorSetLayout layout){
+    VkDescriptorSetAllocateInfo alloc {};
+    alloc.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    alloc.descriptorSetCount = 1;
+    alloc.pSetLayouts = &layout;
+    VkDescriptorSet set = VK_NULL_HANDLE;
+    while(true){
+        bool fresh = chain.current == chain.pools.size();
+        if(fresh){
+            VkDescriptorPool pool = createPool(pool_sets(chain.current));
+            if(!pool)return VK_NULL_HANDLE;
+            chain.pools.push_back(pool);
+        }
+        // maxSets自己数，超过它再分配在1.0里不保证返回错误
+        if(chain.sets < pool_sets(chain.current)){
+            alloc.descriptorPool = chain.pools[chain.current];
+            VkResult r = vkAllocateDescriptorSets(device,&alloc,&set);
+            if(r == VK_SUCCESS){
+                ++chain.sets;
+                return set;
+            }
+            // 某种描述符用完了或者池子碎了，换到链上的下一个，没有就新建；新建的空池都放不下说明布局超出了池子的配比
+            if(fresh || (r != VK_ERROR_OUT_OF_POOL_MEMORY && r != VK_ERROR_FRAGMENTED_POOL))return VK_NULL_HANDLE;
+        }
+        ++chain.current;
+        chain.sets = 0;
+        ++switches;
+    }
+}
+
+void DescriptorAllocator::beginFrame(uint32_t frame,uint64_t serial,uint64_t completed){
+    completedFrame = completed;
+    for(uint32_t t = 0;t < threadCount;++t){
+        Chain & chain = frameChains[frame * threadCount + t];
+        // 没分配过的池子不用碰
+        for(uint32_t i = 0;i <= chain.current && i < chain.pools.size();++i){
+            vkResetDescriptorPool(device,chain.pools[i],0);
+            ++resets;
+        }
+        chain.current = 0;
+        chain.sets = 0;
+    }
+
+    for(auto & cache : caches){
+        std::erase_if(cache.sets,[&](const auto & kv){
+            const Cached & c = kv.second;
+            if(c.lastUsed > completed || c.lastUsed + max_idle >= serial)return false;
+            cache.vacant[c.layout].push_back({c.set,c.lastUsed});
+            return true;
+        });
+    }
+}
+
+VkDescriptorSet DescriptorAllocator::allocate(uint32_t frame,uint32_t thread,VkDescriptorSetLayout layout){
+    return allocateFrom(frameChains[frame * threadCount + thread],layout);
+}
+
+uint64_t DescriptorAllocator::hashBindings(VkDescriptorSetLayout layout,std::span<const DescriptorBinding> bindings){
+    uint64_t h = mix(fnv_offset,layout);
+    // 结构体里有填充，逐个字段算
+    for(auto & b : bindings){
+        h = mix(h,b.binding);
+        h = mix(h,b.type);
+        if(is_buffer(b.type)){
+            h = mix(h,b.buffer.buffer);
+            h = mix(h,b.buffer.offset);
+            h = mix(h,b.buffer.range);
+        }else{
+            h = mix(h,b.image.sampler);
+            h = mix(h,b.image.imageView);
+            h = mix(h,b.image.imageLayout);
+        }
+    }
+    return h;
+}
+
+bool DescriptorAllocator::sameBindings(std::span<const DescriptorBinding> a,std::span<const DescriptorBinding> b){
+    if(a.size() != b.size())return false;
+    for(size_t i = 0;i < a.size();++i){
+        const auto & x = a[i];
+        const auto & y = b[i];
+        if(x.binding != y.binding || x.type != y.type)return false;
+        if(is_buffer(x.type)){
+            if(x.buffer.buffer != y.buffer.buffer || x.buffer.offset != y.buffer.offset || x.buffer.range != y.buffer.range)return false;
+        }else if(x.image.sampler != y.image.sampler || x.image.imageView != y.image.imageView ||
+                 x.image.imageLayout != y.image.imageLayout)return false;
+    }
+    return true;
+}
+
+VkDescriptorSet DescriptorAllocator::get(uint32_t thread,VkDescriptorSetLayout layout,
+                                         std::span<const DescriptorBinding> bindings,uint64_t serial){
+    ThreadCache & cache = caches[thread];
+    uint64_t h = hashBindings(layout,bindings);
+    auto [beg,end] = cache.sets.equal_range(h);
+    for(auto it = beg;it != end;++it){
+        Cached & c = it->second;
+        if(c.layout != layout || !sameBindings(c.bindings,bindings))continue;
+        c.lastUsed = std::max(c.lastUsed,serial);
+        ++cache.hits;
+        return c.set;
+    }
+
+    // 先用GPU已经用完的空闲set，没有再从链上分配
+    VkDescriptorSet set = VK_NULL_HANDLE;
+    auto & vacant = cache.vacant[layout];
+    auto reusable = std::find_if(vacant.begin(),vacant.end(),[this](const Vacant & v){ return v.serial <= completedFrame; });
+    if(reusable != vacant.end()){
+        set = reusable->set;
+        *reusable = vacant.back();
+        vacant.pop_back();
+    }else set = allocateFrom(cache.chain,layout);
+    if(!set)return VK_NULL_HANDLE;
+
+    std::vector<VkWriteDescriptorSet> writes (bindings.size());
+    for(size_t i = 0;i < bindings.size();++i){
+        auto & w = writes[i];
+        w.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        w.dstSet = set;
+        w.dstBinding = bindings[i].binding;
+        w.descriptorCount = 1;
+        w.descriptorType = bindings[i].type;
+        if(is_buffer(bindings[i].type))w.pBufferInfo = &bindings[i].buffer;
+        else w.pImageInfo = &bindings[i].image;
+    }
+    vkUpdateDescriptorSets(device,writes.size(),writes.data(),0,nullptr);
+    ++cache.writes;
+
+    cache.sets.emplace(h,Cached{layout,set,{bindings.begin(),bindings.end()},serial});
+    return set;
+}
+
+void DescriptorAllocator::invalidate(uint64_t serial){
+    for(auto & cache : caches){
+        for(auto & [h,c] : cache.sets){
+            cache.vacant[c.layout].push_back({c.set,std::max(c.lastUsed,serial)});
+        }
+        cache.sets.clear();
+    }
+}
+
+void DescriptorAllocator::report(LogFactory & lg){
+    uint64_t hits = 0,writes = 0,cached = 0;
+    for(auto & c : caches){
+        hits += c.hits;
+        writes += c.writes;
+        cached += c.sets.size();
+    }
+    std::lock_guard guard(lock);
+    lg(LOG_INFO) << "descriptors:" << layouts.size() << " layouts," << cached << " cached sets," << hits << " hits,"
+                 << writes << " writes," << poolsCreated << " pools," << switches << " pool switches,"
+                 << resets << " pool resets" << endlog;
+}
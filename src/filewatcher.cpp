@@ -0,0 +1,119 @@
+#include "filewatcher.h"
+#include <chrono>
+#include <set>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+FileWatcher::~FileWatcher(){
+    stop();
+}
+
+bool FileWatcher::start(std::string directory,Callback fn){
+    stop();
+    dir = std::move(directory);
+    callback = std::move(fn);
+    quit = false;
+#ifdef __linux__
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(fd < 0)return false;
+    // 编辑器一般是写临时文件再改名，所以MOVED_TO也要
+    if(inotify_add_watch(fd,dir.c_str(),IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0 || pipe(wakeFd) < 0){
+        close(fd);
+        fd = -1;
+        return false;
+    }
+#else
+    if(!std::filesystem::is_directory(dir))return false;
+    scan();
+#endif
+    thread = std::thread([this]{ loop(); });
+    return true;
+}
+
+void FileWatcher::stop(){
+    if(!thread.joinable())return;
+    quit = true;
+#ifdef __linux__
+    char c = 0;
+    [[maybe_unused]] auto n = write(wakeFd[1],&c,1);
+#endif
+    thread.join();
+#ifdef __linux__
+    close(fd);
+    close(wakeFd[0]);
+    close(wakeFd[1]);
+    fd = wakeFd[0] = wakeFd[1] = -1;
+#endif
+}
+
+#ifdef __linux__
+void FileWatcher::loop(){
+    std::set<std::string> changed;
+    while(!quit){
+        pollfd fds[2] = {{fd,POLLIN,0},{wakeFd[0],POLLIN,0}};
+        // 有待通知的变化时等到安静下来为止
+        int n = poll(fds,2,changed.empty() ? -1 : quiet_ms);
+        if(quit)break;
+        if(n < 0){
+            if(errno == EINTR)continue;
+            break;
+        }
+        if(n == 0){
+            callback({changed.begin(),changed.end()});
+            changed.clear();
+            continue;
+        }
+        if(!(fds[0].revents & POLLIN))continue;
+
+        alignas(inotify_event) char buf[4096];
+        ssize_t len;
+        while((len = read(fd,buf,sizeof(buf))) > 0){
+            for(char * p = buf;p < buf + len;){
+                auto e = (inotify_event*)p;
+                if(e->len)changed.insert(e->name);
+                p += sizeof(inotify_event) + e->len;
+            }
+        }
+    }
+}
+#else
+void FileWatcher::loop(){
+    using clock = std::chrono::steady_clock;
+    std::set<std::string> changed;
+    clock::time_point last;
+    while(!quit){
+        std::this_thread::sleep_for(std::chrono::milliseconds(poll_ms));
+        auto names = scan();
+        if(!names.empty()){
+            changed.insert(names.begin(),names.end());
+            last = clock::now();
+        }else if(!changed.empty() && clock::now() - last >= std::chrono::milliseconds(quiet_ms)){
+            callback({changed.begin(),changed.end()});
+            changed.clear();
+        }
+    }
+}
+
+std::vector<std::string> FileWatcher::scan(){
+    std::vector<std::string> names;
+    // 第一次扫描只记录，不算变化
+    bool first = times.empty();
+    std::error_code ec;
+    for(auto & entry : std::filesystem::directory_iterator(dir,ec)){
+        auto time = entry.last_write_time(ec);
+        if(ec)continue;
+        std::string name = entry.path().filename().string();
+        auto it = times.find(name);
+        if(it == times.end() || it->second != time){
+            if(!first)names.push_back(name);
+            times[name] = time;
+        }
+    }
+    return names;
+}
+#endif
@@ -2,7 +2,8 @@
 
 Application app;
 
-int main(){
+int main(int argc,char ** argv){
+    app.parseArguments(argc,argv);
     app.setup();
 
     int ret = app.run();
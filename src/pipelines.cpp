@@ -0,0 +1,266 @@
+#include "pipelines.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+using namespace alib::g3;
+
+static constexpr uint64_t fnv_offset = 14695981039346656037ull;
+
+static uint64_t fnv1a(uint64_t h,const void * data,size_t size){
+    auto p = (const uint8_t*)data;
+    for(size_t i = 0;i < size;++i){
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+template<class T> static uint64_t mix(uint64_t h,const T & v){
+    return fnv1a(h,&v,sizeof(v));
+}
+
+bool PipelineKey::setVertexInput(std::span<const VkVertexInputBindingDescription> b,
+                                 std::span<const VkVertexInputAttributeDescription> a){
+    if(b.size() > max_bindings || a.size() > max_attributes)return false;
+    // 没用到的槽保持全0，比较和哈希才能直接按字节来
+    bindings = {};
+    attributes = {};
+    std::copy(b.begin(),b.end(),bindings.begin());
+    std::copy(a.begin(),a.end(),attributes.begin());
+    bindingCount = b.size();
+    attributeCount = a.size();
+    return true;
+}
+
+uint64_t PipelineKey::familyHash() const{
+    uint64_t h = fnv_offset;
+    h = mix(h,vert);
+    h = mix(h,frag);
+    h = mix(h,layout);
+    h = mix(h,renderPass);
+    h = mix(h,subpass);
+    return h;
+}
+
+uint64_t PipelineKey::hash() const{
+    uint64_t h = familyHash();
+    h = mix(h,topology);
+    h = mix(h,polygonMode);
+    h = mix(h,cullMode);
+    h = mix(h,frontFace);
+    h = mix(h,blend);
+    h = mix(h,dynamicStates);
+    h = fnv1a(h,bindings.data(),sizeof(VkVertexInputBindingDescription) * bindingCount);
+    h = fnv1a(h,attributes.data(),sizeof(VkVertexInputAttributeDescription) * attributeCount);
+    return h;
+}
+
+bool PipelineKey::operator==(const PipelineKey & o) const{
+    return vert == o.vert && frag == o.frag && layout == o.layout && renderPass == o.renderPass &&
+        subpass == o.subpass && topology == o.topology && polygonMode == o.polygonMode &&
+        cullMode == o.cullMode && frontFace == o.frontFace && blend == o.blend &&
+        dynamicStates == o.dynamicStates && bindingCount == o.bindingCount && attributeCount == o.attributeCount &&
+        !std::memcmp(bindings.data(),o.bindings.data(),sizeof(VkVertexInputBindingDescription) * bindingCount) &&
+        !std::memcmp(attributes.data(),o.attributes.data(),sizeof(VkVertexInputAttributeDescription) * attributeCount);
+}
+
+void PipelineLibrary::init(VkDevice dev,VkPipelineCache pipelineCache,uint64_t idle){
+    device = dev;
+    cache = pipelineCache;
+    maxIdle = idle;
+}
+
+void PipelineLibrary::destroy(){
+    std::lock_guard guard(lock);
+    for(auto & e : lru){
+        vkDestroyPipeline(device,e.pipeline,nullptr);
+    }
+    lru.clear();
+    entries.clear();
+    bases.clear();
+}
+
+VkPipeline PipelineLibrary::get(const PipelineKey & key,uint64_t frame){
+    uint64_t family = key.familyHash();
+    VkPipeline base = VK_NULL_HANDLE;
+    {
+        std::lock_guard guard(lock);
+        if(frame)lastFrame = std::max(lastFrame,frame);
+        else frame = lastFrame;
+        if(auto it = entries.find(key);it != entries.end()){
+            ++hits;
+            it->second->lastUsed = frame;
+            lru.splice(lru.begin(),lru,it->second);
+            return it->second->pipeline;
+        }
+        ++misses;
+        ++creating;
+        if(auto b = bases.find(family);b != bases.end())base = b->second;
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    VkPipeline pipeline = create(key,base);
+    double ms = std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+    std::lock_guard guard(lock);
+    --creating;
+    createTime += ms;
+    if(!pipeline)return VK_NULL_HANDLE;
+    if(auto it = entries.find(key);it != entries.end()){
+        // 别的线程抢先建好了
+        vkDestroyPipeline(device,pipeline,nullptr);
+        it->second->lastUsed = std::max(it->second->lastUsed,frame);
+        return it->second->pipeline;
+    }
+    if(!bases.contains(family))bases.emplace(family,pipeline);
+    if(base)++derived;
+
+    lru.push_front({key,pipeline,frame});
+    entries.emplace(key,lru.begin());
+    return pipeline;
+}
+
+VkPipeline PipelineLibrary::take(const PipelineKey & key){
+    std::lock_guard guard(lock);
+    auto it = entries.find(key);
+    if(it == entries.end())return VK_NULL_HANDLE;
+    VkPipeline pipeline = it->second->pipeline;
+    if(auto b = bases.find(key.familyHash());b != bases.end() && b->second == pipeline){
+        bases.erase(b);
+    }
+    lru.erase(it->second);
+    entries.erase(it);
+    return pipeline;
+}
+
+uint32_t PipelineLibrary::evict(uint64_t frame,uint64_t completedFrame){
+    std::lock_guard guard(lock);
+    lastFrame = std::max(lastFrame,frame);
+    if(creating)return 0;
+    uint32_t count = 0;
+    // 从最久没用的开始，遇到还不够久的就可以停了
+    while(!lru.empty()){
+        Entry & e = lru.back();
+        if(e.lastUsed + maxIdle >= frame || e.lastUsed > completedFrame)break;
+
+        // base没了的话下一个同族的管线自己当base
+        if(auto b = bases.find(e.key.familyHash());b != bases.end() && b->second == e.pipeline){
+            bases.erase(b);
+        }
+        vkDestroyPipeline(device,e.pipeline,nullptr);
+        entries.erase(e.key);
+        lru.pop_back();
+        ++count;
+    }
+    evicted += count;
+    return count;
+}
+
+void PipelineLibrary::report(LogFactory & lg){
+    std::lock_guard guard(lock);
+    uint64_t total = hits + misses;
+    lg(LOG_INFO) << "pipelines:" << entries.size() << " alive," << hits << " hits," << misses << " misses ("
+                 << (total ? hits * 100.0 / total : 0.0) << "% hit)," << derived << " derived," << evicted
+                 << " evicted," << createTime << "ms creating" << endlog;
+}
+
+VkPipeline PipelineLibrary::create(const PipelineKey & key,VkPipeline base){
+    VkPipelineShaderStageCreateInfo infos[2] = {{},{}};
+    infos[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    infos[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    infos[0].module = key.vert;
+    infos[0].pName = "main";
+
+    infos[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    infos[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    infos[1].module = key.frag;
+    infos[1].pName = "main";
+
+    std::vector<VkDynamicState> dynamicStates;
+    for(uint32_t i = 0;i < 32;++i){
+        if(key.dynamicStates & (1u << i))dynamicStates.push_back((VkDynamicState)i);
+    }
+    VkPipelineDynamicStateCreateInfo dinfo {};
+    dinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dinfo.dynamicStateCount = dynamicStates.size();
+    dinfo.pDynamicStates = dynamicStates.data();
+
+    VkPipelineVertexInputStateCreateInfo vin {};
+    vin.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vin.vertexBindingDescriptionCount = key.bindingCount;
+    vin.pVertexBindingDescriptions = key.bindings.data();
+    vin.vertexAttributeDescriptionCount = key.attributeCount;
+    vin.pVertexAttributeDescriptions = key.attributes.data();
+
+    VkPipelineInputAssemblyStateCreateInfo assem {};
+    assem.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    assem.topology = key.topology;
+    assem.primitiveRestartEnable = VK_FALSE;
+
+    // viewport和scissor是动态状态，这里只需要数量
+    VkPipelineViewportStateCreateInfo vps {};
+    vps.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    vps.viewportCount = 1;
+    vps.scissorCount = 1;
+
+    VkPipelineRasterizationStateCreateInfo raster {};
+    raster.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    raster.depthClampEnable = VK_FALSE;
+    raster.rasterizerDiscardEnable = VK_FALSE;
+    raster.polygonMode = key.polygonMode;
+    raster.lineWidth = 1.0f;
+    raster.cullMode = key.cullMode;
+    raster.frontFace = key.frontFace;
+    raster.depthBiasEnable = VK_FALSE;
+
+    VkPipelineMultisampleStateCreateInfo msamp {};
+    msamp.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    msamp.sampleShadingEnable = VK_FALSE;
+    msamp.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    msamp.minSampleShading = 1.0f;
+
+    VkPipelineColorBlendAttachmentState cblend {};
+    cblend.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                            VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    cblend.blendEnable = key.blend;
+    cblend.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+    cblend.dstColorBlendFactor = key.blend ? VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA : VK_BLEND_FACTOR_ZERO;
+    cblend.colorBlendOp = VK_BLEND_OP_ADD;
+    cblend.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    cblend.dstAlphaBlendFactor = key.blend ? VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA : VK_BLEND_FACTOR_ZERO;
+    cblend.alphaBlendOp = VK_BLEND_OP_ADD;
+
+    VkPipelineColorBlendStateCreateInfo scblend {};
+    scblend.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    scblend.logicOpEnable = VK_FALSE;
+    scblend.logicOp = VK_LOGIC_OP_COPY;
+    scblend.attachmentCount = 1;
+    scblend.pAttachments = &cblend;
+
+    VkGraphicsPipelineCreateInfo gpipe {};
+    gpipe.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    // 同族的都允许派生，base被淘汰之后谁都可以接替
+    gpipe.flags = VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT;
+    if(base)gpipe.flags |= VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+    gpipe.stageCount = 2;
+    gpipe.pStages = infos;
+    gpipe.pVertexInputState = &vin;
+    gpipe.pInputAssemblyState = &assem;
+    gpipe.pViewportState = &vps;
+    gpipe.pRasterizationState = &raster;
+    gpipe.pMultisampleState = &msamp;
+    gpipe.pDepthStencilState = nullptr;
+    gpipe.pColorBlendState = &scblend;
+    gpipe.pDynamicState = &dinfo;
+    gpipe.layout = key.layout;
+    gpipe.renderPass = key.renderPass;
+    gpipe.subpass = key.subpass;
+    gpipe.basePipelineHandle = base;
+    gpipe.basePipelineIndex = -1;
+
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    if(vkCreateGraphicsPipelines(device,cache,1,&gpipe,nullptr,&pipeline) != VK_SUCCESS)pipeline = VK_NULL_HANDLE;
+    return pipeline;
+}
@@ -0,0 +1,173 @@
+#include "profiler.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+
+using namespace alib::g3;
+
+static uint32_t thread_index(){
+    // tid 0 是GPU那一行
+    static std::atomic<uint32_t> next { 1 };
+    thread_local uint32_t id = next++;
+    return id;
+}
+
+void Profiler::init(VkPhysicalDevice physicalDevice,VkDevice dev,const VkDispatch & vkd,uint32_t queueFamily,uint32_t frames){
+    if(!enabled)return;
+    device = dev;
+    // 每帧都要录，直接调驱动
+    cmdResetQueryPool = vkd.vkCmdResetQueryPool ? vkd.vkCmdResetQueryPool : vkCmdResetQueryPool;
+    cmdWriteTimestamp = vkd.vkCmdWriteTimestamp ? vkd.vkCmdWriteTimestamp : vkCmdWriteTimestamp;
+    getQueryPoolResults = vkd.vkGetQueryPoolResults ? vkd.vkGetQueryPoolResults : vkGetQueryPoolResults;
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physicalDevice,&props);
+    timestampPeriod = props.limits.timestampPeriod;
+
+    uint32_t count;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice,&count,nullptr);
+    std::vector<VkQueueFamilyProperties> families (count);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice,&count,families.data());
+    uint32_t bits = families[queueFamily].timestampValidBits;
+    // 这个队列不支持时间戳的话只统计CPU
+    gpu = bits != 0;
+    timestampMask = bits >= 64 ? ~0ull : ((1ull << bits) - 1);
+
+    slots.resize(frames);
+    if(!gpu)return;
+    for(auto & s : slots){
+        VkQueryPoolCreateInfo info {};
+        info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        info.queryCount = max_sections * 2;
+        if(vkCreateQueryPool(device,&info,nullptr,&s.pool) != VK_SUCCESS){
+            gpu = false;
+            return;
+        }
+    }
+}
+
+void Profiler::destroy(LogFactory & lg){
+    for(auto & s : slots){
+        if(s.pool)vkDestroyQueryPool(device,s.pool,nullptr);
+    }
+    slots.clear();
+    if(!enabled || tracePath.empty())return;
+
+    FILE * f = std::fopen(tracePath.c_str(),"w");
+    if(!f){
+        lg(LOG_ERROR) << "Failed to write trace to " << tracePath << endlog;
+        return;
+    }
+    std::lock_guard guard(lock);
+    std::fprintf(f,"{\"traceEvents\":[\n");
+    std::fprintf(f,"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"GPU\"}}");
+    for(auto & e : events){
+        std::fprintf(f,",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                     e.name,e.tid,e.begin,e.duration);
+    }
+    std::fprintf(f,"\n]}\n");
+    std::fclose(f);
+    lg(LOG_INFO) << "profiler:" << events.size() << " events written to " << tracePath << endlog;
+}
+
+void Profiler::add(const char * name,uint32_t tid,double begin,double end,bool isGpu){
+    std::lock_guard guard(lock);
+    if(!tracePath.empty() && events.size() < max_events){
+        events.push_back({name,tid,begin,end - begin});
+    }
+    auto & s = samples[isGpu ? std::string("gpu ") + name : std::string(name)];
+    double ms = (end - begin) / 1000.0;
+    if(s.values.size() < window)s.values.push_back(ms);
+    else s.values[s.next] = ms;
+    s.next = (s.next + 1) % window;
+}
+
+void Profiler::addCpu(const char * name,double begin,double end){
+    add(name,thread_index(),begin,end,false);
+}
+
+void Profiler::gpuFrameBegin(VkCommandBuffer buf,uint32_t slot){
+    if(!enabled || !gpu)return;
+    Slot & s = slots[slot];
+    s.sections.clear();
+    s.queries = 0;
+    cmdResetQueryPool(buf,s.pool,0,max_sections * 2);
+}
+
+uint32_t Profiler::gpuBegin(VkCommandBuffer buf,uint32_t slot,const char * name){
+    if(!enabled || !gpu)return 0;
+    Slot & s = slots[slot];
+    if(s.sections.size() >= max_sections)return max_sections;
+    uint32_t query = s.sections.size() * 2;
+    s.sections.push_back({name,query});
+    s.queries = query + 2;
+    cmdWriteTimestamp(buf,VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,s.pool,query);
+    return s.sections.size() - 1;
+}
+
+void Profiler::gpuEnd(VkCommandBuffer buf,uint32_t slot,uint32_t section){
+    if(!enabled || !gpu || section >= max_sections)return;
+    Slot & s = slots[slot];
+    cmdWriteTimestamp(buf,VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,s.pool,s.sections[section].query + 1);
+}
+
+void Profiler::frameSubmitted(uint32_t slot){
+    if(!enabled || !gpu)return;
+    slots[slot].submitted = slots[slot].queries;
+    slots[slot].submitTime = now();
+}
+
+void Profiler::collect(uint32_t slot){
+    if(!enabled || !gpu)return;
+    Slot & s = slots[slot];
+    if(!s.submitted)return;
+
+    uint64_t data[max_sections * 2];
+    // fence已经signal了，不带WAIT标志也拿得到；拿不到就跳过这一帧
+    VkResult r = getQueryPoolResults(device,s.pool,0,s.submitted,sizeof(uint64_t) * s.submitted,data,
+                                     sizeof(uint64_t),VK_QUERY_RESULT_64_BIT);
+    s.submitted = 0;
+    if(r != VK_SUCCESS)return;
+
+    // GPU时间和CPU时间不是一个时钟，以提交时间为这一帧的起点对齐
+    uint64_t origin = data[0] & timestampMask;
+    auto toUs = [&](uint64_t t){
+        return s.submitTime + ((t & timestampMask) - origin) * timestampPeriod / 1000.0;
+    };
+    for(auto & sec : s.sections){
+        add(sec.name,0,toUs(data[sec.query]),toUs(data[sec.query + 1]),true);
+    }
+}
+
+std::optional<double> Profiler::percentile(const std::string & name,double p){
+    std::lock_guard guard(lock);
+    auto it = samples.find(name);
+    if(it == samples.end() || it->second.values.empty())return std::nullopt;
+    std::vector<double> sorted = it->second.values;
+    std::sort(sorted.begin(),sorted.end());
+    return sorted[std::min(sorted.size() - 1,(size_t)(p * sorted.size()))];
+}
+
+void Profiler::clearSamples(){
+    std::lock_guard guard(lock);
+    samples.clear();
+}
+
+void Profiler::report(LogFactory & lg){
+    if(!enabled)return;
+    std::lock_guard guard(lock);
+    if(samples.empty())return;
+    lg(LOG_INFO) << "profiler:last " << window << " samples of each scope" << endlog;
+    std::vector<double> sorted;
+    for(auto & [name,s] : samples){
+        if(s.values.empty())continue;
+        sorted = s.values;
+        std::sort(sorted.begin(),sorted.end());
+        auto pct = [&](double p){
+            return sorted[std::min(sorted.size() - 1,(size_t)(p * sorted.size()))];
+        };
+        lg(LOG_INFO) << "  " << name << ":p50 " << pct(0.5) << "ms,p95 " << pct(0.95) << "ms,p99 "
+                     << pct(0.99) << "ms" << endlog;
+    }
+}
@@ -0,0 +1,472 @@
+#include "rendergraph.h"
+#include <algorithm>
+#include <set>
+#include <sstream>
+
+static constexpr VkAccessFlags write_access = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT |
+    VK_ACCESS_MEMORY_WRITE_BIT;
+
+/// pure writes don't need what was there before
+static bool overwrites(RGUsage u){
+    return u == RGUsage::TransferDst || u == RGUsage::StorageWrite;
+}
+
+static RenderGraph::State usage_state(RGUsage u,bool image){
+    RenderGraph::State s;
+    switch(u){
+    case RGUsage::ColorAttachment:
+        s = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+             VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+             VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+        break;
+    case RGUsage::Sampled:
+        s = {VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,VK_ACCESS_SHADER_READ_BIT,VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+        break;
+    case RGUsage::TransferSrc:
+        s = {VK_PIPELINE_STAGE_TRANSFER_BIT,VK_ACCESS_TRANSFER_READ_BIT,VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL};
+        break;
+    case RGUsage::TransferDst:
+        s = {VK_PIPELINE_STAGE_TRANSFER_BIT,VK_ACCESS_TRANSFER_WRITE_BIT,VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL};
+        break;
+    case RGUsage::StorageRead:
+        s = {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,VK_ACCESS_SHADER_READ_BIT,VK_IMAGE_LAYOUT_GENERAL};
+        break;
+    case RGUsage::StorageWrite:
+        s = {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,VK_ACCESS_SHADER_WRITE_BIT,VK_IMAGE_LAYOUT_GENERAL};
+        break;
+    case RGUsage::StorageReadWrite:
+        s = {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,VK_IMAGE_LAYOUT_GENERAL};
+        break;
+    case RGUsage::IndirectRead:
+        s = {VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,VK_ACCESS_INDIRECT_COMMAND_READ_BIT,VK_IMAGE_LAYOUT_UNDEFINED};
+        break;
+    case RGUsage::VertexRead:
+        s = {VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,VK_IMAGE_LAYOUT_UNDEFINED};
+        break;
+    }
+    if(!image)s.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    return s;
+}
+
+static const char * layout_name(VkImageLayout l){
+    switch(l){
+    case VK_IMAGE_LAYOUT_UNDEFINED:return "UNDEFINED";
+    case VK_IMAGE_LAYOUT_GENERAL:return "GENERAL";
+    case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:return "COLOR_ATTACHMENT";
+    case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:return "SHADER_READ";
+    case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:return "TRANSFER_SRC";
+    case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:return "TRANSFER_DST";
+    case VK_IMAGE_LAYOUT_PRESENT_SRC_KHR:return "PRESENT_SRC";
+    default:return "OTHER";
+    }
+}
+
+void RenderGraph::init(VkDevice dev,MemoryAllocator & alloc,const VkDispatch & vkd){
+    device = dev;
+    allocator = &alloc;
+    cmdPipelineBarrier = vkd.vkCmdPipelineBarrier ? vkd.vkCmdPipelineBarrier : vkCmdPipelineBarrier;
+}
+
+RenderGraph::Id RenderGraph::importImage(std::string name,VkImageAspectFlags aspect,State initial,State final){
+    Resource r;
+    r.name = std::move(name);
+    r.aspect = aspect;
+    r.initial = initial;
+    r.final = final;
+    resources.push_back(std::move(r));
+    return resources.size() - 1;
+}
+
+RenderGraph::Id RenderGraph::importBuffer(std::string name,State initial,State final){
+    Resource r;
+    r.name = std::move(name);
+    r.image = false;
+    r.initial = initial;
+    r.final = final;
+    resources.push_back(std::move(r));
+    return resources.size() - 1;
+}
+
+RenderGraph::Id RenderGraph::createImage(std::string name,const ImageDesc & desc){
+    Resource r;
+    r.name = std::move(name);
+    r.transient = true;
+    r.aspect = desc.aspect;
+    r.desc = desc;
+    resources.push_back(std::move(r));
+    return resources.size() - 1;
+}
+
+RenderGraph::Id RenderGraph::addPass(std::string name,Record fn){
+    Pass p;
+    p.name = std::move(name);
+    p.fn = std::move(fn);
+    passes.push_back(std::move(p));
+    return passes.size() - 1;
+}
+
+void RenderGraph::use(Id pass,Id resource,RGUsage usage){
+    Use u;
+    u.resource = resource;
+    u.usage = usage;
+    u.state = usage_state(usage,resources[resource].image);
+    u.write = u.state.access & write_access;
+    passes[pass].uses.push_back(u);
+}
+
+void RenderGraph::output(Id resource){
+    resources[resource].output = true;
+}
+
+void RenderGraph::bindImage(Id resource,VkImage img){
+    resources[resource].img = img;
+}
+
+void RenderGraph::bindBuffer(Id resource,VkBuffer buffer){
+    resources[resource].buffer = buffer;
+}
+
+VkImage RenderGraph::image(Id resource) const{
+    return resources[resource].img;
+}
+
+VkImageView RenderGraph::view(Id resource) const{
+    return resources[resource].imgView;
+}
+
+bool RenderGraph::fail(std::string msg){
+    lastError = std::move(msg);
+    return false;
+}
+
+std::vector<RenderGraph::Id> RenderGraph::order(){
+    // 倒着走：一个pass写了后面还要读的东西才活着
+    std::vector<bool> needed (resources.size(),false);
+    for(Id r = 0;r < resources.size();++r)needed[r] = resources[r].output;
+    culled = 0;
+    for(Id p = passes.size();p-- > 0;){
+        Pass & pass = passes[p];
+        pass.alive = std::any_of(pass.uses.begin(),pass.uses.end(),[&](const Use & u){
+            return u.write && needed[u.resource];
+        });
+        if(!pass.alive){
+            ++culled;
+            continue;
+        }
+        for(auto & u : pass.uses){
+            if(overwrites(u.usage))needed[u.resource] = false;
+        }
+        for(auto & u : pass.uses){
+            if(!overwrites(u.usage))needed[u.resource] = true;
+        }
+    }
+
+    // 按资源的读写关系连边，同样可以执行的取声明早的
+    std::vector<std::vector<Id>> next (passes.size());
+    std::vector<uint32_t> indegree (passes.size(),0);
+    std::vector<Id> lastWriter (resources.size(),none);
+    std::vector<std::vector<Id>> readers (resources.size());
+    auto edge = [&](Id from,Id to){
+        if(from == none || from == to)return;
+        next[from].push_back(to);
+        ++indegree[to];
+    };
+    for(Id p = 0;p < passes.size();++p){
+        if(!passes[p].alive)continue;
+        for(auto & u : passes[p].uses){
+            edge(lastWriter[u.resource],p);
+            if(u.write){
+                for(Id r : readers[u.resource])edge(r,p);
+                readers[u.resource].clear();
+                lastWriter[u.resource] = p;
+            }else readers[u.resource].push_back(p);
+        }
+    }
+    std::set<Id> ready;
+    for(Id p = 0;p < passes.size();++p){
+        if(passes[p].alive && !indegree[p])ready.insert(p);
+    }
+    std::vector<Id> out;
+    while(!ready.empty()){
+        Id p = *ready.begin();
+        ready.erase(ready.begin());
+        out.push_back(p);
+        for(Id n : next[p]){
+            if(!--indegree[n])ready.insert(n);
+        }
+    }
+    return out;
+}
+
+bool RenderGraph::allocateTransients(){
+    std::vector<Id> transients;
+    for(Id r = 0;r < resources.size();++r){
+        if(resources[r].transient && resources[r].first != ~0u)transients.push_back(r);
+    }
+    std::sort(transients.begin(),transients.end(),[&](Id a,Id b){ return resources[a].first < resources[b].first; });
+
+    for(Id id : transients){
+        Resource & r = resources[id];
+        VkImageCreateInfo info {};
+        info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        info.imageType = VK_IMAGE_TYPE_2D;
+        info.format = r.desc.format;
+        info.extent = {r.desc.extent.width,r.desc.extent.height,1};
+        info.mipLevels = 1;
+        info.arrayLayers = 1;
+        info.samples = VK_SAMPLE_COUNT_1_BIT;
+        info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        info.usage = r.desc.usage;
+        info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        if(vkCreateImage(device,&info,nullptr,&r.img) != VK_SUCCESS)return fail("failed to create image " + r.name);
+
+        VkMemoryRequirements req;
+        vkGetImageMemoryRequirements(device,r.img,&req);
+        // 找一个成员都已经用完了的槽，没有就开新的
+        Slot * slot = nullptr;
+        for(auto & s : slots){
+            if(s.end < r.first && (s.req.memoryTypeBits & req.memoryTypeBits)){
+                slot = &s;
+                break;
+            }
+        }
+        if(!slot){
+            slots.emplace_back();
+            slot = &slots.back();
+            slot->req.memoryTypeBits = req.memoryTypeBits;
+        }
+        slot->req.size = std::max(slot->req.size,req.size);
+        slot->req.alignment = std::max(slot->req.alignment,req.alignment);
+        slot->req.memoryTypeBits &= req.memoryTypeBits;
+        slot->lazy = slot->lazy && (r.desc.usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT);
+        slot->members.push_back(id);
+        slot->end = r.last;
+        r.slot = slot - slots.data();
+    }
+
+    for(auto & s : slots){
+        auto alloc = allocator->allocate(s.req,ResourceKind::Optimal,VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                         s.lazy ? VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT : 0);
+        if(!alloc)return fail("out of device memory for transient images");
+        s.alloc = *alloc;
+        for(Id id : s.members){
+            Resource & r = resources[id];
+            vkBindImageMemory(device,r.img,s.alloc.memory,s.alloc.offset);
+
+            VkImageViewCreateInfo view {};
+            view.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            view.image = r.img;
+            view.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            view.format = r.desc.format;
+            view.subresourceRange = {r.aspect,0,1,0,1};
+            if(vkCreateImageView(device,&view,nullptr,&r.imgView) != VK_SUCCESS){
+                return fail("failed to create image view " + r.name);
+            }
+        }
+    }
+    return true;
+}
+
+bool RenderGraph::compile(){
+    if(!slots.empty())return fail("compile() twice,release() the graph first");
+    steps.clear();
+    barriers = 0;
+    std::vector<Id> sorted = order();
+
+    // 同一个pass里多次使用同一资源的合并成一次
+    for(Id p : sorted){
+        auto & uses = passes[p].uses;
+        std::vector<Use> merged;
+        for(auto & u : uses){
+            auto it = std::find_if(merged.begin(),merged.end(),[&](const Use & m){ return m.resource == u.resource; });
+            if(it == merged.end()){
+                merged.push_back(u);
+                continue;
+            }
+            if(it->state.layout != u.state.layout){
+                return fail("pass " + passes[p].name + " needs " + resources[u.resource].name + " in two layouts");
+            }
+            it->state.stage |= u.state.stage;
+            it->state.access |= u.state.access;
+            it->write = it->write || u.write;
+        }
+        uses = std::move(merged);
+    }
+
+    for(uint32_t i = 0;i < sorted.size();++i){
+        for(auto & u : passes[sorted[i]].uses){
+            Resource & r = resources[u.resource];
+            r.first = std::min(r.first,i);
+            r.last = std::max(r.last,i);
+        }
+    }
+    if(!allocateTransients())return false;
+
+    std::vector<State> cur (resources.size());
+    for(Id r = 0;r < resources.size();++r){
+        if(!resources[r].transient){
+            cur[r] = resources[r].initial;
+            continue;
+        }
+        // 槽里的第一个要等上一帧最后用这块内存的那些访问
+        if(resources[r].slot == ~0u)continue;
+        Slot & s = slots[resources[r].slot];
+        if(s.members.front() != r)continue;
+        State & init = cur[r];
+        init.stage = 0;
+        for(Id m : s.members){
+            for(Id p : sorted){
+                for(auto & u : passes[p].uses){
+                    if(u.resource != m)continue;
+                    init.stage |= u.state.stage;
+                    init.access |= u.state.access & write_access;
+                }
+            }
+        }
+    }
+
+    for(uint32_t i = 0;i < sorted.size();++i){
+        Step step;
+        step.pass = sorted[i];
+        for(auto & u : passes[sorted[i]].uses){
+            Resource & r = resources[u.resource];
+            if(r.transient && r.first == i){
+                // 前一个占用者用完了，接着它的访问之后开始
+                Slot & s = slots[r.slot];
+                auto it = std::find(s.members.begin(),s.members.end(),u.resource);
+                if(it != s.members.begin())cur[u.resource] = {cur[*(it - 1)].stage,cur[*(it - 1)].access,VK_IMAGE_LAYOUT_UNDEFINED};
+            }
+            State & c = cur[u.resource];
+            bool transition = r.image && c.layout != u.state.layout;
+            if(transition || (c.access & write_access) || u.write){
+                step.barriers.push_back({u.resource,{c.stage,c.access & write_access,c.layout},u.state});
+                c = u.state;
+            }else{
+                // 读之后还是读，布局也一样，不用屏障
+                c.stage |= u.state.stage;
+                c.access |= u.state.access;
+            }
+        }
+        barriers += step.barriers.size();
+        steps.push_back(std::move(step));
+    }
+
+    Step last;
+    last.pass = none;
+    for(Id id = 0;id < resources.size();++id){
+        Resource & r = resources[id];
+        if(r.transient || r.first == ~0u)continue;
+        State & c = cur[id];
+        bool transition = r.image && r.final.layout != VK_IMAGE_LAYOUT_UNDEFINED && c.layout != r.final.layout;
+        if(transition || ((c.access & write_access) && r.final.access)){
+            State dst = r.final;
+            if(dst.layout == VK_IMAGE_LAYOUT_UNDEFINED)dst.layout = c.layout;
+            last.barriers.push_back({id,{c.stage,c.access & write_access,c.layout},dst});
+        }
+    }
+    if(!last.barriers.empty()){
+        barriers += last.barriers.size();
+        steps.push_back(std::move(last));
+    }
+    return true;
+}
+
+void RenderGraph::execute(VkCommandBuffer buf) const{
+    std::vector<VkImageMemoryBarrier> images;
+    std::vector<VkBufferMemoryBarrier> buffers;
+    for(auto & step : steps){
+        if(!step.barriers.empty()){
+            images.clear();
+            buffers.clear();
+            VkPipelineStageFlags src = 0,dst = 0;
+            for(auto & b : step.barriers){
+                const Resource & r = resources[b.resource];
+                src |= b.src.stage;
+                dst |= b.dst.stage;
+                if(r.image){
+                    VkImageMemoryBarrier ib {};
+                    ib.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+                    ib.srcAccessMask = b.src.access;
+                    ib.dstAccessMask = b.dst.access;
+                    ib.oldLayout = b.src.layout;
+                    ib.newLayout = b.dst.layout;
+                    ib.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                    ib.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                    ib.image = r.img;
+                    ib.subresourceRange = {r.aspect,0,VK_REMAINING_MIP_LEVELS,0,VK_REMAINING_ARRAY_LAYERS};
+                    images.push_back(ib);
+                }else{
+                    VkBufferMemoryBarrier bb {};
+                    bb.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+                    bb.srcAccessMask = b.src.access;
+                    bb.dstAccessMask = b.dst.access;
+                    bb.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                    bb.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                    bb.buffer = r.buffer;
+                    bb.offset = 0;
+                    bb.size = VK_WHOLE_SIZE;
+                    buffers.push_back(bb);
+                }
+            }
+            cmdPipelineBarrier(buf,src ? src : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,dst ? dst : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                               0,0,nullptr,buffers.size(),buffers.data(),images.size(),images.data());
+        }
+        if(step.pass != none)passes[step.pass].fn(buf);
+    }
+}
+
+std::string RenderGraph::dump() const{
+    std::ostringstream os;
+    os << "render graph:" << (passes.size() - culled) << "/" << passes.size() << " passes," << culled << " culled,"
+       << barriers << " barriers," << slots.size() << " alias slots\n";
+    auto barrier = [&](const Barrier & b){
+        os << "    barrier " << resources[b.resource].name;
+        if(resources[b.resource].image)os << " " << layout_name(b.src.layout) << "->" << layout_name(b.dst.layout);
+        os << " stage 0x" << std::hex << b.src.stage << "->0x" << b.dst.stage << " access 0x" << b.src.access << "->0x"
+           << b.dst.access << std::dec << "\n";
+    };
+    for(auto & step : steps){
+        os << "  " << (step.pass == none ? std::string("final") : "pass " + passes[step.pass].name) << "\n";
+        for(auto & b : step.barriers)barrier(b);
+    }
+    for(auto & p : passes){
+        if(!p.alive)os << "  culled " << p.name << "\n";
+    }
+    for(auto & r : resources){
+        if(!r.transient)continue;
+        if(r.first == ~0u)os << "  transient " << r.name << " unused\n";
+        else os << "  transient " << r.name << " [" << r.first << "," << r.last << "] slot " << r.slot << "\n";
+    }
+    for(uint32_t i = 0;i < slots.size();++i){
+        os << "  slot " << i << ":" << slots[i].req.size << " bytes," << slots[i].members.size() << " images"
+           << (slots[i].lazy ? ",lazy" : "") << "\n";
+    }
+    return os.str();
+}
+
+std::function<void()> RenderGraph::release(){
+    std::vector<VkImage> imgs;
+    std::vector<VkImageView> views;
+    std::vector<Allocation> allocs;
+    for(auto & r : resources){
+        if(!r.transient)continue;
+        if(r.imgView)views.push_back(r.imgView);
+        if(r.img)imgs.push_back(r.img);
+    }
+    for(auto & s : slots){
+        if(s.alloc)allocs.push_back(s.alloc);
+    }
+    passes.clear();
+    resources.clear();
+    steps.clear();
+    slots.clear();
+    barriers = culled = 0;
+
+    return [dev = device,alloc = allocator,imgs = std::move(imgs),views = std::move(views),allocs = std::move(allocs)]() mutable {
+        for(auto v : views)vkDestroyImageView(dev,v,nullptr);
+        for(auto i : imgs)vkDestroyImage(dev,i,nullptr);
+        for(auto & a : allocs)alloc->free(a);
+    };
+}
@@ -0,0 +1,89 @@
+#include "simulation.h"
+#include <algorithm>
+#include <cmath>
+
+static constexpr float two_pi = 6.28318530718f;
+static constexpr float spin_accel = 1.0f; ///< radians per second² at full input
+
+SimState SimState::lerp(const SimState & a,const SimState & b,float t){
+    SimState s = b;
+    s.time = a.time + (b.time - a.time) * t;
+    // 角度是绕回的，走短的那边
+    float d = b.angle - a.angle;
+    if(d > two_pi / 2)d -= two_pi;
+    else if(d < -two_pi / 2)d += two_pi;
+    s.angle = a.angle + d * t;
+    s.spin = a.spin + (b.spin - a.spin) * t;
+    return s;
+}
+
+Simulation::~Simulation(){
+    stop();
+}
+
+void Simulation::start(double rate){
+    stop();
+    tickRate = rate;
+    quit = false;
+    tickCount = 0;
+    droppedMs = 0;
+    thread = std::thread([this]{ loop(); });
+}
+
+void Simulation::stop(){
+    if(!thread.joinable())return;
+    quit = true;
+    thread.join();
+}
+
+void Simulation::step(SimState & s,double dt,float input){
+    ++s.tick;
+    s.time += dt;
+    s.spin += input * spin_accel * dt;
+    s.angle = std::fmod(s.angle + s.spin * dt,two_pi);
+    if(s.angle < 0)s.angle += two_pi;
+}
+
+void Simulation::loop(){
+    using clock = std::chrono::steady_clock;
+    const auto dt = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / tickRate));
+    const double dtSec = 1.0 / tickRate;
+
+    SimState prev,curr;
+    auto next = clock::now();
+    while(!quit){
+        auto now = clock::now();
+        if(now < next){
+            std::this_thread::sleep_until(next);
+            continue;
+        }
+        // 落后了就连着补几步，补不上的时间直接丢掉，不然会越落越多
+        uint32_t steps = 0;
+        float input = spinInput.load(std::memory_order_relaxed);
+        while(next <= now && steps < max_catch_up){
+            prev = curr;
+            step(curr,dtSec,input);
+            next += dt;
+            ++steps;
+        }
+        if(next <= now){
+            droppedMs.store(droppedMs.load(std::memory_order_relaxed) +
+                            std::chrono::duration<double,std::milli>(now - next).count(),std::memory_order_relaxed);
+            next = now + dt;
+        }
+
+        SimSnapshot & snap = snapshots.back();
+        snap.prev = prev;
+        snap.curr = curr;
+        snap.stamp = next - dt;
+        snapshots.publish();
+        tickCount.fetch_add(steps,std::memory_order_relaxed);
+    }
+}
+
+SimState Simulation::sample(){
+    if(snapshots.update())latest = snapshots.front();
+    // 新的一步到了时刻stamp才开始显示，画面比模拟晚一步
+    double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - latest.stamp).count() * tickRate;
+    return SimState::lerp(latest.prev,latest.curr,(float)std::clamp(t,0.0,1.0));
+}
@@ -0,0 +1,92 @@
+#include "taskgraph.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+using namespace alib::g3;
+
+TaskGraph::TaskId TaskGraph::add(std::string name,std::function<void()> fn,std::vector<TaskId> deps,bool mainThread){
+    TaskId id = tasks.size();
+    for(auto d : deps)tasks[d].next.push_back(id);
+    tasks.push_back({std::move(name),std::move(fn),std::move(deps),{},mainThread});
+    return id;
+}
+
+void TaskGraph::run(){
+    using clock = std::chrono::steady_clock;
+    auto t0 = clock::now();
+    auto since = [t0]{
+        return std::chrono::duration<double,std::milli>(clock::now() - t0).count();
+    };
+
+    std::mutex m;
+    std::condition_variable cv;
+    std::vector<size_t> pending (tasks.size());
+    std::deque<TaskId> mainReady;
+    std::vector<std::thread> workers;
+    size_t done = 0;
+
+    for(TaskId i = 0;i < tasks.size();++i)pending[i] = tasks[i].deps.size();
+
+    // 以下两个lambda都要求持有锁
+    std::function<void(TaskId)> schedule;
+    auto complete = [&](TaskId id){
+        ++done;
+        for(auto n : tasks[id].next){
+            if(--pending[n] == 0)schedule(n);
+        }
+        cv.notify_all();
+    };
+    schedule = [&](TaskId id){
+        if(tasks[id].mainThread){
+            mainReady.push_back(id);
+            return;
+        }
+        workers.emplace_back([&,id]{
+            tasks[id].begin = since();
+            tasks[id].fn();
+            tasks[id].end = since();
+            std::lock_guard lock(m);
+            complete(id);
+        });
+    };
+
+    std::unique_lock lock(m);
+    for(TaskId i = 0;i < tasks.size();++i){
+        if(!pending[i])schedule(i);
+    }
+    while(done < tasks.size()){
+        cv.wait(lock,[&]{ return !mainReady.empty() || done == tasks.size(); });
+        while(!mainReady.empty()){
+            TaskId id = mainReady.front();
+            mainReady.pop_front();
+            lock.unlock();
+            tasks[id].begin = since();
+            tasks[id].fn();
+            tasks[id].end = since();
+            lock.lock();
+            complete(id);
+        }
+    }
+    lock.unlock();
+
+    for(auto & t : workers)t.join();
+    total = since();
+}
+
+void TaskGraph::report(LogFactory & lg) const{
+    std::vector<const Task*> order;
+    for(auto & t : tasks)order.push_back(&t);
+    std::sort(order.begin(),order.end(),[](const Task * a,const Task * b){ return a->begin < b->begin; });
+
+    double serial = 0;
+    for(auto t : order){
+        serial += t->end - t->begin;
+        lg(LOG_INFO) << "  " << t->name << (t->mainThread ? " [main]" : " [worker]") << " at "
+                     << t->begin << "ms,took " << (t->end - t->begin) << "ms" << endlog;
+    }
+    lg(LOG_INFO) << "startup graph:" << total << "ms wall," << serial << "ms if run in order" << endlog;
+}
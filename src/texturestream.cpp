@@ -0,0 +1,113 @@
+#include "texturestream.h"
+#include <cctype>
+#include <fstream>
+
+TextureStreamer::~TextureStreamer(){
+    stop();
+}
+
+void TextureStreamer::start(uint32_t count){
+    stop();
+    quit = false;
+    for(uint32_t i = 0;i < count;++i)threads.emplace_back([this]{ loop(); });
+}
+
+void TextureStreamer::stop(){
+    {
+        std::lock_guard guard(lock);
+        quit = true;
+    }
+    wake.notify_all();
+    for(auto & t : threads)t.join();
+    threads.clear();
+    jobs.clear();
+    ready.clear();
+}
+
+void TextureStreamer::request(std::string name,Decoder decode){
+    {
+        std::lock_guard guard(lock);
+        jobs.push_back({std::move(name),std::move(decode)});
+    }
+    wake.notify_one();
+}
+
+DecodedImage * TextureStreamer::front(){
+    std::lock_guard guard(lock);
+    // deque尾部插入不会让已有元素的引用失效
+    return ready.empty() ? nullptr : &ready.front();
+}
+
+void TextureStreamer::pop(){
+    {
+        std::lock_guard guard(lock);
+        if(!ready.empty())ready.pop_front();
+    }
+    wake.notify_one();
+}
+
+uint32_t TextureStreamer::depth(){
+    std::lock_guard guard(lock);
+    return jobs.size() + decoding + ready.size();
+}
+
+void TextureStreamer::loop(){
+    std::unique_lock guard(lock);
+    while(true){
+        // 解码中的也算进名额，队列满了就先不接活
+        wake.wait(guard,[this]{ return quit || (!jobs.empty() && ready.size() + decoding < max_ready); });
+        if(quit)return;
+        Job job = std::move(jobs.front());
+        jobs.pop_front();
+        ++decoding;
+        guard.unlock();
+
+        DecodedImage img;
+        img.name = job.name;
+        bool ok = job.decode(img) && img.width && img.height &&
+                  img.pixels.size() == (size_t)img.width * img.height * 4;
+
+        guard.lock();
+        --decoding;
+        if(ok)ready.push_back(std::move(img));
+        else ++failed;
+        // 失败的话名额空出来了，等名额的解码线程得醒过来接活
+        wake.notify_all();
+    }
+}
+
+// 跳过空白和#开头的注释，读一个十进制数
+static bool read_ppm_number(std::istream & in,uint32_t & out){
+    int c;
+    while((c = in.peek()) != EOF){
+        if(c == '#'){
+            std::string line;
+            std::getline(in,line);
+        }else if(std::isspace(c))in.get();
+        else break;
+    }
+    return (bool)(in >> out);
+}
+
+bool TextureStreamer::decode_ppm(const std::string & path,DecodedImage & out){
+    std::ifstream in (path,std::ios::binary);
+    char magic[2];
+    if(!in.read(magic,2) || magic[0] != 'P' || magic[1] != '6')return false;
+    uint32_t w,h,maxval;
+    if(!read_ppm_number(in,w) || !read_ppm_number(in,h) || !read_ppm_number(in,maxval))return false;
+    if(!w || !h || maxval != 255 || w > 16384 || h > 16384)return false;
+    in.get(); // 头后面正好一个空白
+
+    std::vector<uint8_t> rgb ((size_t)w * h * 3);
+    if(!in.read((char*)rgb.data(),rgb.size()))return false;
+    out.width = w;
+    out.height = h;
+    out.pixels.resize((size_t)w * h * 4);
+    for(size_t i = 0;i < (size_t)w * h;++i){
+        out.pixels[i * 4 + 0] = rgb[i * 3 + 0];
+        out.pixels[i * 4 + 1] = rgb[i * 3 + 1];
+        out.pixels[i * 4 + 2] = rgb[i * 3 + 2];
+        out.pixels[i * 4 + 3] = 255;
+    }
+    return true;
+}
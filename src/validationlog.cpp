@@ -0,0 +1,173 @@
+#include "validationlog.h"
+#include <chrono>
+#include <cstring>
+
+using namespace alib::g3;
+
+static uint32_t hash_name(const char * s){
+    uint32_t h = 2166136261u;
+    for(;s && *s;++s)h = (h ^ (uint8_t)*s) * 16777619u;
+    return h;
+}
+
+static int log_level(VkDebugUtilsMessageSeverityFlagBitsEXT severity){
+    switch(severity){
+    case VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT:return LOG_ERROR;
+    case VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT:return LOG_WARN;
+    default:return LOG_INFO;
+    }
+}
+
+ValidationLog::ValidationLog(){
+    for(uint32_t i = 0;i < queue_size;++i)queue[i].seq.store(i,std::memory_order_relaxed);
+}
+
+ValidationLog::~ValidationLog(){
+    stop();
+}
+
+void ValidationLog::start(LogFactory & log){
+    stop();
+    lg = &log;
+    quit = false;
+    thread = std::thread([this]{ loop(); });
+}
+
+void ValidationLog::stop(){
+    if(!thread.joinable())return;
+    quit = true;
+    thread.join();
+}
+
+void ValidationLog::fill(VkDebugUtilsMessengerCreateInfoEXT & info){
+    info = {};
+    info.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+    info.messageSeverity = severities;
+    info.messageType = types;
+    info.pfnUserCallback = callback;
+    info.pUserData = this;
+}
+
+VkDebugUtilsMessageSeverityFlagsEXT ValidationLog::parse_severity(std::string_view name){
+    VkDebugUtilsMessageSeverityFlagsEXT s = VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+    if(name == "error")return s;
+    s |= VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT;
+    if(name == "warning")return s;
+    s |= VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT;
+    if(name == "info")return s;
+    return s | VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT;
+}
+
+VkDebugUtilsMessageTypeFlagsEXT ValidationLog::parse_types(std::string_view names){
+    VkDebugUtilsMessageTypeFlagsEXT t = 0;
+    while(!names.empty()){
+        size_t comma = names.find(',');
+        std::string_view name = names.substr(0,comma);
+        if(name == "general")t |= VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT;
+        else if(name == "validation")t |= VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT;
+        else if(name == "performance")t |= VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+        names = comma == std::string_view::npos ? std::string_view() : names.substr(comma + 1);
+    }
+    return t;
+}
+
+VKAPI_ATTR VkBool32 VKAPI_CALL ValidationLog::callback(VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+    VkDebugUtilsMessageTypeFlagsEXT,const VkDebugUtilsMessengerCallbackDataEXT * data,void * user){
+    auto & self = *(ValidationLog*)user;
+    self.total.fetch_add(1,std::memory_order_relaxed);
+    // 有的消息(比如loader的)没有id，用名字或正文代替
+    uint32_t key = (uint32_t)data->messageIdNumber;
+    if(!key)key = hash_name(data->pMessageIdName ? data->pMessageIdName : data->pMessage);
+    if(!key)key = 1;
+
+    bool first = false;
+    uint32_t slot = self.count(key,first);
+    // 见过的只加计数，不拷贝也不排队；队列满了就放弃这次投递，下一次出现再试
+    if(first && !self.push(slot,key,severity,data->pMessageIdName,data->pMessage)){
+        if(slot < table_size)self.table[slot].delivered.store(false,std::memory_order_release);
+        self.dropped.fetch_add(1,std::memory_order_relaxed);
+    }
+    return VK_FALSE;
+}
+
+uint32_t ValidationLog::count(uint32_t key,bool & first){
+    uint32_t start = (key * 2654435761u) & (table_size - 1);
+    for(uint32_t i = 0;i < table_size;++i){
+        Counter & c = table[(start + i) & (table_size - 1)];
+        uint32_t k = c.key.load(std::memory_order_acquire);
+        if(!k && c.key.compare_exchange_strong(k,key,std::memory_order_acq_rel))k = key;
+        if(k != key)continue;
+        c.count.fetch_add(1,std::memory_order_relaxed);
+        // 只有一个线程能拿到投递权
+        first = !c.delivered.load(std::memory_order_acquire) && !c.delivered.exchange(true,std::memory_order_acq_rel);
+        return (start + i) & (table_size - 1);
+    }
+    // 表满了就不去重了
+    first = true;
+    return table_size;
+}
+
+bool ValidationLog::push(uint32_t slot,uint32_t key,VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+                         const char * name,const char * text){
+    uint32_t pos = head.load(std::memory_order_relaxed);
+    Message * m;
+    for(;;){
+        m = &queue[pos & (queue_size - 1)];
+        uint32_t seq = m->seq.load(std::memory_order_acquire);
+        int32_t diff = (int32_t)(seq - pos);
+        if(!diff){
+            if(head.compare_exchange_weak(pos,pos + 1,std::memory_order_relaxed))break;
+        }else if(diff < 0)return false;
+        else pos = head.load(std::memory_order_relaxed);
+    }
+    m->slot = slot;
+    m->key = key;
+    m->severity = severity;
+    std::strncpy(m->name,name ? name : "",max_name - 1);
+    m->name[max_name - 1] = 0;
+    std::strncpy(m->text,text ? text : "",max_text - 1);
+    m->text[max_text - 1] = 0;
+    m->seq.store(pos + 1,std::memory_order_release);
+    return true;
+}
+
+void ValidationLog::drain(){
+    for(;;){
+        Message & m = queue[tail & (queue_size - 1)];
+        if(m.seq.load(std::memory_order_acquire) != tail + 1)return;
+        (*lg)(log_level(m.severity)) << m.text << endlog;
+        if(m.slot < table_size)known[m.slot] = {m.name,m.severity,1};
+        m.seq.store(tail + queue_size,std::memory_order_release);
+        ++tail;
+    }
+}
+
+void ValidationLog::summary(bool final){
+    for(auto & [slot,k] : known){
+        uint64_t n = table[slot].count.load(std::memory_order_relaxed);
+        if(n <= k.reported && !final)continue;
+        if(final){
+            if(n > 1)(*lg)(log_level(k.severity)) << k.name << " x" << n << endlog;
+            continue;
+        }
+        (*lg)(log_level(k.severity)) << k.name << " repeated " << (n - k.reported) << " times," << n << " in total" << endlog;
+        k.reported = n;
+    }
+    if(final){
+        (*lg)(LOG_INFO) << "validation:" << total.load() << " messages," << known.size() << " distinct,"
+                        << dropped.load() << " dropped" << endlog;
+    }
+}
+
+void ValidationLog::loop(){
+    Clock clk;
+    Trigger summaryTrigger(clk,summaryInterval);
+    while(!quit){
+        std::this_thread::sleep_for(std::chrono::milliseconds(drain_ms));
+        drain();
+        // 重复的消息攒着，隔一段时间只报一次次数
+        if(summaryTrigger.test())summary(false);
+    }
+    drain();
+    summary(true);
+}
@@ -0,0 +1,17 @@
+#include "vkdispatch.h"
+
+void VkDispatch::loadInstance(VkInstance instance){
+#define VK_DISPATCH_LOAD(name) name = (PFN_##name)vkGetInstanceProcAddr(instance,#name);
+    VK_DISPATCH_INSTANCE(VK_DISPATCH_LOAD)
+#undef VK_DISPATCH_LOAD
+}
+
+uint32_t VkDispatch::loadDevice(VkDevice device){
+    uint32_t missing = 0;
+#define VK_DISPATCH_LOAD(name) \
+    name = (PFN_##name)vkGetDeviceProcAddr(device,#name); \
+    if(!name)++missing;
+    VK_DISPATCH_DEVICE(VK_DISPATCH_LOAD)
+#undef VK_DISPATCH_LOAD
+    return missing;
+}
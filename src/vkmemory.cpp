@@ -0,0 +1,403 @@
+#include "vkmemory.h"
+#include <algorithm>
+#include <bit>
+#include <string>
+
+using namespace alib::g3;
+
+static VkDeviceSize align_up(VkDeviceSize v,VkDeviceSize a){
+    return a ? (v + a - 1) / a * a : v;
+}
+
+static double to_mb(VkDeviceSize v){
+    return v / (1024.0 * 1024.0);
+}
+
+void MemoryAllocator::init(VkPhysicalDevice pdev,VkDevice dev,VkDeviceSize size){
+    physicalDevice = pdev;
+    device = dev;
+    blockSize = std::bit_floor(std::max(size,min_node));
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice,&memProps);
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physicalDevice,&props);
+    maxAllocations = props.limits.maxMemoryAllocationCount;
+    granularity = props.limits.bufferImageGranularity;
+
+    pools.clear();
+    pools.resize(memProps.memoryTypeCount);
+}
+
+void MemoryAllocator::destroy(){
+    std::lock_guard guard(lock);
+    for(auto & kinds : pools){
+        for(auto & pool : kinds){
+            for(auto & block : pool)releaseBlock(block);
+        }
+    }
+    pools.clear();
+}
+
+void MemoryAllocator::releaseBlock(Block & block){
+    if(!block.memory)return;
+    if(block.mapped)vkUnmapMemory(device,block.memory);
+    vkFreeMemory(device,block.memory,nullptr);
+    block = Block {};
+}
+
+std::optional<Allocation> MemoryAllocator::allocate(const VkMemoryRequirements & req,ResourceKind kind,
+                                                    VkMemoryPropertyFlags required,VkMemoryPropertyFlags preferred){
+    // 最小的节点都比granularity大的话，节点本身就把线性/非线性资源隔开了，不用分池
+    uint8_t pool = granularity > min_node ? (uint8_t)kind : 0;
+
+    std::lock_guard guard(lock);
+    // 先找带preferred的类型，再退回只满足required的
+    for(VkMemoryPropertyFlags want : {required | preferred,required}){
+        for(uint32_t i = 0;i < memProps.memoryTypeCount;++i){
+            if(!(req.memoryTypeBits & (1u << i)))continue;
+            if((memProps.memoryTypes[i].propertyFlags & want) != want)continue;
+            if(auto a = allocateFromType(i,pool,req.size,req.alignment))return a;
+        }
+        if(!preferred)break;
+    }
+    return std::nullopt;
+}
+
+bool MemoryAllocator::newBlock(uint32_t type,VkDeviceSize size,bool dedicated,Block & out){
+    VkMemoryAllocateInfo info {};
+    info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    info.allocationSize = size;
+    info.memoryTypeIndex = type;
+    if(vkAllocateMemory(device,&info,nullptr,&out.memory) != VK_SUCCESS){
+        out.memory = VK_NULL_HANDLE;
+        return false;
+    }
+    if(memProps.memoryTypes[type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT){
+        vkMapMemory(device,out.memory,0,VK_WHOLE_SIZE,0,&out.mapped);
+    }
+    out.size = size;
+    out.dedicated = dedicated;
+    if(!dedicated){
+        // 整块就是最高阶的一个节点
+        uint32_t orders = std::countr_zero(size / min_node) + 1;
+        out.freeNodes.resize(orders);
+        out.freeNodes.back().insert(0);
+    }
+    return true;
+}
+
+std::optional<Allocation> MemoryAllocator::allocateFromType(uint32_t type,uint8_t pidx,VkDeviceSize size,VkDeviceSize alignment){
+    Pool & pool = pools[type][pidx];
+    // 小堆(比如256MB的BAR)上块也相应缩小
+    VkDeviceSize heapSize = memProps.memoryHeaps[memProps.memoryTypes[type].heapIndex].size;
+    VkDeviceSize typeBlock = std::max(std::bit_floor(std::min(blockSize,heapSize / 8)),min_node);
+
+    auto slot = [&]{
+        // 复用被释放掉的块的位置，Allocation里记的下标不会变
+        uint32_t index = std::find_if(pool.begin(),pool.end(),[](const Block & b){ return !b.memory; }) - pool.begin();
+        if(index == pool.size())pool.emplace_back();
+        return index;
+    };
+
+    Allocation a;
+    a.size = size;
+    a.memoryType = type;
+    a.pool = pidx;
+
+    if(size > typeBlock / 2){
+        // 大资源单独分配，放进buddy块里最多要浪费一半
+        Block block;
+        if(!newBlock(type,size,true,block))return std::nullopt;
+        a.block = slot();
+        pool[a.block] = std::move(block);
+        a.dedicated = true;
+    }else{
+        // buddy节点的偏移天然按节点大小对齐
+        VkDeviceSize node = std::bit_ceil(std::max({size,alignment,min_node}));
+        a.order = std::countr_zero(node / min_node);
+
+        auto take = [&](Block & b,VkDeviceSize & offset){
+            uint32_t j = a.order;
+            while(j < b.freeNodes.size() && b.freeNodes[j].empty())++j;
+            if(j >= b.freeNodes.size())return false;
+            offset = *b.freeNodes[j].begin();
+            b.freeNodes[j].erase(b.freeNodes[j].begin());
+            // 一路劈开，右半边放回空闲表
+            while(j > a.order){
+                --j;
+                b.freeNodes[j].insert(offset + (min_node << j));
+            }
+            return true;
+        };
+
+        bool found = false;
+        for(uint32_t i = 0;i < pool.size() && !found;++i){
+            if(!pool[i].memory || pool[i].dedicated)continue;
+            if(take(pool[i],a.offset)){
+                a.block = i;
+                found = true;
+            }
+        }
+        if(!found){
+            Block block;
+            if(!newBlock(type,typeBlock,false,block))return std::nullopt;
+            a.block = slot();
+            pool[a.block] = std::move(block);
+            take(pool[a.block],a.offset);
+        }
+        pool[a.block].wasted += node - size;
+    }
+
+    Block & b = pool[a.block];
+    b.used += size;
+    ++b.allocations;
+    a.memory = b.memory;
+    a.mapped = b.mapped ? (char*)b.mapped + a.offset : nullptr;
+    return a;
+}
+
+void MemoryAllocator::free(Allocation & alloc){
+    if(!alloc)return;
+    std::lock_guard guard(lock);
+    Pool & pool = pools[alloc.memoryType][alloc.pool];
+    Block & block = pool[alloc.block];
+
+    if(alloc.dedicated){
+        releaseBlock(block);
+        alloc = Allocation {};
+        return;
+    }
+
+    VkDeviceSize offset = alloc.offset;
+    uint32_t order = alloc.order;
+    block.used -= alloc.size;
+    block.wasted -= (min_node << order) - alloc.size;
+    --block.allocations;
+    // 和空闲的兄弟节点合并，一直往上
+    while(order + 1 < block.freeNodes.size()){
+        VkDeviceSize buddy = offset ^ (min_node << order);
+        auto it = block.freeNodes[order].find(buddy);
+        if(it == block.freeNodes[order].end())break;
+        block.freeNodes[order].erase(it);
+        offset = std::min(offset,buddy);
+        ++order;
+    }
+    block.freeNodes[order].insert(offset);
+
+    // 空块只留一个，免得来回分配
+    if(!block.allocations){
+        size_t live = std::count_if(pool.begin(),pool.end(),[](const Block & b){ return b.memory && !b.dedicated; });
+        if(live > 1)releaseBlock(block);
+    }
+    alloc = Allocation {};
+}
+
+bool MemoryAllocator::createBuffer(VkDeviceSize size,VkBufferUsageFlags usage,VkMemoryPropertyFlags required,
+                                   VkMemoryPropertyFlags preferred,GpuBuffer & out){
+    VkBufferCreateInfo info {};
+    info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    info.size = size;
+    info.usage = usage;
+    info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if(vkCreateBuffer(device,&info,nullptr,&out.buffer) != VK_SUCCESS)return false;
+
+    VkMemoryRequirements req;
+    vkGetBufferMemoryRequirements(device,out.buffer,&req);
+    auto alloc = allocate(req,ResourceKind::Linear,required,preferred);
+    if(!alloc){
+        vkDestroyBuffer(device,out.buffer,nullptr);
+        out.buffer = VK_NULL_HANDLE;
+        return false;
+    }
+    out.alloc = *alloc;
+    out.size = size;
+    vkBindBufferMemory(device,out.buffer,out.alloc.memory,out.alloc.offset);
+    return true;
+}
+
+void MemoryAllocator::destroyBuffer(GpuBuffer & buf){
+    if(buf.buffer)vkDestroyBuffer(device,buf.buffer,nullptr);
+    free(buf.alloc);
+    buf = GpuBuffer {};
+}
+
+bool MemoryAllocator::createImage(const VkImageCreateInfo & info,VkMemoryPropertyFlags required,
+                                  VkMemoryPropertyFlags preferred,GpuImage & out){
+    if(vkCreateImage(device,&info,nullptr,&out.image) != VK_SUCCESS)return false;
+
+    VkMemoryRequirements req;
+    vkGetImageMemoryRequirements(device,out.image,&req);
+    ResourceKind kind = info.tiling == VK_IMAGE_TILING_OPTIMAL ? ResourceKind::Optimal : ResourceKind::Linear;
+    auto alloc = allocate(req,kind,required,preferred);
+    if(!alloc){
+        vkDestroyImage(device,out.image,nullptr);
+        out.image = VK_NULL_HANDLE;
+        return false;
+    }
+    out.alloc = *alloc;
+    vkBindImageMemory(device,out.image,out.alloc.memory,out.alloc.offset);
+    return true;
+}
+
+void MemoryAllocator::destroyImage(GpuImage & img){
+    if(img.image)vkDestroyImage(device,img.image,nullptr);
+    free(img.alloc);
+    img = GpuImage {};
+}
+
+bool MemoryAllocator::isCoherent(uint32_t memoryType) const{
+    return memProps.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+}
+
+size_t MemoryAllocator::blockCount() const{
+    return stats().blocks;
+}
+
+uint32_t MemoryAllocator::maxAllocationCount() const{
+    return maxAllocations;
+}
+
+static void accumulate(MemoryStats & s,VkDeviceSize size,VkDeviceSize used,VkDeviceSize wasted,
+                       VkDeviceSize largest,size_t allocations,bool dedicated){
+    ++s.blocks;
+    if(dedicated)++s.dedicated;
+    s.reserved += size;
+    s.used += used;
+    s.wasted += wasted;
+    s.free += size - used - wasted;
+    s.largestFree = std::max(s.largestFree,largest);
+    s.allocations += allocations;
+}
+
+MemoryStats MemoryAllocator::stats() const{
+    std::lock_guard guard(lock);
+    MemoryStats s;
+    for(auto & kinds : pools){
+        for(auto & pool : kinds){
+            for(auto & b : pool){
+                if(!b.memory)continue;
+                VkDeviceSize largest = 0;
+                for(size_t j = b.freeNodes.size();j-- > 0;){
+                    if(!b.freeNodes[j].empty()){
+                        largest = min_node << j;
+                        break;
+                    }
+                }
+                accumulate(s,b.size,b.used,b.wasted,largest,b.allocations,b.dedicated);
+            }
+        }
+    }
+    return s;
+}
+
+void MemoryAllocator::report(LogFactory & lg) const{
+    std::unique_lock guard(lock);
+    for(uint32_t t = 0;t < pools.size();++t){
+        MemoryStats s;
+        for(auto & pool : pools[t]){
+            for(auto & b : pool){
+                if(b.memory)accumulate(s,b.size,b.used,b.wasted,0,b.allocations,b.dedicated);
+            }
+        }
+        if(!s.blocks)continue;
+
+        VkMemoryPropertyFlags f = memProps.memoryTypes[t].propertyFlags;
+        std::string flags;
+        if(f & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)flags += " device-local";
+        if(f & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)flags += " host-visible";
+        if(f & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)flags += " coherent";
+        if(f & VK_MEMORY_PROPERTY_HOST_CACHED_BIT)flags += " cached";
+        lg(LOG_INFO) << "  memory type " << t << " (" << flags << " ):" << s.blocks << " blocks (" << s.dedicated
+                     << " dedicated)," << s.allocations << " allocations," << to_mb(s.reserved) << "MB reserved,"
+                     << to_mb(s.used) << "MB used," << to_mb(s.wasted) << "MB wasted" << endlog;
+    }
+    guard.unlock();
+
+    MemoryStats s = stats();
+    lg(LOG_INFO) << "memory:" << to_mb(s.used) << "MB used," << to_mb(s.wasted) << "MB wasted," << s.blocks << "/"
+                 << maxAllocations << " blocks,fragmentation " << (s.fragmentation() * 100) << "%" << endlog;
+}
+
+bool LinearPool::init(MemoryAllocator & allocator,VkDeviceSize frameSize,uint32_t frames,VkBufferUsageFlags usage){
+    regionSize = align_up(frameSize,region_alignment);
+    return allocator.createBuffer(regionSize * frames,usage,
+                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,buf);
+}
+
+void LinearPool::destroy(MemoryAllocator & allocator){
+    allocator.destroyBuffer(buf);
+}
+
+void LinearPool::beginFrame(uint32_t frame){
+    peakUsed = std::max(peakUsed,head.load(std::memory_order_relaxed));
+    regionBase = regionSize * frame;
+    head.store(0,std::memory_order_relaxed);
+}
+
+std::optional<BufferSlice> LinearPool::allocate(VkDeviceSize size,VkDeviceSize alignment){
+    VkDeviceSize cur = head.load(std::memory_order_relaxed);
+    VkDeviceSize start;
+    do{
+        start = align_up(cur,alignment);
+        if(start + size > regionSize)return std::nullopt;
+    }while(!head.compare_exchange_weak(cur,start + size,std::memory_order_relaxed));
+
+    BufferSlice s;
+    s.buffer = buf.buffer;
+    s.offset = regionBase + start;
+    s.size = size;
+    s.mapped = (char*)buf.alloc.mapped + regionBase + start;
+    return s;
+}
+
+bool StagingRing::init(MemoryAllocator & allocator,VkDeviceSize size){
+    head = tail = used = 0;
+    spans.clear();
+    return allocator.createBuffer(size,VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,0,buf);
+}
+
+void StagingRing::destroy(MemoryAllocator & allocator){
+    allocator.destroyBuffer(buf);
+    spans.clear();
+}
+
+std::optional<BufferSlice> StagingRing::allocate(VkDeviceSize size,VkDeviceSize alignment,uint64_t serial){
+    if(!used)head = tail = 0;
+    else if(head == tail)return std::nullopt;
+    VkDeviceSize start = align_up(head,alignment);
+    VkDeviceSize bytes;
+    if(!used || head > tail){
+        if(start + size <= buf.size)bytes = start + size - head;
+        else if(used && size <= tail){
+            // 尾部放不下就跳过剩下的一截，从头开始，跳过的部分算在这次分配里
+            bytes = buf.size - head + size;
+            start = 0;
+        }else return std::nullopt;
+    }else if(start + size <= tail)bytes = start + size - head;
+    else return std::nullopt;
+
+    VkDeviceSize end = start + size;
+    if(!spans.empty() && spans.back().serial == serial){
+        spans.back().end = end;
+        spans.back().bytes += bytes;
+    }else spans.push_back({serial,end,bytes});
+    used += bytes;
+    head = end == buf.size ? 0 : end;
+
+    BufferSlice s;
+    s.buffer = buf.buffer;
+    s.offset = start;
+    s.size = size;
+    s.mapped = (char*)buf.alloc.mapped + start;
+    return s;
+}
+
+void StagingRing::release(uint64_t completed){
+    while(!spans.empty() && spans.front().serial <= completed){
+        tail = spans.front().end == buf.size ? 0 : spans.front().end;
+        used -= spans.front().bytes;
+        spans.pop_front();
+    }
+}
@@ -2,6 +2,8 @@
 #include <vector>
 #include <algorithm>
 #include <cstring>
+#include <fstream>
+#include <string>
 #include <GLFW/glfw3.h>
 
 static bool operator==(const VkLayerProperties & in,const char * d){
@@ -12,6 +14,19 @@ static bool operator==(const VkExtensionProperties & in,const char * d){
     return !std::strcmp(in.extensionName,d);
 }
 
+std::vector<char> read_file(std::string_view fp){
+    std::ifstream ifs(std::string(fp),std::ios::ate | std::ios::binary);
+    if(!ifs.is_open()){
+        return {};
+    }
+    size_t fsize = ifs.tellg();
+    std::vector<char> buf (fsize,0);
+    ifs.seekg(0);
+    ifs.read(buf.data(),fsize);
+    ifs.close();
+    return buf;
+}
+
 VkShaderModule create_shader_module(VkDevice dev,const std::vector<char>& code){
     VkShaderModuleCreateInfo info {};
     info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
@@ -23,6 +38,46 @@ VkShaderModule create_shader_module(VkDevice dev,const std::vector<char>& code){
     return mod;
 }
 
+VkImageView create_image_view(VkDevice dev,VkImage image,VkFormat format,uint32_t mipLevels){
+    VkImageViewCreateInfo createInfo {};
+    createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    createInfo.image = image;
+    createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    createInfo.format = format;
+    createInfo.components = {
+        VK_COMPONENT_SWIZZLE_IDENTITY,
+        VK_COMPONENT_SWIZZLE_IDENTITY,
+        VK_COMPONENT_SWIZZLE_IDENTITY,
+        VK_COMPONENT_SWIZZLE_IDENTITY
+    };
+    createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    createInfo.subresourceRange.baseMipLevel = 0;
+    createInfo.subresourceRange.levelCount = mipLevels;
+    createInfo.subresourceRange.baseArrayLayer = 0;
+    createInfo.subresourceRange.layerCount = 1;
+
+    VkImageView view;
+    if(vkCreateImageView(dev,&createInfo,nullptr,&view) != VK_SUCCESS)return VK_NULL_HANDLE;
+    return view;
+}
+
+uint32_t mip_level_count(uint32_t width,uint32_t height){
+    uint32_t levels = 1;
+    for(uint32_t s = std::max(width,height);s > 1;s >>= 1)++levels;
+    return levels;
+}
+
+bool check_pipeline_cache_header(std::span<const char> data,const VkPhysicalDeviceProperties & props){
+    VkPipelineCacheHeaderVersionOne header;
+    if(data.size() < sizeof(header))return false;
+    std::memcpy(&header,data.data(),sizeof(header));
+
+    if(header.headerSize < sizeof(header) || header.headerSize > data.size())return false;
+    if(header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE)return false;
+    if(header.vendorID != props.vendorID || header.deviceID != props.deviceID)return false;
+    return !std::memcmp(header.pipelineCacheUUID,props.pipelineCacheUUID,VK_UUID_SIZE);
+}
+
 VkExtent2D choose_swap_extent(const VkSurfaceCapabilitiesKHR & cap,GLFWwindow * window){
     if(cap.currentExtent.width != UINT32_MAX){
         return cap.currentExtent;
@@ -36,12 +91,30 @@ VkExtent2D choose_swap_extent(const VkSurfaceCapabilitiesKHR & cap,GLFWwindow *
     }
 }
 
-VkPresentModeKHR choose_swapchains_present_mode(std::span<VkPresentModeKHR> modes){
+const char * frame_pacing_name(FramePacing pacing){
+    switch(pacing){
+    case FramePacing::LowLatency:return "low-latency";
+    case FramePacing::Throughput:return "throughput";
+    case FramePacing::Capped:return "capped";
+    }
+    return "?";
+}
+
+VkPresentModeKHR choose_swapchains_present_mode(std::span<VkPresentModeKHR> modes,FramePacing pacing){
+    // FIFO一定支持；低延迟模式下不渲染会被丢掉的帧
+    if(pacing == FramePacing::LowLatency)return VK_PRESENT_MODE_FIFO_KHR;
     if(std::find(modes.begin(),modes.end(),VK_PRESENT_MODE_MAILBOX_KHR) != modes.end())
         return VK_PRESENT_MODE_MAILBOX_KHR;
     return VK_PRESENT_MODE_FIFO_KHR;
 }
 
+uint32_t choose_swapchain_image_count(const VkSurfaceCapabilitiesKHR & cap,FramePacing pacing){
+    // 少一张图就少排一帧的队
+    uint32_t count = pacing == FramePacing::LowLatency ? std::max(cap.minImageCount,2u) : cap.minImageCount + 1;
+    if(cap.maxImageCount > 0 && count > cap.maxImageCount)count = cap.maxImageCount;
+    return count;
+}
+
 VkSurfaceFormatKHR choose_surface_format(std::span<VkSurfaceFormatKHR> formats){
     if(formats.empty())return {(VkFormat)0,(VkColorSpaceKHR)0};
     for(auto & fmt : formats){
@@ -86,16 +159,27 @@ bool check_validation_layer_support(std::span<const char *> data){
     return true;
 }
 
-std::vector<const char *> get_required_extensions(bool enableValidate){
-    uint32_t ge_c = 0;
-    const char ** ge_v = glfwGetRequiredInstanceExtensions(&ge_c);
-
-    std::vector<const char*> exts (ge_v,ge_v + ge_c);
+std::vector<const char *> get_required_extensions(bool enableValidate,bool windowed){
+    std::vector<const char*> exts;
+    if(windowed){
+        uint32_t ge_c = 0;
+        const char ** ge_v = glfwGetRequiredInstanceExtensions(&ge_c);
+        exts.assign(ge_v,ge_v + ge_c);
+    }
 
     if(enableValidate){
         exts.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
     }
 
+    // 查描述符索引的特性要用，1.0的实例没有就算了
+    uint32_t ext_c = 0;
+    vkEnumerateInstanceExtensionProperties(nullptr,&ext_c,nullptr);
+    std::vector<VkExtensionProperties> available (ext_c);
+    vkEnumerateInstanceExtensionProperties(nullptr,&ext_c,available.data());
+    if(std::find(available.begin(),available.end(),VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) != available.end()){
+        exts.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+    }
+
     return exts;
 }
 
@@ -119,19 +203,51 @@ QueueFamilyIndices find_queue_family(VkPhysicalDevice dev,VkSurfaceKHR surface){
     vkGetPhysicalDeviceQueueFamilyProperties(dev,&qe_c,nullptr);
     std::vector<VkQueueFamilyProperties> qeFamilies (qe_c);
     vkGetPhysicalDeviceQueueFamilyProperties(dev,&qe_c,qeFamilies.data());
-    int i = -1;
-    for(auto & q : qeFamilies){
-        ++i;
-        if(q.queueFlags & VK_QUEUE_GRAPHICS_BIT){
-            ind.graphicsFamily = i; 
-        }
+    ind.queueCounts.resize(qe_c);
+
+    bool graphicsPresents = false;
+    std::optional<uint32_t> anyCompute;
+    for(uint32_t i = 0;i < qe_c;++i){
+        auto & q = qeFamilies[i];
+        ind.queueCounts[i] = q.queueCount;
+        bool graphics = q.queueFlags & VK_QUEUE_GRAPHICS_BIT;
+        bool compute = q.queueFlags & VK_QUEUE_COMPUTE_BIT;
+        bool transfer = q.queueFlags & VK_QUEUE_TRANSFER_BIT;
 
         VkBool32 presentSupport = false;
-        vkGetPhysicalDeviceSurfaceSupportKHR(dev,i,surface,&presentSupport);
-        if(presentSupport){
-            ind.presentFamily = i;
+        if(surface != VK_NULL_HANDLE)vkGetPhysicalDeviceSurfaceSupportKHR(dev,i,surface,&presentSupport);
+
+        // 取第一个，不过能present的图形族优先
+        if(graphics && (!ind.graphicsFamily || (presentSupport && !graphicsPresents))){
+            ind.graphicsFamily = i;
+            graphicsPresents = presentSupport;
         }
+        if(presentSupport && !ind.presentFamily)ind.presentFamily = i;
+        if(compute && !anyCompute)anyCompute = i;
+        if(compute && !graphics && !ind.computeFamily)ind.computeFamily = i;
+        if(transfer && !graphics && !compute && !ind.transferFamily)ind.transferFamily = i;
+    }
+    if(graphicsPresents)ind.presentFamily = ind.graphicsFamily;
+    // headless,nothing to present,reuse the graphics queue
+    if(surface == VK_NULL_HANDLE)ind.presentFamily = ind.graphicsFamily;
+
+    // 没有专用的族就和图形队列共用
+    if(!ind.transferFamily)ind.transferFamily = ind.computeFamily ? ind.computeFamily : ind.graphicsFamily;
+    if(!ind.computeFamily && ind.graphicsFamily){
+        bool graphicsComputes = qeFamilies[*ind.graphicsFamily].queueFlags & VK_QUEUE_COMPUTE_BIT;
+        ind.computeFamily = graphicsComputes ? ind.graphicsFamily : anyCompute;
     }
 
     return ind;
+}
+
+std::optional<uint32_t> find_memory_type(VkPhysicalDevice dev,uint32_t typeBits,VkMemoryPropertyFlags props){
+    VkPhysicalDeviceMemoryProperties memProps;
+    vkGetPhysicalDeviceMemoryProperties(dev,&memProps);
+    for(uint32_t i = 0;i < memProps.memoryTypeCount;++i){
+        if((typeBits & (1u << i)) && (memProps.memoryTypes[i].propertyFlags & props) == props){
+            return i;
+        }
+    }
+    return std::nullopt;
 }
\ No newline at end of file
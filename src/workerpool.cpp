@@ -0,0 +1,60 @@
+#include "workerpool.h"
+
+WorkerPool::~WorkerPool(){
+    stop();
+}
+
+void WorkerPool::start(uint32_t count){
+    stop();
+    // 线程启动前就定好它见过的代数，否则紧接着的run()可能在它拿到锁之前就加了代数，它会一直等下去
+    uint64_t gen;
+    {
+        std::lock_guard lock(m);
+        quit = false;
+        gen = generation;
+    }
+    for(uint32_t i = 1;i < count;++i){
+        threads.emplace_back([this,i,gen]{ loop(i,gen); });
+    }
+}
+
+void WorkerPool::stop(){
+    {
+        std::lock_guard lock(m);
+        quit = true;
+    }
+    wake.notify_all();
+    for(auto & t : threads)t.join();
+    threads.clear();
+}
+
+void WorkerPool::loop(uint32_t index,uint64_t seen){
+    std::unique_lock lock(m);
+    while(true){
+        wake.wait(lock,[&]{ return quit || generation != seen; });
+        if(quit)return;
+        seen = generation;
+        auto fn = job;
+        lock.unlock();
+        (*fn)(index);
+        lock.lock();
+        if(--pending == 0)done.notify_one();
+    }
+}
+
+void WorkerPool::run(const std::function<void(uint32_t)> & fn){
+    if(threads.empty()){
+        fn(0);
+        return;
+    }
+    {
+        std::lock_guard lock(m);
+        job = &fn;
+        pending = threads.size();
+        ++generation;
+    }
+    wake.notify_all();
+    fn(0);
+    std::unique_lock lock(m);
+    done.wait(lock,[&]{ return pending == 0; });
+}
@@ -0,0 +1,176 @@
+#include "descriptors.h"
+#include <cstdio>
+#include <set>
+#include <vector>
+
+// 跑在任意Vulkan设备上，CI里用lavapipe(llvmpipe)；找不到设备就跳过
+static int failures = 0;
+
+#define CHECK(cond) do{ \
+    if(!(cond)){ \
+        std::printf("%s:%d: CHECK(%s) failed\n",__FILE__,__LINE__,#cond); \
+        ++failures; \
+    } \
+}while(0)
+
+static constexpr int skip_code = 77;
+
+struct Context{
+    VkInstance instance { VK_NULL_HANDLE };
+    VkPhysicalDevice physicalDevice { VK_NULL_HANDLE };
+    VkDevice device { VK_NULL_HANDLE };
+    VkPhysicalDeviceProperties props {};
+};
+
+static bool create_context(Context & ctx){
+    VkApplicationInfo app {};
+    app.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    app.pApplicationName = "test_descriptors";
+    app.apiVersion = VK_API_VERSION_1_0;
+    VkInstanceCreateInfo info {};
+    info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    info.pApplicationInfo = &app;
+    if(vkCreateInstance(&info,nullptr,&ctx.instance) != VK_SUCCESS)return false;
+
+    uint32_t count = 0;
+    vkEnumeratePhysicalDevices(ctx.instance,&count,nullptr);
+    if(!count)return false;
+    std::vector<VkPhysicalDevice> devices (count);
+    vkEnumeratePhysicalDevices(ctx.instance,&count,devices.data());
+    // 有软件实现就用它，结果和具体显卡无关
+    ctx.physicalDevice = devices[0];
+    for(auto d : devices){
+        VkPhysicalDeviceProperties p;
+        vkGetPhysicalDeviceProperties(d,&p);
+        if(p.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU)ctx.physicalDevice = d;
+    }
+    vkGetPhysicalDeviceProperties(ctx.physicalDevice,&ctx.props);
+
+    float priority = 1.0f;
+    VkDeviceQueueCreateInfo queue {};
+    queue.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queue.queueFamilyIndex = 0;
+    queue.queueCount = 1;
+    queue.pQueuePriorities = &priority;
+    VkDeviceCreateInfo devInfo {};
+    devInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    devInfo.queueCreateInfoCount = 1;
+    devInfo.pQueueCreateInfos = &queue;
+    return vkCreateDevice(ctx.physicalDevice,&devInfo,nullptr,&ctx.device) == VK_SUCCESS;
+}
+
+static void destroy_context(Context & ctx){
+    if(ctx.device)vkDestroyDevice(ctx.device,nullptr);
+    if(ctx.instance)vkDestroyInstance(ctx.instance,nullptr);
+}
+
+/// count bindings of one type,each holding one descriptor
+static VkDescriptorSetLayout make_layout(DescriptorAllocator & descriptors,VkDescriptorType type,uint32_t count){
+    std::vector<VkDescriptorSetLayoutBinding> bindings (count);
+    for(uint32_t i = 0;i < count;++i){
+        bindings[i].binding = i;
+        bindings[i].descriptorType = type;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+    VkDescriptorSetLayoutCreateInfo info {};
+    info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    info.bindingCount = count;
+    info.pBindings = bindings.data();
+    return descriptors.layout(info);
+}
+
+static void test_layout_cache(const Context & ctx){
+    DescriptorAllocator descriptors;
+    descriptors.init(ctx.device,1,1);
+    VkDescriptorSetLayout a = make_layout(descriptors,VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,1);
+    VkDescriptorSetLayout b = make_layout(descriptors,VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,1);
+    VkDescriptorSetLayout c = make_layout(descriptors,VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,1);
+    CHECK(a && c);
+    CHECK(a == b);
+    CHECK(a != c);
+    descriptors.destroy();
+}
+
+/// allocate from one chain until it moves on to a second pool,returns how many sets the first one held
+static uint32_t fill_first_pool(DescriptorAllocator & descriptors,uint32_t frame,uint32_t thread,
+                                VkDescriptorSetLayout layout,std::set<VkDescriptorSet> & sets){
+    for(uint32_t n = 0;n <= DescriptorAllocator::min_pool_sets;++n){
+        VkDescriptorSet set = descriptors.allocate(frame,thread,layout);
+        CHECK(set != VK_NULL_HANDLE);
+        if(!set)return n;
+        sets.insert(set);
+        if(descriptors.chainLength(frame,thread) > 1)return n;
+    }
+    return DescriptorAllocator::min_pool_sets + 1;
+}
+
+static void test_chain_growth(const Context & ctx){
+    const uint32_t frames = 2,threads = 2;
+    DescriptorAllocator descriptors;
+    descriptors.init(ctx.device,frames,threads);
+    VkDescriptorSetLayout uniform = make_layout(descriptors,VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,1);
+
+    // 第一个池子正好放min_pool_sets个，再要一个链就得长出第二个
+    std::set<VkDescriptorSet> sets;
+    uint32_t held = fill_first_pool(descriptors,0,0,uniform,sets);
+    CHECK(held == DescriptorAllocator::min_pool_sets);
+    CHECK(descriptors.chainLength(0,0) == 2);
+    CHECK(descriptors.poolSwitches() == 1);
+    CHECK(sets.size() == held + 1);
+    // 别的帧和线程的链不受影响
+    CHECK(descriptors.chainLength(0,1) == 0);
+    CHECK(descriptors.chainLength(1,0) == 0);
+
+    // 每个set要5个storage buffer，池子按每set 4个配，描述符先用完：
+    // 驱动报VK_ERROR_OUT_OF_POOL_MEMORY，链也要长出下一个池子
+    VkDescriptorSetLayout storage = make_layout(descriptors,VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,5);
+    std::set<VkDescriptorSet> storageSets;
+    held = fill_first_pool(descriptors,1,1,storage,storageSets);
+    CHECK(held > 0 && held <= DescriptorAllocator::min_pool_sets);
+    CHECK(descriptors.chainLength(1,1) == 2);
+    if(held < DescriptorAllocator::min_pool_sets)std::printf("storage sets:pool ran out of descriptors after %u sets\n",held);
+    else std::printf("storage sets:driver doesn't report exhausted descriptors,moved on at maxSets\n");
+
+    // 帧槽回来了：整条链重置，同样多的分配全落在原来的池子里
+    uint64_t created = descriptors.poolCount();
+    uint64_t resets = descriptors.poolResets();
+    descriptors.beginFrame(0,frames + 1,1);
+    CHECK(descriptors.poolResets() == resets + 2);
+    sets.clear();
+    held = fill_first_pool(descriptors,0,0,uniform,sets);
+    CHECK(held == DescriptorAllocator::min_pool_sets);
+    CHECK(descriptors.chainLength(0,0) == 2);
+    CHECK(descriptors.poolCount() == created);
+    // 只重置了这一帧的链
+    CHECK(descriptors.chainLength(1,1) == 2);
+
+    // 没用到的池子不重置
+    resets = descriptors.poolResets();
+    descriptors.beginFrame(0,frames + 2,2);
+    CHECK(descriptors.poolResets() == resets + 2);
+    descriptors.beginFrame(0,frames + 3,3);
+    CHECK(descriptors.poolResets() == resets + 3);
+    CHECK(descriptors.chainLength(0,0) == 2);
+    CHECK(descriptors.poolCount() == created);
+
+    descriptors.destroy();
+}
+
+int main(){
+    Context ctx;
+    if(!create_context(ctx)){
+        std::printf("no Vulkan device,skipped\n");
+        destroy_context(ctx);
+        return skip_code;
+    }
+    std::printf("device:%s\n",ctx.props.deviceName);
+
+    test_layout_cache(ctx);
+    test_chain_growth(ctx);
+
+    destroy_context(ctx);
+    if(failures)std::printf("%d checks failed\n",failures);
+    else std::printf("all checks passed\n");
+    return failures ? 1 : 0;
+}
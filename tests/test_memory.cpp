@@ -0,0 +1,280 @@
+#include "vkmemory.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <random>
+
+// 跑在任意Vulkan设备上，CI里用lavapipe(llvmpipe)；找不到设备就跳过
+static int failures = 0;
+
+#define CHECK(cond) do{ \
+    if(!(cond)){ \
+        std::printf("%s:%d: CHECK(%s) failed\n",__FILE__,__LINE__,#cond); \
+        ++failures; \
+    } \
+}while(0)
+
+static constexpr int skip_code = 77;
+
+struct Context{
+    VkInstance instance { VK_NULL_HANDLE };
+    VkPhysicalDevice physicalDevice { VK_NULL_HANDLE };
+    VkDevice device { VK_NULL_HANDLE };
+    VkPhysicalDeviceProperties props {};
+};
+
+static bool create_context(Context & ctx){
+    VkApplicationInfo app {};
+    app.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    app.pApplicationName = "test_memory";
+    app.apiVersion = VK_API_VERSION_1_0;
+    VkInstanceCreateInfo info {};
+    info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    info.pApplicationInfo = &app;
+    if(vkCreateInstance(&info,nullptr,&ctx.instance) != VK_SUCCESS)return false;
+
+    uint32_t count = 0;
+    vkEnumeratePhysicalDevices(ctx.instance,&count,nullptr);
+    if(!count)return false;
+    std::vector<VkPhysicalDevice> devices (count);
+    vkEnumeratePhysicalDevices(ctx.instance,&count,devices.data());
+    // 有软件实现就用它，结果和具体显卡无关
+    ctx.physicalDevice = devices[0];
+    for(auto d : devices){
+        VkPhysicalDeviceProperties p;
+        vkGetPhysicalDeviceProperties(d,&p);
+        if(p.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU)ctx.physicalDevice = d;
+    }
+    vkGetPhysicalDeviceProperties(ctx.physicalDevice,&ctx.props);
+
+    float priority = 1.0f;
+    VkDeviceQueueCreateInfo queue {};
+    queue.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queue.queueFamilyIndex = 0;
+    queue.queueCount = 1;
+    queue.pQueuePriorities = &priority;
+    VkDeviceCreateInfo devInfo {};
+    devInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    devInfo.queueCreateInfoCount = 1;
+    devInfo.pQueueCreateInfos = &queue;
+    return vkCreateDevice(ctx.physicalDevice,&devInfo,nullptr,&ctx.device) == VK_SUCCESS;
+}
+
+static void destroy_context(Context & ctx){
+    if(ctx.device)vkDestroyDevice(ctx.device,nullptr);
+    if(ctx.instance)vkDestroyInstance(ctx.instance,nullptr);
+}
+
+static VkMemoryRequirements requirements(VkDeviceSize size,VkDeviceSize alignment){
+    VkMemoryRequirements req {};
+    req.size = size;
+    req.alignment = alignment;
+    req.memoryTypeBits = ~0u;
+    return req;
+}
+
+/// live allocations must not overlap,counted with the buddy node they occupy
+static bool overlapping(const std::vector<Allocation> & allocs){
+    std::map<VkDeviceMemory,std::vector<std::pair<VkDeviceSize,VkDeviceSize>>> ranges;
+    for(auto & a : allocs){
+        VkDeviceSize size = a.dedicated ? a.size : MemoryAllocator::min_node << a.order;
+        ranges[a.memory].push_back({a.offset,a.offset + size});
+    }
+    for(auto & [mem,r] : ranges){
+        std::sort(r.begin(),r.end());
+        for(size_t i = 1;i < r.size();++i){
+            if(r[i].first < r[i - 1].second)return true;
+        }
+    }
+    return false;
+}
+
+static void check_empty(MemoryAllocator & allocator){
+    MemoryStats s = allocator.stats();
+    CHECK(s.allocations == 0);
+    CHECK(s.used == 0);
+    CHECK(s.wasted == 0);
+    CHECK(s.dedicated == 0);
+    // 每个池只留一个空块，而且它已经合并回一整个节点
+    CHECK(s.blocks == 1);
+    CHECK(s.free == s.reserved);
+    CHECK(s.largestFree == s.reserved);
+    CHECK(s.fragmentation() == 0.0);
+}
+
+static void test_buddy(const Context & ctx){
+    MemoryAllocator allocator;
+    allocator.init(ctx.physicalDevice,ctx.device,1ull << 20);
+
+    std::mt19937 rng (1234);
+    std::vector<Allocation> allocs;
+    VkDeviceSize requested = 0;
+    for(int i = 0;i < 2000;++i){
+        VkDeviceSize size = 1 + rng() % 20000;
+        VkDeviceSize alignment = 1ull << (rng() % 10);
+        auto a = allocator.allocate(requirements(size,alignment),ResourceKind::Linear,VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+        CHECK(a.has_value());
+        if(!a)continue;
+        CHECK(a->offset % alignment == 0);
+        CHECK(a->size == size);
+        CHECK(a->mapped != nullptr);
+        requested += size;
+        allocs.push_back(*a);
+        // 随机释放一部分，让拆开的节点和合并交替发生
+        if(rng() % 3 == 0){
+            size_t k = rng() % allocs.size();
+            requested -= allocs[k].size;
+            allocator.free(allocs[k]);
+            allocs[k] = allocs.back();
+            allocs.pop_back();
+        }
+    }
+    CHECK(!overlapping(allocs));
+
+    MemoryStats s = allocator.stats();
+    CHECK(s.allocations == allocs.size());
+    CHECK(s.used == requested);
+    CHECK(s.used + s.wasted + s.free == s.reserved);
+    CHECK(s.largestFree <= s.free);
+
+    std::shuffle(allocs.begin(),allocs.end(),rng);
+    for(auto & a : allocs)allocator.free(a);
+    check_empty(allocator);
+    allocator.destroy();
+}
+
+static void test_fragmentation(const Context & ctx){
+    const VkDeviceSize block = 1ull << 20;
+    MemoryAllocator allocator;
+    allocator.init(ctx.physicalDevice,ctx.device,block);
+
+    // 用最小节点填满一整块
+    std::vector<Allocation> allocs;
+    for(VkDeviceSize i = 0;i < block / MemoryAllocator::min_node;++i){
+        auto a = allocator.allocate(requirements(MemoryAllocator::min_node,1),ResourceKind::Linear,
+                                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+        CHECK(a.has_value());
+        if(a)allocs.push_back(*a);
+    }
+    MemoryStats s = allocator.stats();
+    CHECK(s.blocks == 1);
+    CHECK(s.free == 0);
+    CHECK(s.fragmentation() == 0.0);
+
+    // 隔一个释放一个，空出一半，但没有两个空闲的兄弟节点能合并
+    std::sort(allocs.begin(),allocs.end(),[](const Allocation & a,const Allocation & b){ return a.offset < b.offset; });
+    for(size_t i = 0;i < allocs.size();i += 2)allocator.free(allocs[i]);
+    s = allocator.stats();
+    CHECK(s.free == block / 2);
+    CHECK(s.largestFree == MemoryAllocator::min_node);
+    CHECK(s.fragmentation() == 1.0 - (double)MemoryAllocator::min_node / (block / 2));
+
+    for(size_t i = 1;i < allocs.size();i += 2)allocator.free(allocs[i]);
+    check_empty(allocator);
+    allocator.destroy();
+}
+
+static void test_granularity(const Context & ctx){
+    VkDeviceSize granularity = std::max<VkDeviceSize>(ctx.props.limits.bufferImageGranularity,1);
+    MemoryAllocator allocator;
+    allocator.init(ctx.physicalDevice,ctx.device,1ull << 20);
+
+    std::vector<Allocation> linear,optimal;
+    for(int i = 0;i < 200;++i){
+        VkDeviceSize size = 64 + (i * 97) % 3000;
+        auto l = allocator.allocate(requirements(size,1),ResourceKind::Linear,0);
+        auto o = allocator.allocate(requirements(size,1),ResourceKind::Optimal,0);
+        CHECK(l && o);
+        if(l)linear.push_back(*l);
+        if(o)optimal.push_back(*o);
+    }
+    // 线性和非线性资源不能落在同一个granularity页里
+    auto pages = [&](const Allocation & a){
+        VkDeviceSize size = MemoryAllocator::min_node << a.order;
+        return std::pair{a.offset / granularity,(a.offset + size - 1) / granularity};
+    };
+    bool shared = false;
+    for(auto & l : linear){
+        for(auto & o : optimal){
+            if(l.memory != o.memory)continue;
+            auto [l0,l1] = pages(l);
+            auto [o0,o1] = pages(o);
+            if(l0 <= o1 && o0 <= l1)shared = true;
+        }
+    }
+    CHECK(!shared);
+    if(granularity > MemoryAllocator::min_node){
+        for(auto & l : linear)CHECK(l.pool == (uint8_t)ResourceKind::Linear);
+        for(auto & o : optimal)CHECK(o.pool == (uint8_t)ResourceKind::Optimal);
+    }
+
+    std::vector<Allocation> all = linear;
+    all.insert(all.end(),optimal.begin(),optimal.end());
+    CHECK(!overlapping(all));
+    for(auto & a : all)allocator.free(a);
+    MemoryStats s = allocator.stats();
+    CHECK(s.allocations == 0);
+    CHECK(s.used == 0);
+    CHECK(s.wasted == 0);
+    // 两种资源分了池的话各留一个空块
+    CHECK(s.blocks <= 2);
+    CHECK(s.free == s.reserved);
+    allocator.destroy();
+}
+
+static void test_linear_pool(const Context & ctx){
+    MemoryAllocator allocator;
+    allocator.init(ctx.physicalDevice,ctx.device);
+    const uint32_t frames = 3;
+    LinearPool pool;
+    CHECK(pool.init(allocator,1000,frames,VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT));
+    VkDeviceSize region = pool.frameSize();
+    CHECK(region >= 1000);
+    CHECK(region % LinearPool::region_alignment == 0);
+
+    for(uint32_t round = 0;round < 2;++round){
+        for(uint32_t f = 0;f < frames;++f){
+            pool.beginFrame(f);
+            VkDeviceSize last = f * region;
+            bool first = true;
+            while(auto s = pool.allocate(100,64)){
+                // 只在这一帧自己的区域里往前推
+                CHECK(s->offset % 64 == 0);
+                CHECK(s->offset >= last);
+                CHECK(s->offset + s->size <= (f + 1) * region);
+                CHECK(s->buffer == pool.buffer());
+                if(first)CHECK(s->offset == f * region);
+                std::memset(s->mapped,0xab,s->size);
+                last = s->offset + s->size;
+                first = false;
+            }
+            CHECK(!first);
+            CHECK(!pool.allocate(region + 1,1));
+        }
+    }
+    CHECK(pool.peak() > 0 && pool.peak() <= region);
+    pool.destroy(allocator);
+    check_empty(allocator);
+    allocator.destroy();
+}
+
+int main(){
+    Context ctx;
+    if(!create_context(ctx)){
+        std::printf("no Vulkan device,skipped\n");
+        destroy_context(ctx);
+        return skip_code;
+    }
+    std::printf("device:%s\n",ctx.props.deviceName);
+
+    test_buddy(ctx);
+    test_fragmentation(ctx);
+    test_granularity(ctx);
+    test_linear_pool(ctx);
+
+    destroy_context(ctx);
+    if(failures)std::printf("%d checks failed\n",failures);
+    else std::printf("all checks passed\n");
+    return failures ? 1 : 0;
+}